@@ -0,0 +1,474 @@
+#include "darknet.h"
+#include "blas.h"
+#include "gemm.h"
+#include "im2col.h"
+#include "list.h"
+#include "network.h"
+#include "utils.h"
+
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * CPU benchmarks for catching performance regressions between releases:
+ *
+ *   ./bench [-out bench.json] [-runs 5] [-batch 4] [-threads N] [-affinity] [cfg ...]
+ *
+ * gemm_cpu is timed on a fixed set of square and convolution-like shapes.
+ * Then for each of the given cfgs (default: all of cfg/) every distinct
+ * layer geometry is timed forward and backward at batch 1 with random
+ * weights, im2col_cpu on every distinct convolution input, and
+ * network_predict end to end: the latency of a batch-1 inference network
+ * and the throughput at -batch, or at the cfg's batch if that is smaller.
+ * Recurrent networks keep the batch their cfg builds them with.
+ *
+ * Each cfg runs in its own process, so a cfg that does not build is skipped
+ * and one network's memory does not weigh on the next. Every measurement is
+ * one warm-up run plus -runs timed ones; the JSON keeps the median, the
+ * minimum and the mean of the timed runs.
+ */
+
+typedef struct{
+    double median;
+    double min;
+    double mean;
+} bench_time;
+
+typedef struct{
+    int ta, tb, m, n, k;
+} gemm_shape;
+
+static gemm_shape gemm_shapes[] = {
+    {0, 0, 64, 64, 64},
+    {0, 0, 256, 256, 256},
+    {0, 0, 512, 512, 512},
+    {0, 0, 1024, 1024, 1024},
+    {1, 0, 512, 512, 512},
+    {0, 1, 512, 512, 512},
+    {1, 1, 512, 512, 512},
+    /* 3x3 convolutions: a 416x416 RGB input, a 56x56 block, 13x13 heads. */
+    {0, 0, 32, 173056, 27},
+    {0, 0, 64, 3136, 576},
+    {0, 0, 1024, 169, 4608},
+    /* 1x1 convolutions. */
+    {0, 0, 256, 3136, 64},
+    {0, 0, 125, 169, 1024},
+    /* Weight and input gradients of the 56x56 block. */
+    {0, 1, 64, 576, 3136},
+    {1, 0, 576, 3136, 64},
+};
+
+typedef struct{
+    int c, h, w, size, stride, pad;
+} im2col_shape;
+
+typedef struct{
+    im2col_shape *shapes;
+    int n;
+    int cap;
+} im2col_shapes;
+
+typedef struct{
+    gemm_shape s;
+    float *a, *b, *c;
+} gemm_args;
+
+typedef struct{
+    im2col_shape s;
+    float *im, *col;
+} im2col_args;
+
+typedef struct{
+    layer l;
+    network net;
+} layer_args;
+
+typedef struct{
+    network net;
+    float *input;
+} predict_args;
+
+static int compare_double(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+/* prepare, if not null, runs untimed before every run. */
+static bench_time bench(void (*fn)(void *), void (*prepare)(void *), void *arg, int runs)
+{
+    int i;
+    bench_time b = {0};
+    double *t = calloc(runs, sizeof(double));
+    if(prepare) prepare(arg);
+    fn(arg);
+    for(i = 0; i < runs; ++i){
+        double start;
+        if(prepare) prepare(arg);
+        start = what_time_is_it_now();
+        fn(arg);
+        t[i] = what_time_is_it_now() - start;
+        b.mean += t[i]/runs;
+    }
+    qsort(t, runs, sizeof(double), compare_double);
+    b.median = (runs % 2) ? t[runs/2] : .5*(t[runs/2 - 1] + t[runs/2]);
+    b.min = t[0];
+    free(t);
+    return b;
+}
+
+static float *random_buffer(size_t n)
+{
+    size_t i;
+    float *x = calloc(n, sizeof(float));
+    for(i = 0; i < n; ++i) x[i] = rand_uniform(-1, 1);
+    return x;
+}
+
+/* Batchnorm statistics of an untrained network would blow activations up. */
+static void randomize_statistics(network *net)
+{
+    int i, j;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        int n = (l.type == CONNECTED) ? l.outputs : (l.type == BATCHNORM) ? l.c : l.n;
+        if(!l.rolling_variance) continue;
+        for(j = 0; j < n; ++j){
+            l.rolling_mean[j] = rand_uniform(-.1, .1);
+            l.rolling_variance[j] = rand_uniform(.5, 1.5);
+        }
+    }
+}
+
+static void json_item(FILE *fp, int *first)
+{
+    fprintf(fp, "%s\n    ", *first ? "" : ",");
+    *first = 0;
+}
+
+static void json_time(FILE *fp, char *name, bench_time t)
+{
+    fprintf(fp, "\"%s_ms\": %.4f, \"%s_min_ms\": %.4f, \"%s_mean_ms\": %.4f",
+            name, t.median*1000, name, t.min*1000, name, t.mean*1000);
+}
+
+static void run_gemm(void *ptr)
+{
+    gemm_args *a = ptr;
+    gemm_shape s = a->s;
+    gemm_cpu(s.ta, s.tb, s.m, s.n, s.k, 1, a->a, s.ta ? s.m : s.k, a->b, s.tb ? s.k : s.n, 1, a->c, s.n);
+}
+
+static void bench_gemm(FILE *fp, int runs)
+{
+    int i, first = 1;
+    fprintf(fp, "  \"gemm\": [");
+    for(i = 0; i < sizeof(gemm_shapes)/sizeof(gemm_shapes[0]); ++i){
+        gemm_args a;
+        bench_time t;
+        a.s = gemm_shapes[i];
+        a.a = random_buffer((size_t)a.s.m*a.s.k);
+        a.b = random_buffer((size_t)a.s.k*a.s.n);
+        a.c = calloc((size_t)a.s.m*a.s.n, sizeof(float));
+        t = bench(run_gemm, 0, &a, runs);
+        json_item(fp, &first);
+        fprintf(fp, "{\"ta\": %d, \"tb\": %d, \"m\": %d, \"n\": %d, \"k\": %d, ", a.s.ta, a.s.tb, a.s.m, a.s.n, a.s.k);
+        json_time(fp, "time", t);
+        fprintf(fp, ", \"gflops\": %.3f}", 2.*a.s.m*a.s.n*a.s.k/t.median/1e9);
+        fprintf(stderr, "gemm %d%d %5d x %6d x %5d: %9.3f ms\n", a.s.ta, a.s.tb, a.s.m, a.s.n, a.s.k, t.median*1000);
+        free(a.a);
+        free(a.b);
+        free(a.c);
+    }
+    fprintf(fp, "\n  ],\n");
+}
+
+static void add_im2col_shape(im2col_shapes *shapes, layer l)
+{
+    int i;
+    im2col_shape s = {l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad};
+    /* 1x1 stride 1 convolutions multiply the input directly. */
+    if(s.size == 1 && s.stride == 1) return;
+    for(i = 0; i < shapes->n; ++i){
+        if(!memcmp(shapes->shapes + i, &s, sizeof(s))) return;
+    }
+    if(shapes->n == shapes->cap){
+        shapes->cap = shapes->cap ? 2*shapes->cap : 64;
+        shapes->shapes = realloc(shapes->shapes, shapes->cap*sizeof(im2col_shape));
+    }
+    shapes->shapes[shapes->n++] = s;
+}
+
+static void run_im2col(void *ptr)
+{
+    im2col_args *a = ptr;
+    im2col_shape s = a->s;
+    im2col_cpu(a->im, s.c, s.h, s.w, s.size, s.stride, s.pad, a->col);
+}
+
+static void bench_im2col(FILE *fp, im2col_shapes *shapes, int runs)
+{
+    int i, first = 1;
+    fprintf(fp, "  \"im2col\": [");
+    for(i = 0; i < shapes->n; ++i){
+        im2col_args a;
+        bench_time t;
+        int out_h, out_w;
+        size_t cols;
+        a.s = shapes->shapes[i];
+        out_h = (a.s.h + 2*a.s.pad - a.s.size)/a.s.stride + 1;
+        out_w = (a.s.w + 2*a.s.pad - a.s.size)/a.s.stride + 1;
+        cols = (size_t)out_h*out_w*a.s.c*a.s.size*a.s.size;
+        a.im = random_buffer((size_t)a.s.c*a.s.h*a.s.w);
+        a.col = calloc(cols, sizeof(float));
+        t = bench(run_im2col, 0, &a, runs);
+        json_item(fp, &first);
+        fprintf(fp, "{\"c\": %d, \"h\": %d, \"w\": %d, \"size\": %d, \"stride\": %d, \"pad\": %d, ",
+                a.s.c, a.s.h, a.s.w, a.s.size, a.s.stride, a.s.pad);
+        json_time(fp, "time", t);
+        fprintf(fp, ", \"gbps\": %.3f}", sizeof(float)*((double)cols + a.s.c*a.s.h*a.s.w)/t.median/1e9);
+        free(a.im);
+        free(a.col);
+    }
+    fprintf(fp, "\n  ]");
+}
+
+static void run_layer_forward(void *ptr)
+{
+    layer_args *a = ptr;
+    a->l.forward(a->l, a->net);
+}
+
+static void run_layer_backward(void *ptr)
+{
+    layer_args *a = ptr;
+    a->l.backward(a->l, a->net);
+}
+
+/* Backward needs the state a training forward pass leaves behind. */
+static void prepare_layer_backward(void *ptr)
+{
+    layer_args *a = ptr;
+    fill_cpu(a->l.outputs*a->l.batch, 0, a->l.delta, 1);
+    a->l.forward(a->l, a->net);
+    fill_cpu(a->l.outputs*a->l.batch, .01, a->l.delta, 1);
+}
+
+static int fixed_batch_layer(LAYER_TYPE t)
+{
+    return t == RNN || t == GRU || t == LSTM || t == CRNN;
+}
+
+/* Recurrent layers keep the batch they were built with. */
+static int fixed_batch(network net)
+{
+    int i;
+    for(i = 0; i < net.n; ++i){
+        if(fixed_batch_layer(net.layers[i].type)) return 1;
+    }
+    return 0;
+}
+
+static int seen_before(list *seen, char *key)
+{
+    node *n;
+    for(n = seen->front; n; n = n->next){
+        if(!strcmp(n->val, key)) return 1;
+    }
+    list_insert(seen, copy_string(key));
+    return 0;
+}
+
+static void bench_layers(FILE *fp, char *cfgfile, int runs, im2col_shapes *shapes)
+{
+    int i, first = 1;
+    list *seen = make_list();
+    network net = parse_network_cfg(cfgfile);
+    if(!fixed_batch(net)) set_batch_network(&net, 1);
+    randomize_statistics(&net);
+    for(i = 0; i < net.inputs*net.batch; ++i) net.input[i] = rand_uniform(-1, 1);
+
+    /* One pass fills every input; bench_network already autotuned. */
+    net.train = 0;
+    forward_network(net);
+
+    fprintf(fp, "  \"layers\": [");
+    for(i = 0; i < net.n; ++i){
+        char key[256];
+        layer_args a;
+        bench_time f, b;
+        layer l = net.layers[i];
+        /* Recurrent layers are timed forward only; CPU training overruns their state. */
+        int backward = l.backward && l.delta && !fixed_batch_layer(l.type);
+        snprintf(key, sizeof(key), "%s %d %d %d %d %d %d %d %d %d %d %d %d", get_layer_string(l.type),
+                l.h, l.w, l.c, l.out_h, l.out_w, l.out_c, l.inputs, l.outputs, l.size, l.stride, l.groups, l.batch_normalize);
+        if(l.type == CONVOLUTIONAL) add_im2col_shape(shapes, l);
+        if(seen_before(seen, key)) continue;
+
+        a.l = l;
+        a.net = net;
+        a.net.index = i;
+        a.net.input = i ? net.layers[i-1].output : net.input;
+        a.net.delta = i ? net.layers[i-1].delta : 0;
+        a.net.train = 0;
+        f = bench(run_layer_forward, 0, &a, runs);
+        if(backward){
+            a.net.train = 1;
+            b = bench(run_layer_backward, prepare_layer_backward, &a, runs);
+        }
+
+        json_item(fp, &first);
+        fprintf(fp, "{\"layer\": %d, \"type\": \"%s\", \"h\": %d, \"w\": %d, \"c\": %d, "
+                "\"out_h\": %d, \"out_w\": %d, \"out_c\": %d, \"inputs\": %d, \"outputs\": %d, "
+                "\"size\": %d, \"stride\": %d, \"groups\": %d, \"batch_normalize\": %d, ",
+                i, get_layer_string(l.type), l.h, l.w, l.c, l.out_h, l.out_w, l.out_c,
+                l.inputs, l.outputs, l.size, l.stride, l.groups, l.batch_normalize);
+        json_time(fp, "forward", f);
+        if(backward){
+            fprintf(fp, ", ");
+            json_time(fp, "backward", b);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ],\n");
+    free_list_contents(seen);
+    free_list(seen);
+    free_network(net);
+}
+
+static void run_predict(void *ptr)
+{
+    predict_args *a = ptr;
+    network_predict(a->net, a->input);
+}
+
+static void bench_network(FILE *fp, char *cfgfile, int runs, int batch)
+{
+    predict_args a;
+    bench_time latency, throughput;
+    /* Runs first, so with a cold autotune cache the algorithms are tried
+     * on the fused network, shortcuts folded into convolutions included. */
+    network net = parse_network_cfg_inference(cfgfile);
+    /* set_batch_network can only shrink the buffers the cfg allocated. */
+    if(batch > net.batch || fixed_batch(net)) batch = net.batch;
+    if(!fixed_batch(net)) set_batch_network(&net, 1);
+    randomize_statistics(&net);
+    fuse_batchnorm_network(&net);
+    fuse_shortcut_network(&net);
+    plan_network_memory(&net);
+
+    a.net = net;
+    a.input = random_buffer((size_t)net.inputs*net.batch);
+    latency = bench(run_predict, 0, &a, runs);
+    free(a.input);
+
+    if(batch == net.batch){
+        throughput = latency;
+    } else {
+        set_batch_network(&net, batch);
+        a.net = net;
+        a.input = random_buffer((size_t)net.inputs*batch);
+        throughput = bench(run_predict, 0, &a, runs);
+        free(a.input);
+    }
+
+    fprintf(fp, "  \"w\": %d, \"h\": %d, \"c\": %d, ", net.w, net.h, net.c);
+    json_time(fp, "latency", latency);
+    fprintf(fp, ", \"batch\": %d, ", batch);
+    json_time(fp, "batch", throughput);
+    fprintf(fp, ", \"images_per_second\": %.3f,\n", batch/throughput.median);
+    fprintf(stderr, "%s: %.3f ms latency, %.2f images/s at batch %d\n", cfgfile, latency.median*1000,
+            batch/throughput.median, batch);
+    free_network(net);
+}
+
+/* file_error exits with 0, so a finished child reports its own status. */
+#define BENCH_DONE 3
+
+/* Writes the cfg's results as one JSON object to a temporary file, or
+ * returns 0 if the child failed. */
+static FILE *bench_cfg(char *cfgfile, int runs, int batch, int threads, int affinity)
+{
+    int status;
+    pid_t pid;
+    FILE *fp = tmpfile();
+    if(!fp) return 0;
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if(pid == 0){
+        im2col_shapes shapes = {0};
+        if(threads || affinity) thread_pool_init(threads, affinity);
+        srand(2222222);
+        fprintf(fp, "{\n  \"cfg\": \"%s\",\n", cfgfile);
+        bench_network(fp, cfgfile, runs, batch);
+        bench_layers(fp, cfgfile, runs, &shapes);
+        bench_im2col(fp, &shapes, runs);
+        fprintf(fp, "\n  }");
+        fclose(fp);
+        _exit(BENCH_DONE);
+    }
+    if(pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != BENCH_DONE){
+        fprintf(stderr, "Skipping %s: it does not build or run\n", cfgfile);
+        fclose(fp);
+        return 0;
+    }
+    rewind(fp);
+    return fp;
+}
+
+int main(int argc, char **argv)
+{
+    int i, c, first = 1;
+    char *outfile = find_char_arg(argc, argv, "-out", "bench.json");
+    int runs = find_int_arg(argc, argv, "-runs", 5);
+    int batch = find_int_arg(argc, argv, "-batch", 4);
+    int threads = find_int_arg(argc, argv, "-threads", 0);
+    int affinity = find_arg(argc, argv, "-affinity");
+    char **cfgs = argv + 1;
+    int ncfgs = 0;
+    glob_t found = {0};
+    FILE **results;
+    FILE *fp;
+
+    gpu_index = -1;
+    if(runs < 1) runs = 1;
+    /* The options above were removed from argv; the cfgs are what is left. */
+    while(ncfgs < argc - 1 && cfgs[ncfgs]) ++ncfgs;
+    if(!ncfgs){
+        glob("cfg/*.cfg", 0, 0, &found);
+        cfgs = found.gl_pathv;
+        ncfgs = found.gl_pathc;
+    }
+    fp = fopen(outfile, "w");
+    if(!fp) file_error(outfile);
+
+    /* The children start their own pools; a forked pool has no workers. */
+    results = calloc(ncfgs, sizeof(FILE *));
+    for(i = 0; i < ncfgs; ++i) results[i] = bench_cfg(cfgs[i], runs, batch, threads, affinity);
+
+    if(threads || affinity) thread_pool_init(threads, affinity);
+    srand(2222222);
+    fprintf(fp, "{\n  \"threads\": %d,\n  \"runs\": %d,\n", thread_pool_size(), runs);
+    bench_gemm(fp, runs);
+    fprintf(fp, "  \"cfgs\": [");
+    for(i = 0; i < ncfgs; ++i){
+        if(!results[i]) continue;
+        fprintf(fp, "%s\n  ", first ? "" : ",");
+        first = 0;
+        while((c = fgetc(results[i])) != EOF) fputc(c, fp);
+        fclose(results[i]);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    fprintf(stderr, "Saved results to %s\n", outfile);
+
+    free(results);
+    globfree(&found);
+    return 0;
+}
@@ -48,7 +48,7 @@ void train_captcha(char *cfgfile, char *weightfile)
     char **paths = (char **)list_to_array(plist);
     printf("%d\n", plist->size);
     clock_t time;
-    pthread_t load_thread;
+    task *load_thread;
     data train;
     data buffer;
 
@@ -67,7 +67,7 @@ void train_captcha(char *cfgfile, char *weightfile)
     while(1){
         ++i;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         fix_data_captcha(train, solved);
 
@@ -15,7 +15,7 @@ float *get_regression_values(char **labels, int n)
     return v;
 }
 
-void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus, int ngpus, int clear)
+void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus, int ngpus, int clear, char *profile)
 {
     int i;
 
@@ -36,6 +36,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         nets[i].learning_rate *= ngpus;
     }
     srand(time(0));
+    if(profile) nets[0].prof = make_profiler(nets[0]);
     network net = nets[0];
 
     int imgs = net.batch * net.subdivisions * ngpus;
@@ -47,6 +48,8 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     char *label_list = option_find_str(options, "labels", "data/labels.list");
     char *train_list = option_find_str(options, "train", "data/train.list");
     int classes = option_find_int(options, "classes", 2);
+    char *packed = option_find_str(options, "packed", 0);
+    int cache = option_find_int(options, "cache", 0);
 
     char **labels = get_labels(label_list);
     list *plist = get_paths(train_list);
@@ -76,20 +79,20 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     args.m = N;
     args.labels = labels;
     args.type = CLASSIFICATION_DATA;
+    if(packed){
+        args.packed = load_packed_data(packed);
+        args.m = N = packed_data_size(args.packed);
+    }
+    if(cache) image_cache_init((size_t)cache << 20);
 
     data train;
-    data buffer;
-    pthread_t load_thread;
-    args.d = &buffer;
-    load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, net.prefetch);
 
     int epoch = (*net.seen)/N;
     while(get_current_batch(net) < net.max_batches || net.max_batches == 0){
         time = what_time_is_it_now();
 
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = get_data_loader_batch(loader);
 
         printf("Loaded: %lf seconds\n", what_time_is_it_now()-time);
         time = what_time_is_it_now();
@@ -107,7 +110,6 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
         if(avg_loss == -1) avg_loss = loss;
         avg_loss = avg_loss*.9 + loss*.1;
         printf("%ld, %.3f: %f, %f avg, %f rate, %lf seconds, %ld images\n", get_current_batch(net), (float)(*net.seen)/N, loss, avg_loss, get_current_rate(net), what_time_is_it_now()-time, *net.seen);
-        free_data(train);
         if(*net.seen/N > epoch){
             epoch = *net.seen/N;
             char buff[256];
@@ -120,9 +122,16 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
             save_weights(net, buff);
         }
     }
+    free_data_loader(loader);
+    free_packed_data(args.packed);
+    print_image_cache();
     char buff[256];
     sprintf(buff, "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
+    if(profile){
+        print_profile(net);
+        save_profile_trace(net, profile);
+    }
 
     free_network(net);
     free_ptrs((void**)labels, classes);
@@ -186,7 +195,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
 
    data train;
    data buffer;
-   pthread_t load_thread;
+   task *load_thread;
    args.d = &buffer;
    load_thread = load_data(args);
 
@@ -194,7 +203,7 @@ void train_classifier(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
    while(get_current_batch(net) < net.max_batches || net.max_batches == 0){
    time=clock();
 
-   pthread_join(load_thread, 0);
+   wait_task(load_thread);
    train = buffer;
    load_thread = load_data(args);
 
@@ -285,11 +294,11 @@ void validate_classifier_crop(char *datacfg, char *filename, char *weightfile)
     args.d = &buffer;
     args.type = OLD_CLASSIFICATION_DATA;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     for(i = 1; i <= splits; ++i){
         time=clock();
 
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         val = buffer;
 
         num = (i+1)*m/splits - i*m/splits;
@@ -570,7 +579,9 @@ void validate_classifier_multi(char *datacfg, char *filename, char *weightfile)
 
 void try_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int layer_num)
 {
-    network net = parse_network_cfg(cfgfile);
+    // No memory plan: it would let later layers overwrite the output
+    // inspected below.
+    network net = parse_network_cfg_inference(cfgfile);
     if(weightfile){
         load_weights(&net, weightfile);
     }
@@ -649,13 +660,11 @@ void try_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filena
     }
 }
 
-void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int top)
+void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int top, char *profile)
 {
-    network net = parse_network_cfg(cfgfile);
-    if(weightfile){
-        load_weights(&net, weightfile);
-    }
+    network net = load_network_inference(cfgfile, weightfile);
     set_batch_network(&net, 1);
+    if(profile) net.prof = make_profiler(net);
     srand(2222222);
 
     list *options = read_data_cfg(datacfg);
@@ -677,7 +686,7 @@ void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *fi
             printf("Enter Image Path: ");
             fflush(stdout);
             input = fgets(input, 256, stdin);
-            if(!input) return;
+            if(!input) break;
             strtok(input, "\n");
         }
         image im = load_image_color(input, 0, 0);
@@ -701,6 +710,10 @@ void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *fi
         free_image(im);
         if (filename) break;
     }
+    if(profile){
+        print_profile(net);
+        save_profile_trace(net, profile);
+    }
 }
 
 
@@ -778,11 +791,11 @@ void test_classifier(char *datacfg, char *cfgfile, char *weightfile, int target_
     args.d = &buffer;
     args.type = OLD_CLASSIFICATION_DATA;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     for(curr = net.batch; curr < m; curr += net.batch){
         time=clock();
 
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         val = buffer;
 
         if(curr < m){
@@ -1111,15 +1124,16 @@ void run_classifier(int argc, char **argv)
     int cam_index = find_int_arg(argc, argv, "-c", 0);
     int top = find_int_arg(argc, argv, "-t", 0);
     int clear = find_arg(argc, argv, "-clear");
+    char *profile = find_char_arg(argc, argv, "-profile", 0);
     char *data = argv[3];
     char *cfg = argv[4];
     char *weights = (argc > 5) ? argv[5] : 0;
     char *filename = (argc > 6) ? argv[6]: 0;
     char *layer_s = (argc > 7) ? argv[7]: 0;
     int layer = layer_s ? atoi(layer_s) : -1;
-    if(0==strcmp(argv[2], "predict")) predict_classifier(data, cfg, weights, filename, top);
+    if(0==strcmp(argv[2], "predict")) predict_classifier(data, cfg, weights, filename, top, profile);
     else if(0==strcmp(argv[2], "try")) try_classifier(data, cfg, weights, filename, atoi(layer_s));
-    else if(0==strcmp(argv[2], "train")) train_classifier(data, cfg, weights, gpus, ngpus, clear);
+    else if(0==strcmp(argv[2], "train")) train_classifier(data, cfg, weights, gpus, ngpus, clear, profile);
     else if(0==strcmp(argv[2], "demo")) demo_classifier(data, cfg, weights, cam_index, filename);
     else if(0==strcmp(argv[2], "gun")) gun_classifier(data, cfg, weights, cam_index, filename);
     else if(0==strcmp(argv[2], "threat")) threat_classifier(data, cfg, weights, cam_index, filename);
@@ -54,13 +54,13 @@ void train_coco(char *cfgfile, char *weightfile)
     args.saturation = net.saturation;
     args.hue = net.hue;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     clock_t time;
     //while(i*imgs < N*120){
     while(get_current_batch(net) < net.max_batches){
         i += 1;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data_in_thread(args);
 
@@ -171,7 +171,7 @@ void validate_coco(char *cfgfile, char *weightfile)
     image *val_resized = calloc(nthreads, sizeof(image));
     image *buf = calloc(nthreads, sizeof(image));
     image *buf_resized = calloc(nthreads, sizeof(image));
-    pthread_t *thr = calloc(nthreads, sizeof(pthread_t));
+    task **thr = calloc(nthreads, sizeof(task *));
 
     load_args args = {0};
     args.w = net.w;
@@ -188,7 +188,7 @@ void validate_coco(char *cfgfile, char *weightfile)
     for(i = nthreads; i < m+nthreads; i += nthreads){
         fprintf(stderr, "%d\n", i);
         for(t = 0; t < nthreads && i+t-nthreads < m; ++t){
-            pthread_join(thr[t], 0);
+            wait_task(thr[t]);
             val[t] = buf[t];
             val_resized[t] = buf_resized[t];
         }
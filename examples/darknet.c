@@ -1,11 +1,12 @@
 #include "darknet.h"
 
 #include <time.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 
-extern void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int top);
-extern void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, char *outfile, int fullscreen);
+extern void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int top, char *profile);
+extern void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, char *outfile, int fullscreen, char *profile);
 extern void run_voxel(int argc, char **argv);
 extern void run_yolo(int argc, char **argv);
 extern void run_detector(int argc, char **argv);
@@ -390,6 +391,63 @@ void mkimg(char *cfgfile, char *weightfile, int h, int w, int num, char *prefix)
     }
 }
 
+void quantize_net(char *cfgfile, char *weightfile, char *listfile, char *outfile, int max)
+{
+    gpu_index = -1;
+    network net = parse_network_cfg(cfgfile);
+    if(weightfile){
+        load_weights(&net, weightfile);
+    }
+    list *plist = get_paths(listfile);
+    char **paths = (char **)list_to_array(plist);
+    int n = (max > 0 && max < plist->size) ? max : plist->size;
+
+    set_batch_network(&net, 1);
+    image im = load_image_color(paths[0], 0, 0);
+    image sized = letterbox_image(im, net.w, net.h);
+    float *ref = calloc(net.outputs, sizeof(float));
+    memcpy(ref, network_predict(net, sized.data), net.outputs*sizeof(float));
+
+    quantize_network(&net, paths, n);
+
+    float *out = network_predict(net, sized.data);
+    float err = 0, mag = 0;
+    int i;
+    for(i = 0; i < net.outputs; ++i){
+        err = fmax(err, fabs(out[i] - ref[i]));
+        mag = fmax(mag, fabs(ref[i]));
+    }
+    printf("Max output error %f (max output %f) on %s\n", err, mag, paths[0]);
+    save_weights(net, outfile);
+
+    free(ref);
+    free_image(im);
+    free_image(sized);
+    free(paths);
+    free_list(plist);
+}
+
+void compile_net(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network net = parse_network_cfg_inference(cfgfile);
+    if(weightfile){
+        load_weights(&net, weightfile);
+    }
+    fuse_batchnorm_network(&net);
+    save_compiled_network(net, cfgfile, outfile);
+    free_network(net);
+}
+
+void pack_data(char *listfile, char *outfile, int max_side, int shard_mb)
+{
+    list *plist = get_paths(listfile);
+    char **paths = (char **)list_to_array(plist);
+    pack_dataset(paths, plist->size, outfile, max_side, (size_t)shard_mb << 20);
+    free_ptrs((void **)paths, plist->size);
+    free_list(plist);
+}
+
 void visualize(char *cfgfile, char *weightfile)
 {
     network net = parse_network_cfg(cfgfile);
@@ -411,6 +469,10 @@ int main(int argc, char **argv)
         fprintf(stderr, "usage: %s <function>\n", argv[0]);
         return 0;
     }
+    int threads = find_int_arg(argc, argv, "-threads", 0);
+    int affinity = find_arg(argc, argv, "-affinity");
+    if(threads || affinity) thread_pool_init(threads, affinity);
+
     gpu_index = find_int_arg(argc, argv, "-i", 0);
     if(find_arg(argc, argv, "-nogpu")) {
         gpu_index = -1;
@@ -441,7 +503,7 @@ int main(int argc, char **argv)
         char *filename = (argc > 4) ? argv[4]: 0;
         char *outfile = find_char_arg(argc, argv, "-out", 0);
         int fullscreen = find_arg(argc, argv, "-fullscreen");
-        test_detector("cfg/coco.data", argv[2], argv[3], filename, thresh, .5, outfile, fullscreen);
+        test_detector("cfg/coco.data", argv[2], argv[3], filename, thresh, .5, outfile, fullscreen, 0);
     } else if (0 == strcmp(argv[1], "cifar")){
         run_cifar(argc, argv);
     } else if (0 == strcmp(argv[1], "go")){
@@ -453,7 +515,7 @@ int main(int argc, char **argv)
     } else if (0 == strcmp(argv[1], "coco")){
         run_coco(argc, argv);
     } else if (0 == strcmp(argv[1], "classify")){
-        predict_classifier("cfg/imagenet1k.data", argv[2], argv[3], argv[4], 5);
+        predict_classifier("cfg/imagenet1k.data", argv[2], argv[3], argv[4], 5, 0);
     } else if (0 == strcmp(argv[1], "classifier")){
         run_classifier(argc, argv);
     } else if (0 == strcmp(argv[1], "regressor")){
@@ -502,6 +564,23 @@ int main(int argc, char **argv)
         partial(argv[2], argv[3], argv[4], atoi(argv[5]));
     } else if (0 == strcmp(argv[1], "average")){
         average(argc, argv);
+    } else if (0 == strcmp(argv[1], "quantize")){
+        int max = find_int_arg(argc, argv, "-n", 0);
+        quantize_net(argv[2], argv[3], argv[4], argv[5], max);
+    } else if (0 == strcmp(argv[1], "compile")){
+        if(argc < 5){
+            fprintf(stderr, "usage: %s compile <cfg> <weights> <output>\n", argv[0]);
+            return 0;
+        }
+        compile_net(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "pack")){
+        if(argc < 4){
+            fprintf(stderr, "usage: %s pack <list> <output> [-max size] [-shard MB]\n", argv[0]);
+            return 0;
+        }
+        int max = find_int_arg(argc, argv, "-max", 0);
+        int shard = find_int_arg(argc, argv, "-shard", 1024);
+        pack_data(argv[2], argv[3], max, shard);
     } else if (0 == strcmp(argv[1], "visualize")){
         visualize(argv[2], (argc > 3) ? argv[3] : 0);
     } else if (0 == strcmp(argv[1], "mkimg")){
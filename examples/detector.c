@@ -2,11 +2,13 @@
 
 static int coco_ids[] = {1,2,3,4,5,6,7,8,9,10,11,13,14,15,16,17,18,19,20,21,22,23,24,25,27,28,31,32,33,34,35,36,37,38,39,40,41,42,43,44,46,47,48,49,50,51,52,53,54,55,56,57,58,59,60,61,62,63,64,65,67,70,72,73,74,75,76,77,78,79,80,81,82,84,85,86,87,88,89,90};
 
-void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, int ngpus, int clear)
+void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, int ngpus, int clear, char *profile)
 {
     list *options = read_data_cfg(datacfg);
     char *train_images = option_find_str(options, "train", "data/train.list");
     char *backup_directory = option_find_str(options, "backup", "/backup/");
+    char *packed = option_find_str(options, "packed", 0);
+    int cache = option_find_int(options, "cache", 0);
 
     srand(time(0));
     char *base = basecfg(cfgfile);
@@ -26,11 +28,12 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
         nets[i].learning_rate *= ngpus;
     }
     srand(time(0));
+    if(profile) nets[0].prof = make_profiler(nets[0]);
     network net = nets[0];
 
     int imgs = net.batch * net.subdivisions * ngpus;
     printf("Learning Rate: %g, Momentum: %g, Decay: %g\n", net.learning_rate, net.momentum, net.decay);
-    data train, buffer;
+    data train;
 
     layer l = net.layers[net.n - 1];
 
@@ -49,12 +52,16 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     args.classes = classes;
     args.jitter = jitter;
     args.num_boxes = l.max_boxes;
-    args.d = &buffer;
     args.type = DETECTION_DATA;
     //args.type = INSTANCE_DATA;
     args.threads = 8;
+    if(packed){
+        args.packed = load_packed_data(packed);
+        args.m = packed_data_size(args.packed);
+    }
+    if(cache) image_cache_init((size_t)cache << 20);
 
-    pthread_t load_thread = load_data(args);
+    data_loader *loader = make_data_loader(args, net.prefetch);
     clock_t time;
     int count = 0;
     //while(i*imgs < N*120){
@@ -65,13 +72,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             if (get_current_batch(net)+200 > net.max_batches) dim = 608;
             //int dim = (rand() % 4 + 16) * 32;
             printf("%d\n", dim);
-            args.w = dim;
-            args.h = dim;
-
-            pthread_join(load_thread, 0);
-            train = buffer;
-            free_data(train);
-            load_thread = load_data(args);
+            resize_data_loader(loader, dim, dim);
 
             for(i = 0; i < ngpus; ++i){
                 resize_network(nets + i, dim, dim);
@@ -79,9 +80,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             net = nets[0];
         }
         time=clock();
-        pthread_join(load_thread, 0);
-        train = buffer;
-        load_thread = load_data(args);
+        train = get_data_loader_batch(loader);
 
         /*
         int k;
@@ -141,14 +140,20 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             sprintf(buff, "%s/%s_%d.weights", backup_directory, base, i);
             save_weights(net, buff);
         }
-        free_data(train);
     }
+    free_data_loader(loader);
+    free_packed_data(args.packed);
+    print_image_cache();
 #ifdef GPU
     if(ngpus != 1) sync_nets(nets, ngpus, 0);
 #endif
     char buff[256];
     sprintf(buff, "%s/%s_final.weights", backup_directory, base);
     save_weights(net, buff);
+    if(profile){
+        print_profile(net);
+        save_profile_trace(net, profile);
+    }
 }
 
 
@@ -158,15 +163,16 @@ static int get_coco_image_id(char *filename)
     return atoi(p+1);
 }
 
-static void print_cocos(FILE *fp, char *image_path, box *boxes, float **probs, int num_boxes, int classes, int w, int h)
+static void print_cocos(FILE *fp, char *image_path, detection *dets, int num, int w, int h)
 {
-    int i, j;
+    int i;
     int image_id = get_coco_image_id(image_path);
-    for(i = 0; i < num_boxes; ++i){
-        float xmin = boxes[i].x - boxes[i].w/2.;
-        float xmax = boxes[i].x + boxes[i].w/2.;
-        float ymin = boxes[i].y - boxes[i].h/2.;
-        float ymax = boxes[i].y + boxes[i].h/2.;
+    for(i = 0; i < num; ++i){
+        box b = dets[i].bbox;
+        float xmin = b.x - b.w/2.;
+        float xmax = b.x + b.w/2.;
+        float ymin = b.y - b.h/2.;
+        float ymax = b.y + b.h/2.;
 
         if (xmin < 0) xmin = 0;
         if (ymin < 0) ymin = 0;
@@ -178,52 +184,47 @@ static void print_cocos(FILE *fp, char *image_path, box *boxes, float **probs, i
         float bw = xmax - xmin;
         float bh = ymax - ymin;
 
-        for(j = 0; j < classes; ++j){
-            if (probs[i][j]) fprintf(fp, "{\"image_id\":%d, \"category_id\":%d, \"bbox\":[%f, %f, %f, %f], \"score\":%f},\n", image_id, coco_ids[j], bx, by, bw, bh, probs[i][j]);
-        }
+        fprintf(fp, "{\"image_id\":%d, \"category_id\":%d, \"bbox\":[%f, %f, %f, %f], \"score\":%f},\n", image_id, coco_ids[dets[i].class], bx, by, bw, bh, dets[i].prob);
     }
 }
 
-void print_detector_detections(FILE **fps, char *id, box *boxes, float **probs, int total, int classes, int w, int h)
+void print_detector_detections(FILE **fps, char *id, detection *dets, int num, int w, int h)
 {
-    int i, j;
-    for(i = 0; i < total; ++i){
-        float xmin = boxes[i].x - boxes[i].w/2. + 1;
-        float xmax = boxes[i].x + boxes[i].w/2. + 1;
-        float ymin = boxes[i].y - boxes[i].h/2. + 1;
-        float ymax = boxes[i].y + boxes[i].h/2. + 1;
+    int i;
+    for(i = 0; i < num; ++i){
+        box b = dets[i].bbox;
+        float xmin = b.x - b.w/2. + 1;
+        float xmax = b.x + b.w/2. + 1;
+        float ymin = b.y - b.h/2. + 1;
+        float ymax = b.y + b.h/2. + 1;
 
         if (xmin < 1) xmin = 1;
         if (ymin < 1) ymin = 1;
         if (xmax > w) xmax = w;
         if (ymax > h) ymax = h;
 
-        for(j = 0; j < classes; ++j){
-            if (probs[i][j]) fprintf(fps[j], "%s %f %f %f %f %f\n", id, probs[i][j],
-                    xmin, ymin, xmax, ymax);
-        }
+        fprintf(fps[dets[i].class], "%s %f %f %f %f %f\n", id, dets[i].prob,
+                xmin, ymin, xmax, ymax);
     }
 }
 
-void print_imagenet_detections(FILE *fp, int id, box *boxes, float **probs, int total, int classes, int w, int h)
+void print_imagenet_detections(FILE *fp, int id, detection *dets, int num, int w, int h)
 {
-    int i, j;
-    for(i = 0; i < total; ++i){
-        float xmin = boxes[i].x - boxes[i].w/2.;
-        float xmax = boxes[i].x + boxes[i].w/2.;
-        float ymin = boxes[i].y - boxes[i].h/2.;
-        float ymax = boxes[i].y + boxes[i].h/2.;
+    int i;
+    for(i = 0; i < num; ++i){
+        box b = dets[i].bbox;
+        float xmin = b.x - b.w/2.;
+        float xmax = b.x + b.w/2.;
+        float ymin = b.y - b.h/2.;
+        float ymax = b.y + b.h/2.;
 
         if (xmin < 0) xmin = 0;
         if (ymin < 0) ymin = 0;
         if (xmax > w) xmax = w;
         if (ymax > h) ymax = h;
 
-        for(j = 0; j < classes; ++j){
-            int class = j;
-            if (probs[i][class]) fprintf(fp, "%d %d %f %f %f %f %f\n", id, j+1, probs[i][class],
-                    xmin, ymin, xmax, ymax);
-        }
+        fprintf(fp, "%d %d %f %f %f %f %f\n", id, dets[i].class+1, dets[i].prob,
+                xmin, ymin, xmax, ymax);
     }
 }
 
@@ -239,10 +240,7 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
     int *map = 0;
     if (mapf) map = read_map(mapf);
 
-    network net = parse_network_cfg(cfgfile);
-    if(weightfile){
-        load_weights(&net, weightfile);
-    }
+    network net = load_network_inference(cfgfile, weightfile);
     set_batch_network(&net, 2);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net.learning_rate, net.momentum, net.decay);
     srand(time(0));
@@ -281,10 +279,6 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
     }
 
 
-    box *boxes = calloc(l.w*l.h*l.n, sizeof(box));
-    float **probs = calloc(l.w*l.h*l.n, sizeof(float *));
-    for(j = 0; j < l.w*l.h*l.n; ++j) probs[j] = calloc(classes+1, sizeof(float *));
-
     int m = plist->size;
     int i=0;
     int t;
@@ -297,7 +291,7 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
     image *val_resized = calloc(nthreads, sizeof(image));
     image *buf = calloc(nthreads, sizeof(image));
     image *buf_resized = calloc(nthreads, sizeof(image));
-    pthread_t *thr = calloc(nthreads, sizeof(pthread_t));
+    task **thr = calloc(nthreads, sizeof(task *));
 
     image input = make_image(net.w, net.h, net.c*2);
 
@@ -317,7 +311,7 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
     for(i = nthreads; i < m+nthreads; i += nthreads){
         fprintf(stderr, "%d\n", i);
         for(t = 0; t < nthreads && i+t-nthreads < m; ++t){
-            pthread_join(thr[t], 0);
+            wait_task(thr[t]);
             val[t] = buf[t];
             val_resized[t] = buf_resized[t];
         }
@@ -337,15 +331,17 @@ void validate_detector_flip(char *datacfg, char *cfgfile, char *weightfile, char
             network_predict(net, input.data);
             int w = val[t].w;
             int h = val[t].h;
-            get_region_boxes(l, w, h, net.w, net.h, thresh, probs, boxes, 0, 0, map, .5, 0);
-            if (nms) do_nms_sort(boxes, probs, l.w*l.h*l.n, classes, nms);
+            int num = 0;
+            detection *dets = get_region_detections(l, w, h, net.w, net.h, thresh, map, .5, 0, &num);
+            if (nms) num = do_nms_detections(dets, num, nms);
             if (coco){
-                print_cocos(fp, path, boxes, probs, l.w*l.h*l.n, classes, w, h);
+                print_cocos(fp, path, dets, num, w, h);
             } else if (imagenet){
-                print_imagenet_detections(fp, i+t-nthreads+1, boxes, probs, l.w*l.h*l.n, classes, w, h);
+                print_imagenet_detections(fp, i+t-nthreads+1, dets, num, w, h);
             } else {
-                print_detector_detections(fps, id, boxes, probs, l.w*l.h*l.n, classes, w, h);
+                print_detector_detections(fps, id, dets, num, w, h);
             }
+            free_detections(dets, num);
             free(id);
             free_image(val[t]);
             free_image(val_resized[t]);
@@ -375,10 +371,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     int *map = 0;
     if (mapf) map = read_map(mapf);
 
-    network net = parse_network_cfg(cfgfile);
-    if(weightfile){
-        load_weights(&net, weightfile);
-    }
+    network net = load_network_inference(cfgfile, weightfile);
     set_batch_network(&net, 1);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net.learning_rate, net.momentum, net.decay);
     srand(time(0));
@@ -417,10 +410,6 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     }
 
 
-    box *boxes = calloc(l.w*l.h*l.n, sizeof(box));
-    float **probs = calloc(l.w*l.h*l.n, sizeof(float *));
-    for(j = 0; j < l.w*l.h*l.n; ++j) probs[j] = calloc(classes+1, sizeof(float *));
-
     int m = plist->size;
     int i=0;
     int t;
@@ -433,7 +422,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     image *val_resized = calloc(nthreads, sizeof(image));
     image *buf = calloc(nthreads, sizeof(image));
     image *buf_resized = calloc(nthreads, sizeof(image));
-    pthread_t *thr = calloc(nthreads, sizeof(pthread_t));
+    task **thr = calloc(nthreads, sizeof(task *));
 
     load_args args = {0};
     args.w = net.w;
@@ -451,7 +440,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     for(i = nthreads; i < m+nthreads; i += nthreads){
         fprintf(stderr, "%d\n", i);
         for(t = 0; t < nthreads && i+t-nthreads < m; ++t){
-            pthread_join(thr[t], 0);
+            wait_task(thr[t]);
             val[t] = buf[t];
             val_resized[t] = buf_resized[t];
         }
@@ -468,15 +457,17 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
             network_predict(net, X);
             int w = val[t].w;
             int h = val[t].h;
-            get_region_boxes(l, w, h, net.w, net.h, thresh, probs, boxes, 0, 0, map, .5, 0);
-            if (nms) do_nms_sort(boxes, probs, l.w*l.h*l.n, classes, nms);
+            int num = 0;
+            detection *dets = get_region_detections(l, w, h, net.w, net.h, thresh, map, .5, 0, &num);
+            if (nms) num = do_nms_detections(dets, num, nms);
             if (coco){
-                print_cocos(fp, path, boxes, probs, l.w*l.h*l.n, classes, w, h);
+                print_cocos(fp, path, dets, num, w, h);
             } else if (imagenet){
-                print_imagenet_detections(fp, i+t-nthreads+1, boxes, probs, l.w*l.h*l.n, classes, w, h);
+                print_imagenet_detections(fp, i+t-nthreads+1, dets, num, w, h);
             } else {
-                print_detector_detections(fps, id, boxes, probs, l.w*l.h*l.n, classes, w, h);
+                print_detector_detections(fps, id, dets, num, w, h);
             }
+            free_detections(dets, num);
             free(id);
             free_image(val[t]);
             free_image(val_resized[t]);
@@ -495,10 +486,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
 
 void validate_detector_recall(char *cfgfile, char *weightfile)
 {
-    network net = parse_network_cfg(cfgfile);
-    if(weightfile){
-        load_weights(&net, weightfile);
-    }
+    network net = load_network_inference(cfgfile, weightfile);
     set_batch_network(&net, 1);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net.learning_rate, net.momentum, net.decay);
     srand(time(0));
@@ -571,23 +559,20 @@ void validate_detector_recall(char *cfgfile, char *weightfile)
     }
 }
 
-void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, char *outfile, int fullscreen)
+void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filename, float thresh, float hier_thresh, char *outfile, int fullscreen, char *profile)
 {
     list *options = read_data_cfg(datacfg);
     char *name_list = option_find_str(options, "names", "data/names.list");
     char **names = get_labels(name_list);
 
     image **alphabet = load_alphabet();
-    network net = parse_network_cfg(cfgfile);
-    if(weightfile){
-        load_weights(&net, weightfile);
-    }
+    network net = load_network_inference(cfgfile, weightfile);
     set_batch_network(&net, 1);
+    if(profile) net.prof = make_profiler(net);
     srand(2222222);
     double time;
     char buff[256];
     char *input = buff;
-    int j;
     float nms=.3;
     while(1){
         if(filename){
@@ -596,34 +581,27 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
             printf("Enter Image Path: ");
             fflush(stdout);
             input = fgets(input, 256, stdin);
-            if(!input) return;
+            if(!input) break;
             strtok(input, "\n");
         }
         image im = load_image_color(input,0,0);
-        image sized = letterbox_image(im, net.w, net.h);
+        image sized = float_to_image(net.w, net.h, im.c, net.input);
+        letterbox_image_into(im, net.w, net.h, sized);
         //image sized = resize_image(im, net.w, net.h);
         //image sized2 = resize_max(im, net.w);
         //image sized = crop_image(sized2, -((net.w - sized2.w)/2), -((net.h - sized2.h)/2), net.w, net.h);
         //resize_network(&net, sized.w, sized.h);
         layer l = net.layers[net.n-1];
 
-        box *boxes = calloc(l.w*l.h*l.n, sizeof(box));
-        float **probs = calloc(l.w*l.h*l.n, sizeof(float *));
-        for(j = 0; j < l.w*l.h*l.n; ++j) probs[j] = calloc(l.classes + 1, sizeof(float *));
-        float **masks = 0;
-        if (l.coords > 4){
-            masks = calloc(l.w*l.h*l.n, sizeof(float*));
-            for(j = 0; j < l.w*l.h*l.n; ++j) masks[j] = calloc(l.coords-4, sizeof(float *));
-        }
-
         float *X = sized.data;
         time=what_time_is_it_now();
         network_predict(net, X);
         printf("%s: Predicted in %f seconds.\n", input, what_time_is_it_now()-time);
-        get_region_boxes(l, im.w, im.h, net.w, net.h, thresh, probs, boxes, masks, 0, 0, hier_thresh, 1);
-        if (nms) do_nms_obj(boxes, probs, l.w*l.h*l.n, l.classes, nms);
-        //else if (nms) do_nms_sort(boxes, probs, l.w*l.h*l.n, l.classes, nms);
-        draw_detections(im, l.w*l.h*l.n, thresh, boxes, probs, masks, names, alphabet, l.classes);
+        int num = 0;
+        detection *dets = get_region_detections(l, im.w, im.h, net.w, net.h, thresh, 0, hier_thresh, 1, &num);
+        if (nms) num = do_nms_obj_detections(dets, num, nms);
+        //else if (nms) num = do_nms_detections(dets, num, nms);
+        draw_region_detections(im, dets, num, thresh, names, alphabet, l.classes);
         if(outfile){
             save_image(im, outfile);
         }
@@ -641,11 +619,13 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
         }
 
         free_image(im);
-        free_image(sized);
-        free(boxes);
-        free_ptrs((void **)probs, l.w*l.h*l.n);
+        free_detections(dets, num);
         if (filename) break;
     }
+    if(profile){
+        print_profile(net);
+        save_profile_trace(net, profile);
+    }
 }
 
 void run_detector(int argc, char **argv)
@@ -662,6 +642,7 @@ void run_detector(int argc, char **argv)
     }
     char *gpu_list = find_char_arg(argc, argv, "-gpus", 0);
     char *outfile = find_char_arg(argc, argv, "-out", 0);
+    char *profile = find_char_arg(argc, argv, "-profile", 0);
     int *gpus = 0;
     int gpu = 0;
     int ngpus = 0;
@@ -694,8 +675,8 @@ void run_detector(int argc, char **argv)
     char *cfg = argv[4];
     char *weights = (argc > 5) ? argv[5] : 0;
     char *filename = (argc > 6) ? argv[6]: 0;
-    if(0==strcmp(argv[2], "test")) test_detector(datacfg, cfg, weights, filename, thresh, hier_thresh, outfile, fullscreen);
-    else if(0==strcmp(argv[2], "train")) train_detector(datacfg, cfg, weights, gpus, ngpus, clear);
+    if(0==strcmp(argv[2], "test")) test_detector(datacfg, cfg, weights, filename, thresh, hier_thresh, outfile, fullscreen, profile);
+    else if(0==strcmp(argv[2], "train")) train_detector(datacfg, cfg, weights, gpus, ngpus, clear, profile);
     else if(0==strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "valid2")) validate_detector_flip(datacfg, cfg, weights, outfile);
     else if(0==strcmp(argv[2], "recall")) validate_detector_recall(cfg, weights);
@@ -48,8 +48,8 @@ void train_lsd3(char *fcfg, char *fweight, char *gcfg, char *gweight, char *acfg
     sargs.classes = 1;
     sargs.labels = ls;
 
-    pthread_t tload_thread = load_data_in_thread(targs);
-    pthread_t sload_thread = load_data_in_thread(sargs);
+    task *tload_thread = load_data_in_thread(targs);
+    task *sload_thread = load_data_in_thread(sargs);
     clock_t time;
 
     float aloss_avg = -1;
@@ -78,8 +78,8 @@ void train_lsd3(char *fcfg, char *fweight, char *gcfg, char *gweight, char *acfg
     while (get_current_batch(gnet) < gnet.max_batches) {
         i += 1;
         time=clock();
-        pthread_join(tload_thread, 0);
-        pthread_join(sload_thread, 0);
+        wait_task(tload_thread);
+        wait_task(sload_thread);
         train = tbuffer;
         style = sbuffer;
         tload_thread = load_data_in_thread(targs);
@@ -246,7 +246,7 @@ void train_pix2pix(char *cfg, char *weight, char *acfg, char *aweight, int clear
     char *ls[1] = {"coco"};
     args.labels = ls;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     clock_t time;
 
     network_state gstate = {0};
@@ -283,7 +283,7 @@ void train_pix2pix(char *cfg, char *weight, char *acfg, char *aweight, int clear
     while (get_current_batch(net) < net.max_batches) {
         i += 1;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data_in_thread(args);
 
@@ -484,7 +484,7 @@ void train_dcgan(char *cfg, char *weight, char *acfg, char *aweight, int clear,
     char *ls[2] = {"imagenet", "zzzzzzzz"};
     args.labels = ls;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     clock_t time;
 
     gnet.train = 1;
@@ -504,7 +504,7 @@ void train_dcgan(char *cfg, char *weight, char *acfg, char *aweight, int clear,
     start += 1;
         i += 1;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
 
         //translate_data_rows(train, -.5);
@@ -660,7 +660,7 @@ void train_colorizer(char *cfg, char *weight, char *acfg, char *aweight, int cle
     char *ls[2] = {"imagenet"};
     args.labels = ls;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     clock_t time;
 
     int x_size = net.inputs*net.batch;
@@ -685,7 +685,7 @@ void train_colorizer(char *cfg, char *weight, char *acfg, char *aweight, int cle
     while (get_current_batch(net) < net.max_batches) {
         i += 1;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data_in_thread(args);
 
@@ -850,7 +850,7 @@ void train_lsd2(char *cfgfile, char *weightfile, char *acfgfile, char *aweightfi
     char *ls[1] = {"coco"};
     args.labels = ls;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     clock_t time;
 
     network_state gstate = {0};
@@ -886,7 +886,7 @@ void train_lsd2(char *cfgfile, char *weightfile, char *acfgfile, char *aweightfi
     while (get_current_batch(net) < net.max_batches) {
         i += 1;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data_in_thread(args);
 
@@ -1009,13 +1009,13 @@ void train_lsd(char *cfgfile, char *weightfile, int clear)
     char *ls[1] = {"coco"};
     args.labels = ls;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     clock_t time;
     //while(i*imgs < N*120){
     while(get_current_batch(net) < net.max_batches){
         i += 1;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data_in_thread(args);
 
@@ -70,7 +70,7 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
 
     data train;
     data buffer;
-    pthread_t load_thread;
+    task *load_thread;
     args.d = &buffer;
     load_thread = load_data(args);
 
@@ -78,7 +78,7 @@ void train_segmenter(char *datacfg, char *cfgfile, char *weightfile, int *gpus,
     while(get_current_batch(net) < net.max_batches || net.max_batches == 0){
         time=clock();
 
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data(args);
 
@@ -33,13 +33,13 @@ void train_super(char *cfgfile, char *weightfile, int clear)
     args.d = &buffer;
     args.type = SUPER_DATA;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     clock_t time;
     //while(i*imgs < N*120){
     while(get_current_batch(net) < net.max_batches){
         i += 1;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data_in_thread(args);
 
@@ -19,7 +19,7 @@ void train_tag(char *cfgfile, char *weightfile, int clear)
     printf("%d\n", plist->size);
     int N = plist->size;
     clock_t time;
-    pthread_t load_thread;
+    task *load_thread;
     data train;
     data buffer;
 
@@ -49,7 +49,7 @@ void train_tag(char *cfgfile, char *weightfile, int clear)
     int epoch = (*net.seen)/N;
     while(get_current_batch(net) < net.max_batches || net.max_batches == 0){
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
 
         load_thread = load_data_in_thread(args);
@@ -76,7 +76,7 @@ void train_tag(char *cfgfile, char *weightfile, int clear)
     sprintf(buff, "%s/%s.weights", backup_directory, base);
     save_weights(net, buff);
 
-    pthread_join(load_thread, 0);
+    wait_task(load_thread);
     free_data(buffer);
     free_network(net);
     free_ptrs((void**)paths, plist->size);
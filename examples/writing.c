@@ -33,11 +33,11 @@ void train_writing(char *cfgfile, char *weightfile)
     args.d = &buffer;
     args.type = WRITING_DATA;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     int epoch = (*net.seen)/N;
     while(get_current_batch(net) < net.max_batches || net.max_batches == 0){
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
         load_thread = load_data_in_thread(args);
         printf("Loaded %lf seconds\n",sec(clock()-time));
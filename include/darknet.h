@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #define SECRET_NUM -1234
@@ -55,6 +56,10 @@ typedef enum{
     LOGISTIC, RELU, RELIE, LINEAR, RAMP, TANH, PLSE, LEAKY, ELU, LOGGY, STAIR, HARDTAN, LHTAN
 } ACTIVATION;
 
+typedef enum{
+    CONV_IM2COL, CONV_1X1, CONV_DIRECT, CONV_WINOGRAD
+} CONV_ALGORITHM;
+
 typedef enum {
     CONVOLUTIONAL,
     DECONVOLUTIONAL,
@@ -102,6 +107,7 @@ typedef struct{
 
 struct network;
 typedef struct network network;
+typedef struct profiler profiler;
 
 struct layer;
 typedef struct layer layer;
@@ -142,6 +148,9 @@ struct layer{
     int sqrt;
     int flip;
     int index;
+    int fused;            // shortcut: output computed by the preceding convolution
+    int fused_shortcut;   // convolution: index of the shortcut it computes
+    int shared_output;    // output and delta live in memory the layer does not own
     int binary;
     int xnor;
     int steps;
@@ -213,6 +222,22 @@ struct layer{
 
     float * binary_weights;
 
+    uint64_t * xnor_weights;
+    float * xnor_scales;
+
+    CONV_ALGORITHM algorithm;
+    int autotune;   // 0: fixed algorithm, 1: tune on next forward, 2: tuned
+    float * winograd_weights;
+
+    int8_t * qweights;
+    float * qweight_scales;
+    float * qscales;
+    float * qbiases;
+    float qinput_min;
+    float qinput_max;
+    float qinput_scale;
+    int qinput_zero;
+
     float * biases;
     float * bias_updates;
 
@@ -443,6 +468,7 @@ typedef struct network{
     int outputs;
     int truths;
     int notruth;
+    int prefetch;
     int h, w, c;
     int max_crop;
     int min_crop;
@@ -460,6 +486,13 @@ typedef struct network{
     float *truth;
     float *delta;
     float *workspace;
+    size_t workspace_size;
+    float *arena;
+    void *mapping;
+    size_t mapping_size;
+    int shared_weights;
+    char *cfgfile;
+    profiler *prof;
     int train;
     int index;
     float *cost;
@@ -490,10 +523,28 @@ typedef struct {
     float *data;
 } image;
 
+/* Interleaved 8-bit pixels, see image_u8.c. */
+typedef struct {
+    int w;
+    int h;
+    int c;
+    unsigned char *data;
+} image_u8;
+
 typedef struct{
     float x, y, w, h;
 } box;
 
+/* One scored class of one anchor, see get_region_detections. */
+typedef struct detection{
+    box bbox;
+    int index;
+    int class;
+    float prob;
+    float max_prob;
+    float *mask;
+} detection;
+
 typedef struct matrix{
     int rows, cols;
     float **vals;
@@ -513,6 +564,8 @@ typedef enum {
     CLASSIFICATION_DATA, DETECTION_DATA, CAPTCHA_DATA, REGION_DATA, IMAGE_DATA, COMPARE_DATA, WRITING_DATA, SWAG_DATA, TAG_DATA, OLD_CLASSIFICATION_DATA, STUDY_DATA, DET_DATA, SUPER_DATA, LETTERBOX_DATA, REGRESSION_DATA, SEGMENTATION_DATA, INSTANCE_DATA
 } data_type;
 
+typedef struct packed_data packed_data;
+
 typedef struct load_args{
     int threads;
     char **paths;
@@ -544,6 +597,7 @@ typedef struct load_args{
     image *resized;
     data_type type;
     tree *hierarchy;
+    packed_data *packed;
 } load_args;
 
 typedef struct{
@@ -555,6 +609,17 @@ typedef struct{
 
 network load_network(char *cfg, char *weights, int clear);
 network *load_network_p(char *cfg, char *weights, int clear);
+network load_network_inference(char *cfg, char *weights);
+network *load_network_inference_p(char *cfg, char *weights);
+void fuse_batchnorm_network(network *net);
+void fuse_shortcut_network(network *net);
+void plan_network_memory(network *net);
+void replan_network_memory(network *net);
+profiler *make_profiler(network net);
+void free_profiler(profiler *p);
+void print_profile(network net);
+void save_profile_trace(network net, char *filename);
+int unplan_network_memory(network *net);
 load_args get_base_args(network net);
 
 void free_data(data d);
@@ -571,7 +636,32 @@ typedef struct list{
     node *back;
 } list;
 
-pthread_t load_data(load_args args);
+typedef struct task task;
+void thread_pool_init(int threads, int affinity);
+int thread_pool_size();
+task *submit_task(void (*fn)(void *), void *arg);
+void wait_task(task *t);
+void parallel_for(int n, void (*body)(int i, void *arg), void *arg);
+
+task *load_data(load_args args);
+
+typedef struct data_loader data_loader;
+data_loader *make_data_loader(load_args args, int depth);
+data get_data_loader_batch(data_loader *l);
+void resize_data_loader(data_loader *l, int w, int h);
+void free_data_loader(data_loader *l);
+
+void pack_dataset(char **paths, int n, char *out, int max_side, size_t shard_bytes);
+packed_data *load_packed_data(char *filename);
+void free_packed_data(packed_data *p);
+int packed_data_size(packed_data *p);
+image_u8 packed_image_u8(packed_data *p, int i);
+box_label *packed_boxes(packed_data *p, int i, int *n);
+char *packed_path(packed_data *p, int i);
+
+void image_cache_init(size_t bytes);
+image_u8 load_image_u8_cached(char *path);
+void print_image_cache();
 list *read_data_cfg(char *filename);
 list *read_cfg(char *filename);
 
@@ -639,21 +729,39 @@ char *option_find_str(list *l, char *key, char *def);
 int option_find_int(list *l, char *key, int def);
 
 network parse_network_cfg(char *filename);
+network parse_network_cfg_inference(char *filename);
 void save_weights(network net, char *filename);
 void load_weights(network *net, char *filename);
+void load_weights_inference(network *net, char *filename);
 void save_weights_upto(network net, char *filename, int cutoff);
 void load_weights_upto(network *net, char *filename, int start, int cutoff);
+void save_compiled_network(network net, char *cfgfile, char *filename);
+network load_compiled_network(char *filename);
+int is_compiled_network(char *filename);
+network clone_network_inference(network net);
+void quantize_network(network *net, char **paths, int n);
 
 void zero_objectness(layer l);
 void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, float **probs, box *boxes, float **masks, int only_objectness, int *map, float tree_thresh, int relative);
+detection *get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, int *num);
+void free_detections(detection *dets, int n);
+int do_nms_detections(detection *dets, int n, float thresh);
+int do_nms_obj_detections(detection *dets, int n, float thresh);
+int do_soft_nms_detections(detection *dets, int n, float sigma, float thresh);
+void do_nms_detections_batch(detection **dets, int *nums, int batch, float thresh);
+void draw_region_detections(image im, detection *dets, int n, float thresh, char **names, image **alphabet, int classes);
 void free_network(network net);
 void set_batch_network(network *net, int b);
 void set_temp_network(network net, float t);
 image load_image(char *filename, int w, int h, int c);
 image load_image_color(char *filename, int w, int h);
+image_u8 load_image_u8(char *filename);
+void free_image_u8(image_u8 m);
 image make_image(int w, int h, int c);
 image resize_image(image im, int w, int h);
 image letterbox_image(image im, int w, int h);
+void letterbox_image_into(image im, int w, int h, image boxed);
+void load_image_letterbox(char *filename, image boxed, int *w, int *h);
 image crop_image(image im, int dx, int dy, int w, int h);
 image resize_min(image im, int min);
 image threshold_image(image im, float thresh);
@@ -720,7 +828,7 @@ image get_image_from_stream(CvCapture *cap);
 #endif
 void free_image(image m);
 float train_network(network net, data d);
-pthread_t load_data_in_thread(load_args args);
+task *load_data_in_thread(load_args args);
 void load_data_blocking(load_args args);
 list *get_paths(char *filename);
 void hierarchy_predictions(float *predictions, int n, tree *hier, int only_leaves, int stride);
@@ -67,6 +67,10 @@ load_net = lib.load_network_p
 load_net.argtypes = [c_char_p, c_char_p, c_int]
 load_net.restype = c_void_p
 
+load_net_inference = lib.load_network_inference_p
+load_net_inference.argtypes = [c_char_p, c_char_p]
+load_net_inference.restype = c_void_p
+
 free_image = lib.free_image
 free_image.argtypes = [IMAGE]
 
@@ -119,7 +123,7 @@ if __name__ == "__main__":
     #meta = load_meta("cfg/imagenet1k.data")
     #r = classify(net, meta, im)
     #print r[:10]
-    net = load_net("cfg/tiny-yolo.cfg", "tiny-yolo.weights", 0)
+    net = load_net_inference("cfg/tiny-yolo.cfg", "tiny-yolo.weights")
     meta = load_meta("cfg/coco.data")
     r = detect(net, meta, "data/dog.jpg")
     print r
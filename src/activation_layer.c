@@ -19,7 +19,7 @@ layer make_activation_layer(int batch, int inputs, ACTIVATION activation)
     l.batch=batch;
 
     l.output = calloc(batch*inputs, sizeof(float*));
-    l.delta = calloc(batch*inputs, sizeof(float*));
+    l.delta = training_calloc(batch*inputs, sizeof(float*));
 
     l.forward = forward_activation_layer;
     l.backward = backward_activation_layer;
@@ -0,0 +1,150 @@
+#include "autotune.h"
+#include "convolutional_layer.h"
+#include "list.h"
+#include "option_list.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Per-layer choice of convolution algorithm. The first CPU forward pass
+ * through a convolutional layer whose cfg does not fix an algorithm times
+ * every algorithm that applies on the layer's real input and keeps the
+ * fastest. Winners are cached on disk in $DARKNET_AUTOTUNE_CACHE (default
+ * ~/.darknet_autotune), one key=algorithm line per CPU model, thread count and
+ * layer geometry, so a network is only timed once per machine. Setting
+ * DARKNET_AUTOTUNE=0 keeps the built-in defaults.
+ */
+
+#define AUTOTUNE_RUNS 3
+/* Largest output error, relative to im2col, an algorithm may trade for speed. */
+#define AUTOTUNE_TOLERANCE 1e-3
+
+static pthread_mutex_t autotune_lock = PTHREAD_MUTEX_INITIALIZER;
+static list *autotune_cache;
+static char autotune_cpu[256];
+
+static char *autotune_cache_file()
+{
+    static char path[4096];
+    char *file = getenv("DARKNET_AUTOTUNE_CACHE");
+    char *home = getenv("HOME");
+    if(file) return file;
+    if(!home) return 0;
+    snprintf(path, sizeof(path), "%s/.darknet_autotune", home);
+    return path;
+}
+
+static void load_autotune_cache()
+{
+    char *file = autotune_cache_file();
+    FILE *fp = file ? fopen(file, "r") : 0;
+    char *line;
+    autotune_cache = make_list();
+    if(fp){
+        while((line = fgetl(fp)) != 0){
+            strip(line);
+            if(line[0] == '\0' || line[0] == '#' || !read_option(line, autotune_cache)) free(line);
+        }
+        fclose(fp);
+    }
+
+    strcpy(autotune_cpu, "unknown");
+    fp = fopen("/proc/cpuinfo", "r");
+    if(fp){
+        while((line = fgetl(fp)) != 0){
+            char *colon = strchr(line, ':');
+            if(colon && strncmp(line, "model name", 10) == 0){
+                strncpy(autotune_cpu, colon + 1, sizeof(autotune_cpu) - 1);
+                free(line);
+                break;
+            }
+            free(line);
+        }
+        fclose(fp);
+    }
+    /* Keys are stored without whitespace, the way cfg options are. */
+    strip(autotune_cpu);
+}
+
+static void save_autotune_result(char *key, char *algorithm)
+{
+    char *file = autotune_cache_file();
+    FILE *fp = file ? fopen(file, "a") : 0;
+    option_insert(autotune_cache, copy_string(key), algorithm);
+    if(!fp) return;
+    fprintf(fp, "%s=%s\n", key, algorithm);
+    fclose(fp);
+}
+
+static double time_conv_algorithm(layer *l, network net, CONV_ALGORITHM a)
+{
+    double best = 0;
+    int i;
+    set_conv_algorithm(l, a);
+    /* set_conv_algorithm has already checked Winograd, and refused it with im2col. */
+    if(l->algorithm != a) return -1;
+    if(a != CONV_IM2COL && a != CONV_WINOGRAD && convolutional_algorithm_error(*l) > AUTOTUNE_TOLERANCE) return -1;
+    /* The first run only warms caches and the packed weights. */
+    for(i = 0; i < AUTOTUNE_RUNS; ++i){
+        double start = what_time_is_it_now();
+        forward_convolutional_layer(*l, net);
+        double t = what_time_is_it_now() - start;
+        if(i == 1 || (i > 1 && t < best)) best = t;
+    }
+    return best;
+}
+
+void autotune_convolutional_layer(layer *l, network net)
+{
+    char *env = getenv("DARKNET_AUTOTUNE");
+    char key[512];
+    char *cached;
+    int threads = thread_pool_size();
+    CONV_ALGORITHM a;
+    CONV_ALGORITHM best = l->algorithm;
+    double best_time = -1;
+
+    if(l->autotune != 1) return;
+    l->autotune = 2;
+    if((env && atoi(env) == 0) || l->xnor || l->qweights) return;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+
+    pthread_mutex_lock(&autotune_lock);
+    if(!autotune_cache) load_autotune_cache();
+    snprintf(key, sizeof(key), "%s/%dthreads/c%dh%dw%dn%dk%ds%dp%dg%db%d", autotune_cpu, threads,
+            l->c, l->h, l->w, l->n, l->size, l->stride, l->pad, l->groups, l->batch);
+    cached = option_find(autotune_cache, key);
+    if(cached){
+        set_conv_algorithm(l, get_conv_algorithm(cached));
+        pthread_mutex_unlock(&autotune_lock);
+        return;
+    }
+
+    /* Timed as inference so batchnorm statistics are left alone. */
+    net.train = 0;
+    fprintf(stderr, "autotune %4d x%4d x%4d -> %4d %2dx%2d/%d:", l->w, l->h, l->c, l->n, l->size, l->size, l->stride);
+    for(a = CONV_IM2COL; a <= CONV_WINOGRAD; ++a){
+        double t;
+        if(!can_use_conv_algorithm(*l, a)) continue;
+        t = time_conv_algorithm(l, net, a);
+        if(t < 0){
+            fprintf(stderr, " %s rejected", get_conv_algorithm_string(a));
+            continue;
+        }
+        fprintf(stderr, " %s %.3f ms", get_conv_algorithm_string(a), t*1000);
+        if(best_time < 0 || t < best_time){
+            best = a;
+            best_time = t;
+        }
+    }
+    fprintf(stderr, " -> %s\n", get_conv_algorithm_string(best));
+    set_conv_algorithm(l, best);
+    save_autotune_result(key, get_conv_algorithm_string(best));
+    pthread_mutex_unlock(&autotune_lock);
+}
@@ -0,0 +1,8 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "darknet.h"
+
+void autotune_convolutional_layer(layer *l, network net);
+
+#endif
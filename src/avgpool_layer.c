@@ -18,7 +18,7 @@ avgpool_layer make_avgpool_layer(int batch, int w, int h, int c)
     l.inputs = h*w*c;
     int output_size = l.outputs * batch;
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
+    l.delta =   training_calloc(output_size, sizeof(float));
     l.forward = forward_avgpool_layer;
     l.backward = backward_avgpool_layer;
     #ifdef GPU
@@ -37,3 +37,31 @@ void col2im_cpu(float* data_col,
     }
 }
 
+
+// Accumulates columns [col0, col0 + ncols) of an im2col matrix stored ncols
+// wide, the counterpart of im2col_cpu_cols.
+void col2im_cpu_cols(float* data_col,
+         int channels,  int height,  int width,
+         int ksize,  int stride, int pad,
+         int col0, int ncols, float* data_im)
+{
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    int channels_col = channels * ksize * ksize;
+    int c, i;
+    for (c = 0; c < channels_col; ++c) {
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        int h = col0 / width_col;
+        int w = col0 % width_col;
+        float *src = data_col + (size_t)c * ncols;
+        for (i = 0; i < ncols; ++i) {
+            col2im_add_pixel(data_im, height, width, channels,
+                    h_offset + h * stride, w_offset + w * stride, c_im, pad, src[i]);
+            if (++w == width_col) {
+                w = 0;
+                ++h;
+            }
+        }
+    }
+}
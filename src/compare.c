@@ -25,7 +25,7 @@ void train_compare(char *cfgfile, char *weightfile)
     int N = plist->size;
     printf("%d\n", N);
     clock_t time;
-    pthread_t load_thread;
+    task *load_thread;
     data train;
     data buffer;
 
@@ -45,7 +45,7 @@ void train_compare(char *cfgfile, char *weightfile)
     while(1){
         ++i;
         time=clock();
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         train = buffer;
 
         load_thread = load_data_in_thread(args);
@@ -70,7 +70,7 @@ void train_compare(char *cfgfile, char *weightfile)
             if(epoch%22 == 0) net.learning_rate *= .1;
         }
     }
-    pthread_join(load_thread, 0);
+    wait_task(load_thread);
     free_data(buffer);
     free_network(net);
     free_ptrs((void**)paths, plist->size);
@@ -111,11 +111,11 @@ void validate_compare(char *filename, char *weightfile)
     args.d = &buffer;
     args.type = COMPARE_DATA;
 
-    pthread_t load_thread = load_data_in_thread(args);
+    task *load_thread = load_data_in_thread(args);
     for(i = 1; i <= splits; ++i){
         time=clock();
 
-        pthread_join(load_thread, 0);
+        wait_task(load_thread);
         val = buffer;
 
         num = (i+1)*N/splits - i*N/splits;
@@ -5,6 +5,7 @@
 #include "cuda.h"
 #include "blas.h"
 #include "gemm.h"
+#include "quantize.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -30,12 +31,12 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     l.out_c = outputs;
 
     l.output = calloc(batch*outputs, sizeof(float));
-    l.delta = calloc(batch*outputs, sizeof(float));
+    l.delta = training_calloc(batch*outputs, sizeof(float));
 
-    l.weight_updates = calloc(inputs*outputs, sizeof(float));
-    l.bias_updates = calloc(outputs, sizeof(float));
+    l.weight_updates = training_calloc(inputs*outputs, sizeof(float));
+    l.bias_updates = training_calloc(outputs, sizeof(float));
 
-    l.weights = calloc(outputs*inputs, sizeof(float));
+    l.weights = weights_calloc(outputs*inputs, sizeof(float));
     l.biases = calloc(outputs, sizeof(float));
 
     l.forward = forward_connected_layer;
@@ -44,7 +45,7 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
 
     //float scale = 1./sqrt(inputs);
     float scale = sqrt(2./inputs);
-    for(i = 0; i < outputs*inputs; ++i){
+    for(i = 0; l.weights && i < outputs*inputs; ++i){
         l.weights[i] = scale*rand_uniform(-1, 1);
     }
 
@@ -53,30 +54,30 @@ layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activa
     }
 
     if(adam){
-        l.m = calloc(l.inputs*l.outputs, sizeof(float));
-        l.v = calloc(l.inputs*l.outputs, sizeof(float));
-        l.bias_m = calloc(l.outputs, sizeof(float));
-        l.scale_m = calloc(l.outputs, sizeof(float));
-        l.bias_v = calloc(l.outputs, sizeof(float));
-        l.scale_v = calloc(l.outputs, sizeof(float));
+        l.m = training_calloc(l.inputs*l.outputs, sizeof(float));
+        l.v = training_calloc(l.inputs*l.outputs, sizeof(float));
+        l.bias_m = training_calloc(l.outputs, sizeof(float));
+        l.scale_m = training_calloc(l.outputs, sizeof(float));
+        l.bias_v = training_calloc(l.outputs, sizeof(float));
+        l.scale_v = training_calloc(l.outputs, sizeof(float));
     }
     if(batch_normalize){
         l.scales = calloc(outputs, sizeof(float));
-        l.scale_updates = calloc(outputs, sizeof(float));
+        l.scale_updates = training_calloc(outputs, sizeof(float));
         for(i = 0; i < outputs; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(outputs, sizeof(float));
-        l.mean_delta = calloc(outputs, sizeof(float));
-        l.variance = calloc(outputs, sizeof(float));
-        l.variance_delta = calloc(outputs, sizeof(float));
+        l.mean = training_calloc(outputs, sizeof(float));
+        l.mean_delta = training_calloc(outputs, sizeof(float));
+        l.variance = training_calloc(outputs, sizeof(float));
+        l.variance_delta = training_calloc(outputs, sizeof(float));
 
         l.rolling_mean = calloc(outputs, sizeof(float));
         l.rolling_variance = calloc(outputs, sizeof(float));
 
-        l.x = calloc(batch*outputs, sizeof(float));
-        l.x_norm = calloc(batch*outputs, sizeof(float));
+        l.x = training_calloc(batch*outputs, sizeof(float));
+        l.x_norm = training_calloc(batch*outputs, sizeof(float));
     }
 
 #ifdef GPU
@@ -148,8 +149,23 @@ void update_connected_layer(layer l, update_args a)
     scal_cpu(l.inputs*l.outputs, momentum, l.weight_updates, 1);
 }
 
+static void forward_int8_connected_layer(layer l, network net)
+{
+    uint8_t *input = (uint8_t *)net.workspace;
+    int lda = quantized_lda(l);
+    int i;
+    for(i = 0; i < l.batch; ++i){
+        quantize_activations(net.input + i*l.inputs, l.inputs, l.qinput_scale, l.qinput_zero, input);
+        gemv_int8(l.outputs, l.inputs, l.qweights, lda, input, l.qscales, l.qbiases, l.activation, l.output + i*l.outputs);
+    }
+}
+
 void forward_connected_layer(layer l, network net)
 {
+    if(l.qweights && !net.train){
+        forward_int8_connected_layer(l, net);
+        return;
+    }
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
     int m = l.batch;
     int k = l.inputs;
@@ -326,6 +326,7 @@ void pull_convolutional_layer(convolutional_layer layer)
         cuda_pull_array(layer.rolling_mean_gpu, layer.rolling_mean, layer.n);
         cuda_pull_array(layer.rolling_variance_gpu, layer.rolling_variance, layer.n);
     }
+    update_winograd_weights(layer);
 }
 
 void push_convolutional_layer(convolutional_layer layer)
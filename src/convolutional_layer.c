@@ -5,6 +5,9 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "quantize.h"
+#include "depthwise.h"
+#include "winograd.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -66,6 +69,36 @@ void binarize_input(float *input, int n, int size, float *binary) {
   }
 }
 
+// Sign bits of each filter in the (ky, kx, c) tap order of im2col_cpu_bits,
+// plus the per-filter mean |w| that binarize_weights uses as the scale.
+void pack_binary_weights(float *weights, int n, int c, int size,
+                         uint64_t *packed, float *scales) {
+  int cw = (c + 63) / 64;
+  int words = size * size * cw;
+  int k = c * size * size;
+  int i, f, t;
+  for (f = 0; f < n; ++f) {
+    float *w = weights + f * k;
+    uint64_t *p = packed + f * words;
+    float mean = 0;
+    for (i = 0; i < k; ++i) {
+      mean += fabs(w[i]);
+    }
+    scales[f] = mean / k;
+    memset(p, 0, words * sizeof(uint64_t));
+    for (i = 0; i < c; ++i) {
+      for (t = 0; t < size * size; ++t) {
+        if (w[i * size * size + t] > 0)
+          p[t * cw + i / 64] |= 1ULL << (i & 63);
+      }
+    }
+  }
+}
+
+static int xnor_words(layer l) {
+  return l.size * l.size * ((l.c / l.groups + 63) / 64);
+}
+
 int convolutional_out_height(convolutional_layer l) {
   return (l.h + 2 * l.pad - l.size) / l.stride + 1;
 }
@@ -82,7 +115,40 @@ image get_convolutional_delta(convolutional_layer l) {
   return float_to_image(l.out_w, l.out_h, l.out_c, l.delta);
 }
 
-static size_t get_workspace_size(layer l) {
+// 1x1, stride 1, no padding: the input already is the im2col matrix.
+static int is_pointwise(layer l) {
+  return l.size == 1 && l.stride == 1 && l.pad == 0;
+}
+
+// One filter per channel: handled by the direct kernels in depthwise.c.
+int is_depthwise_convolutional(convolutional_layer l) {
+  return l.groups == l.c && l.c == l.n;
+}
+
+// Output pixels per im2col/col2im slice in backward, sized so the slice
+// stays within CONV_WORKSPACE_FLOATS.
+#define CONV_WORKSPACE_FLOATS (1 << 20)
+static int workspace_cols(layer l) {
+  int k = l.size * l.size * l.c / l.groups;
+  int n = l.out_h * l.out_w;
+  int cols = CONV_WORKSPACE_FLOATS / k;
+  if (cols < 64)
+    cols = 64;
+  return (cols < n) ? cols : n;
+}
+
+// Tiles per Winograd pass: the transformed inputs and GEMM outputs of a pass
+// share the workspace, 36 * (c + n) floats per tile.
+static int winograd_chunk(layer l) {
+  int tiles = (l.out_h + WINOGRAD_TILE - 1) / WINOGRAD_TILE *
+              ((l.out_w + WINOGRAD_TILE - 1) / WINOGRAD_TILE) * l.batch;
+  int chunk = CONV_WORKSPACE_FLOATS / (WINOGRAD_TAPS * (l.c + l.n));
+  if (chunk < 32)
+    chunk = 32;
+  return (chunk < tiles) ? chunk : tiles;
+}
+
+static size_t algorithm_workspace_size(layer l) {
 #ifdef CUDNN
   if (gpu_index >= 0) {
     size_t most = 0;
@@ -106,8 +172,58 @@ static size_t get_workspace_size(layer l) {
     return most;
   }
 #endif
-  return (size_t)l.out_h * l.out_w * l.size * l.size * l.c * sizeof(float) /
-         l.groups;
+  size_t s = (size_t)l.out_h * l.out_w * l.size * l.size * l.c *
+             sizeof(float) / l.groups;
+#ifdef GPU
+  if (gpu_index < 0)
+#endif
+  {
+    // The CPU path never stores a whole im2col matrix: forward gathers
+    // patches while packing and backward works in slices of columns.
+    s = (l.algorithm == CONV_1X1 || l.algorithm == CONV_DIRECT)
+            ? 0
+            : (size_t)l.size * l.size * l.c / l.groups * workspace_cols(l) *
+                  sizeof(float);
+  }
+  if (l.algorithm == CONV_WINOGRAD) {
+    size_t w = (size_t)WINOGRAD_TAPS * (l.c + l.n) * winograd_chunk(l) *
+               sizeof(float);
+    if (w > s)
+      s = w;
+  }
+  if (l.xnor) {
+    size_t words = xnor_words(l);
+    size_t pixels = (size_t)l.h * l.w * ((l.c / l.groups + 63) / 64);
+    size_t bits = (2 * (size_t)l.out_h * l.out_w * words + pixels) *
+                  sizeof(uint64_t);
+    if (bits > s)
+      s = bits;
+  }
+  if (l.qweights) {
+    size_t q = get_quantized_workspace_size(l);
+    if (q > s)
+      s = q;
+  }
+  return s;
+}
+
+// Until the algorithm is tuned, reserve enough for whichever one wins.
+static size_t get_workspace_size(layer l) {
+  size_t s = algorithm_workspace_size(l);
+  CONV_ALGORITHM a;
+  if (l.autotune != 1)
+    return s;
+  for (a = CONV_IM2COL; a <= CONV_WINOGRAD; ++a) {
+    layer t = l;
+    size_t w;
+    if (!can_use_conv_algorithm(l, a))
+      continue;
+    t.algorithm = a;
+    w = algorithm_workspace_size(t);
+    if (w > s)
+      s = w;
+  }
+  return s;
 }
 
 #ifdef GPU
@@ -195,14 +311,14 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
   l.nweights = c * n * size * size / l.groups;
   l.nbiases = n;
 
-  l.weights = calloc(l.nweights, sizeof(float));
-  l.weight_updates = calloc(l.nweights, sizeof(float));
+  l.weights = weights_calloc(l.nweights, sizeof(float));
+  l.weight_updates = training_calloc(l.nweights, sizeof(float));
 
   l.biases = calloc(n, sizeof(float));
-  l.bias_updates = calloc(n, sizeof(float));
+  l.bias_updates = training_calloc(n, sizeof(float));
 
   float scale = sqrt(2. / (size * size * c));
-  for (i = 0; i < l.nweights; ++i)
+  for (i = 0; l.weights && i < l.nweights; ++i)
     l.weights[i] = scale * rand_normal();
   int out_w = convolutional_out_width(l);
   int out_h = convolutional_out_height(l);
@@ -213,7 +329,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
   l.inputs = l.w * l.h * l.c;
 
   l.output = calloc(l.batch * l.outputs, sizeof(float));
-  l.delta = calloc(l.batch * l.outputs, sizeof(float));
+  l.delta = training_calloc(l.batch * l.outputs, sizeof(float));
 
   l.forward = forward_convolutional_layer;
   l.backward = backward_convolutional_layer;
@@ -226,36 +342,37 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
   }
 
   if (xnor) {
-    l.binary_weights = calloc(l.nweights, sizeof(float));
-    l.binary_input = calloc(l.inputs * l.batch, sizeof(float));
+    l.xnor_weights = calloc(n * xnor_words(l), sizeof(uint64_t));
+    l.xnor_scales = calloc(n, sizeof(float));
+    update_xnor_weights(l);
   }
 
   if (batch_normalize) {
     l.scales = calloc(n, sizeof(float));
-    l.scale_updates = calloc(n, sizeof(float));
+    l.scale_updates = training_calloc(n, sizeof(float));
     for (i = 0; i < n; ++i) {
       l.scales[i] = 1;
     }
 
-    l.mean = calloc(n, sizeof(float));
-    l.variance = calloc(n, sizeof(float));
+    l.mean = training_calloc(n, sizeof(float));
+    l.variance = training_calloc(n, sizeof(float));
 
-    l.mean_delta = calloc(n, sizeof(float));
-    l.variance_delta = calloc(n, sizeof(float));
+    l.mean_delta = training_calloc(n, sizeof(float));
+    l.variance_delta = training_calloc(n, sizeof(float));
 
     l.rolling_mean = calloc(n, sizeof(float));
     l.rolling_variance = calloc(n, sizeof(float));
-    l.x = calloc(l.batch * l.outputs, sizeof(float));
-    l.x_norm = calloc(l.batch * l.outputs, sizeof(float));
+    l.x = training_calloc(l.batch * l.outputs, sizeof(float));
+    l.x_norm = training_calloc(l.batch * l.outputs, sizeof(float));
   }
 
   if (adam) {
-    l.m = calloc(l.nweights, sizeof(float));
-    l.v = calloc(l.nweights, sizeof(float));
-    l.bias_m = calloc(n, sizeof(float));
-    l.scale_m = calloc(n, sizeof(float));
-    l.bias_v = calloc(n, sizeof(float));
-    l.scale_v = calloc(n, sizeof(float));
+    l.m = training_calloc(l.nweights, sizeof(float));
+    l.v = training_calloc(l.nweights, sizeof(float));
+    l.bias_m = training_calloc(n, sizeof(float));
+    l.scale_m = training_calloc(n, sizeof(float));
+    l.bias_v = training_calloc(n, sizeof(float));
+    l.scale_v = training_calloc(n, sizeof(float));
   }
 
 #ifdef GPU
@@ -329,7 +446,8 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c,
 #endif
   }
 #endif
-  l.workspace_size = get_workspace_size(l);
+  l.autotune = 1;
+  set_conv_algorithm(&l, default_conv_algorithm(l));
   l.activation = activation;
 
   fprintf(stderr,
@@ -351,6 +469,41 @@ void denormalize_convolutional_layer(convolutional_layer l) {
     l.rolling_mean[i] = 0;
     l.rolling_variance[i] = 1;
   }
+  update_winograd_weights(l);
+  update_xnor_weights(l);
+}
+
+// Inference only: fold the rolling batchnorm statistics into the weights and
+// biases, with the epsilon forward_batchnorm_layer uses, and free the buffers
+// only training needs. Int8 layers already fold batchnorm into their epilogue
+// and binary weights are rebuilt from the float ones, so those are left alone.
+void fuse_batchnorm_convolutional_layer(convolutional_layer *l) {
+  int i, j;
+  int k = l->c / l->groups * l->size * l->size;
+  if (!l->batch_normalize || l->qweights || l->binary || l->xnor)
+    return;
+  for (i = 0; i < l->n; ++i) {
+    float scale = l->scales[i] / (sqrt(l->rolling_variance[i]) + .000001f);
+    for (j = 0; j < k; ++j) {
+      l->weights[i * k + j] *= scale;
+    }
+    l->biases[i] -= l->rolling_mean[i] * scale;
+  }
+  l->batch_normalize = 0;
+  free(l->x);
+  free(l->x_norm);
+  l->x = 0;
+  l->x_norm = 0;
+  update_winograd_weights(*l);
+#ifdef GPU
+  if (gpu_index >= 0) {
+    cuda_free(l->x_gpu);
+    cuda_free(l->x_norm_gpu);
+    l->x_gpu = 0;
+    l->x_norm_gpu = 0;
+    push_convolutional_layer(*l);
+  }
+#endif
 }
 
 void resize_convolutional_layer(convolutional_layer *l, int w, int h) {
@@ -366,8 +519,10 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h) {
   l->inputs = l->w * l->h * l->c;
 
   l->output = realloc(l->output, l->batch * l->outputs * sizeof(float));
-  l->delta = realloc(l->delta, l->batch * l->outputs * sizeof(float));
-  if (l->batch_normalize) {
+  // Inference-only networks have no delta or x/x_norm to resize.
+  if (l->delta)
+    l->delta = realloc(l->delta, l->batch * l->outputs * sizeof(float));
+  if (l->x) {
     l->x = realloc(l->x, l->batch * l->outputs * sizeof(float));
     l->x_norm = realloc(l->x_norm, l->batch * l->outputs * sizeof(float));
   }
@@ -390,6 +545,9 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h) {
   cudnn_convolutional_setup(l);
 #endif
 #endif
+  // A tuned choice only holds for the geometry it was timed at.
+  if (l->autotune)
+    l->autotune = 1;
   l->workspace_size = get_workspace_size(*l);
 }
 
@@ -426,45 +584,335 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n,
   }
 }
 
-void forward_convolutional_layer(convolutional_layer l, network net) {
-  fill_cpu(l.outputs * l.batch, 0, l.output, 1);
+static void forward_xnor_convolutional_layer(convolutional_layer l,
+                                             network net) {
+  int m = l.n / l.groups;
+  int n = l.out_h * l.out_w;
+  int words = xnor_words(l);
+  int group_size = l.c / l.groups;
+  int group_step = l.h * l.w * group_size;
+  uint64_t *bits = (uint64_t *)net.workspace;
+  uint64_t *mask = bits + (size_t)n * words;
+  uint64_t *pixels = mask + (size_t)n * words;
+  int i, j;
 
-  if (l.xnor) {
-    binarize_weights(l.weights, l.n, l.c / l.groups * l.size * l.size, l.binary_weights);
-    swap_binary(&l);
-    binarize_cpu(net.input, l.c * l.h * l.w * l.batch, l.binary_input);
-    net.input = l.binary_input;
+  for (i = 0; i < l.batch; ++i) {
+    for (j = 0; j < l.groups; ++j) {
+      float *input = net.input + i * l.inputs + j * group_step;
+      float *output = l.output + i * l.outputs + j * m * n;
+      im2col_cpu_bits(input, group_size, l.h, l.w, l.size, l.stride, l.pad,
+                      pixels, bits, mask);
+      gemm_bin_packed(m, n, words, l.xnor_scales + j * m,
+                      l.xnor_weights + (size_t)j * m * words, bits, mask,
+                      output, n);
+    }
   }
+}
 
-  // image im = float_to_image(l.w, l.h, l.c, net.input);
-  // printf("\nfilter_before:\n");
-  // print_image(im);
-
-  int m = l.n;                   // output channel
-  int k = l.size * l.size * l.c; // kernel size, input channel
-  int n = l.out_h * l.out_w;     // output size
-
-  float *a = l.weights;
-  float *c = l.output;
-
+// Inference on int8 weights. The input is quantized once per image, 1x1
+// stride-1 layers feed it to the GEMM as is, and the GEMM epilogue applies
+// requantization, batchnorm, bias and activation while storing l.output.
+static void forward_int8_convolutional_layer(convolutional_layer l,
+                                             network net) {
+  int m = l.n / l.groups;
+  int k = quantized_cols(l);
+  int n = l.out_h * l.out_w;
+  int lda = quantized_lda(l);
   int group_size = l.c / l.groups;
   int group_step = l.h * l.w * group_size;
-  k = k / l.groups;
-  m = m / l.groups;
+  uint8_t *input = (uint8_t *)net.workspace;
+  uint8_t *cols = input + l.inputs;
   int i, j;
+
   for (i = 0; i < l.batch; ++i) {
-    for (j = 0; j < l.groups; j++) {
-      float *aoffset = a + j * k;
-      float *boffset = net.workspace;
-      float *coffset = c + j * n * group_size;
-      float *inputoffset = net.input + group_step * j;
-      im2col_cpu(inputoffset, group_size, l.h, l.w, l.size, l.stride, l.pad,
-                 boffset);
-      gemm(0, 0, m, n, k, 1, aoffset, k, boffset, n, 1, coffset, n);
+    quantize_activations(net.input + i * l.inputs, l.inputs, l.qinput_scale,
+                         l.qinput_zero, input);
+    for (j = 0; j < l.groups; ++j) {
+      uint8_t *b = input + j * group_step;
+      if (l.size != 1 || l.stride != 1 || l.pad != 0) {
+        im2col_cpu_u8(b, group_size, l.h, l.w, l.size, l.stride, l.pad,
+                      l.qinput_zero, cols);
+        b = cols;
+      }
+      gemm_int8(m, n, k, l.qweights + (size_t)j * m * lda, lda, b, n,
+                l.qscales + j * m, l.qbiases + j * m, l.activation,
+                l.output + i * l.outputs + j * m * n, n);
+    }
+  }
+}
+
+typedef struct {
+  convolutional_layer *l;
+  network *net;
+  int fused;
+} depthwise_args;
+
+static void forward_depthwise_channel(int i, void *ptr) {
+  depthwise_args *d = ptr;
+  convolutional_layer l = *d->l;
+  int c = i % l.n;
+  float scale = 1, bias = 0;
+  ACTIVATION a = LINEAR;
+  if (d->fused) {
+    bias = l.biases[c];
+    a = l.activation;
+    if (l.batch_normalize) {
+      scale = l.scales[c] / (sqrt(l.rolling_variance[c]) + .000001f);
+      bias -= scale * l.rolling_mean[c];
+    }
+  }
+  depthwise_conv2d(d->net->input + (size_t)i * l.h * l.w, l.h, l.w,
+                   l.weights + c * l.size * l.size, l.size, l.stride, l.pad,
+                   scale, bias, a, l.output + (size_t)i * l.out_h * l.out_w);
+}
+
+// Channels are independent; each iteration owns one filter's updates across
+// the whole batch.
+static void backward_depthwise_channel(int j, void *ptr) {
+  depthwise_args *d = ptr;
+  convolutional_layer l = *d->l;
+  int size2 = l.size * l.size;
+  int k = l.out_w * l.out_h;
+  int i;
+  for (i = 0; i < l.batch; ++i) {
+    size_t in = ((size_t)i * l.c + j) * l.h * l.w;
+    depthwise_conv2d_backward(
+        d->net->input + in, l.h, l.w, l.weights + j * size2, l.size, l.stride,
+        l.pad, l.delta + ((size_t)i * l.n + j) * k,
+        l.weight_updates + j * size2, d->net->delta ? d->net->delta + in : 0);
+  }
+}
+
+// Outside training batchnorm uses the rolling statistics, so it folds into
+// the per-channel scale and bias that the kernel applies together with the
+// activation. Training keeps the separate batchnorm pass for its statistics.
+static void forward_depthwise_convolutional_layer(convolutional_layer l,
+                                                  network net) {
+  int fused = !l.batch_normalize || !net.train;
+  depthwise_args d = {&l, &net, fused};
+  parallel_for(l.batch * l.n, forward_depthwise_channel, &d);
+  if (!fused) {
+    forward_batchnorm_layer(l, net);
+    activate_array(l.output, l.outputs * l.batch, l.activation);
+  }
+}
+
+static void forward_winograd_convolutional_layer(convolutional_layer l,
+                                                 network net) {
+  int tiles_h = (l.out_h + WINOGRAD_TILE - 1) / WINOGRAD_TILE;
+  int tiles_w = (l.out_w + WINOGRAD_TILE - 1) / WINOGRAD_TILE;
+  int tiles = tiles_h * tiles_w * l.batch;
+  int chunk = winograd_chunk(l);
+  float *v = net.workspace;
+  float *m = v + (size_t)WINOGRAD_TAPS * l.c * chunk;
+  int t, nt, i;
+  for (t = 0; t < tiles; t += nt) {
+    nt = (tiles - t < chunk) ? tiles - t : chunk;
+    winograd_input_tiles(net.input, l.c, l.h, l.w, l.pad, tiles_h, tiles_w, t,
+                         nt, v);
+    for (i = 0; i < WINOGRAD_TAPS; ++i) {
+      gemm(0, 0, l.n, nt, l.c, 1, l.winograd_weights + (size_t)i * l.n * l.c,
+           l.c, v + (size_t)i * l.c * nt, nt, 0, m + (size_t)i * l.n * nt,
+           nt);
     }
+    winograd_output_tiles(m, l.n, l.out_h, l.out_w, tiles_h, tiles_w, t, nt,
+                          l.output);
+  }
+}
+
+// Recompute the transformed filters; needed whenever l.weights changes.
+void update_winograd_weights(convolutional_layer l) {
+  if (l.winograd_weights && l.weights)
+    winograd_transform_weights(l.weights, l.n, l.c, l.winograd_weights);
+}
+
+// Repack the sign bits and scales of xnor filters; needed whenever l.weights
+// changes.
+void update_xnor_weights(convolutional_layer l) {
+  if (l.xnor_weights && l.weights)
+    pack_binary_weights(l.weights, l.n, l.c / l.groups, l.size,
+                        l.xnor_weights, l.xnor_scales);
+}
 
-    c += l.out_h * l.out_w * l.n;
-    net.input += l.c * l.h * l.w;
+// Largest difference between the outputs of l's algorithm and of im2col for
+// one random input image, relative to the largest im2col output.
+float convolutional_algorithm_error(convolutional_layer l) {
+  network net = {0};
+  layer a = l;
+  layer ref;
+  float *out = calloc(l.outputs, sizeof(float));
+  float err = 0, max = 0;
+  unsigned seed = 1;
+  int i;
+  a.batch = 1;
+  a.batch_normalize = 0;
+  a.activation = LINEAR;
+  a.qweights = 0;
+  // There is no network to find a fused shortcut's layers in.
+  a.fused_shortcut = 0;
+  a.biases = calloc(l.n, sizeof(float));
+  ref = a;
+  ref.algorithm = CONV_IM2COL;
+  ref.output = out;
+  a.workspace_size = get_workspace_size(a);
+  ref.workspace_size = get_workspace_size(ref);
+  net.input = calloc(l.inputs, sizeof(float));
+  net.workspace = calloc(1, (a.workspace_size > ref.workspace_size)
+                                ? a.workspace_size
+                                : ref.workspace_size);
+  // Own seed, so checking a layer does not shift the weight initialization.
+  for (i = 0; i < l.inputs; ++i)
+    net.input[i] = 2. * rand_r(&seed) / RAND_MAX - 1;
+  forward_convolutional_layer(a, net);
+  forward_convolutional_layer(ref, net);
+  for (i = 0; i < l.outputs; ++i) {
+    float d = fabs(l.output[i] - out[i]);
+    if (d > err)
+      err = d;
+    if (fabs(out[i]) > max)
+      max = fabs(out[i]);
+  }
+  free(a.biases);
+  free(net.input);
+  free(net.workspace);
+  free(out);
+  return (max > 0) ? err / max : err;
+}
+
+int can_use_conv_algorithm(convolutional_layer l, CONV_ALGORITHM a) {
+  switch (a) {
+  case CONV_IM2COL:
+    return 1;
+  case CONV_1X1:
+    return is_pointwise(l);
+  case CONV_DIRECT:
+    return is_depthwise_convolutional(l) && !l.xnor && !l.binary;
+  case CONV_WINOGRAD:
+    return l.size == 3 && l.stride == 1 && l.groups == 1 && !l.xnor &&
+           !l.binary;
+  }
+  return 0;
+}
+
+// Used when nothing has been tuned: the specialized kernels where they apply,
+// and Winograd where it usually wins, with enough tiles to amortize the 4x
+// larger transformed filters and enough channels for the tile transforms.
+CONV_ALGORITHM default_conv_algorithm(convolutional_layer l) {
+  int tiles = (l.out_h + WINOGRAD_TILE - 1) / WINOGRAD_TILE *
+              ((l.out_w + WINOGRAD_TILE - 1) / WINOGRAD_TILE);
+  if (can_use_conv_algorithm(l, CONV_DIRECT))
+    return CONV_DIRECT;
+  if (can_use_conv_algorithm(l, CONV_1X1))
+    return CONV_1X1;
+  if (can_use_conv_algorithm(l, CONV_WINOGRAD) && tiles >= 64 && l.c >= 16 &&
+      l.n >= 16)
+    return CONV_WINOGRAD;
+  return CONV_IM2COL;
+}
+
+// Switch l to algorithm a, or to im2col if a does not apply, and resize
+// l->workspace_size; the caller owns the workspace buffer. Winograd is checked
+// against im2col when it is turned on and refused if it is off by more than
+// WINOGRAD_TOLERANCE.
+#define WINOGRAD_TOLERANCE 1e-3
+void set_conv_algorithm(convolutional_layer *l, CONV_ALGORITHM a) {
+  if (!can_use_conv_algorithm(*l, a))
+    a = CONV_IM2COL;
+#ifdef GPU
+  if (gpu_index >= 0 && a == CONV_WINOGRAD)
+    a = CONV_IM2COL;
+#endif
+  // Mapped or shared weights are not there yet; whoever brings them sets up
+  // the transformed filters.
+  if (a == CONV_WINOGRAD && !l->winograd_weights && l->weights) {
+    float err;
+    l->winograd_weights =
+        calloc((size_t)WINOGRAD_TAPS * l->n * l->c, sizeof(float));
+    update_winograd_weights(*l);
+    l->algorithm = a;
+    err = convolutional_algorithm_error(*l);
+    if (err > WINOGRAD_TOLERANCE) {
+      fprintf(stderr, "Winograd off: relative error %g\n", err);
+      a = CONV_IM2COL;
+    }
+  }
+  if (a != CONV_WINOGRAD) {
+    free(l->winograd_weights);
+    l->winograd_weights = 0;
+  }
+  l->algorithm = a;
+  l->workspace_size = get_workspace_size(*l);
+}
+
+CONV_ALGORITHM get_conv_algorithm(char *s) {
+  if (strcmp(s, "im2col") == 0)
+    return CONV_IM2COL;
+  if (strcmp(s, "1x1") == 0)
+    return CONV_1X1;
+  if (strcmp(s, "direct") == 0)
+    return CONV_DIRECT;
+  if (strcmp(s, "winograd") == 0)
+    return CONV_WINOGRAD;
+  fprintf(stderr, "Couldn't find convolution algorithm %s, going with im2col\n",
+          s);
+  return CONV_IM2COL;
+}
+
+char *get_conv_algorithm_string(CONV_ALGORITHM a) {
+  switch (a) {
+  case CONV_IM2COL:
+    return "im2col";
+  case CONV_1X1:
+    return "1x1";
+  case CONV_DIRECT:
+    return "direct";
+  case CONV_WINOGRAD:
+    return "winograd";
+  }
+  return "im2col";
+}
+
+static void forward_unfused_convolutional_layer(convolutional_layer l,
+                                                network net) {
+  fill_cpu(l.outputs * l.batch, 0, l.output, 1);
+
+  if (l.xnor) {
+    forward_xnor_convolutional_layer(l, net);
+  } else if (l.algorithm == CONV_WINOGRAD) {
+    forward_winograd_convolutional_layer(l, net);
+  } else {
+    // image im = float_to_image(l.w, l.h, l.c, net.input);
+    // printf("\nfilter_before:\n");
+    // print_image(im);
+
+    int m = l.n;                   // output channel
+    int k = l.size * l.size * l.c; // kernel size, input channel
+    int n = l.out_h * l.out_w;     // output size
+
+    float *a = l.weights;
+    float *c = l.output;
+
+    int group_size = l.c / l.groups;
+    int group_step = l.h * l.w * group_size;
+    k = k / l.groups;
+    m = m / l.groups;
+    int i, j;
+    for (i = 0; i < l.batch; ++i) {
+      for (j = 0; j < l.groups; j++) {
+        float *aoffset = a + j * k;
+        float *coffset = c + j * n * group_size;
+        float *inputoffset = net.input + group_step * j;
+        if (l.algorithm == CONV_1X1) {
+          gemm(0, 0, m, n, k, 1, aoffset, k, inputoffset, n, 1, coffset, n);
+        } else {
+          gemm_im2col(m, n, k, 1, aoffset, k, inputoffset, l.h, l.w, l.size,
+                      l.stride, l.pad, 1, coffset, n, 0);
+        }
+      }
+
+      c += l.out_h * l.out_w * l.n;
+      net.input += l.c * l.h * l.w;
+    }
   }
 
   // im = float_to_image(l.out_w, l.out_h, l.out_c, l.output);
@@ -482,10 +930,62 @@ void forward_convolutional_layer(convolutional_layer l, network net) {
   }
 
   activate_array(l.output, l.outputs * l.batch, l.activation);
-  if (l.binary || l.xnor)
+  if (l.binary)
     swap_binary(&l);
 }
 
+// Inference on the GEMM paths: bias and activation, and the residual add and
+// activation of a fused shortcut s, are applied by the GEMM epilogue to each
+// output tile while it is still in cache. Batchnorm must already be folded
+// into the weights (fuse_batchnorm_network).
+static void forward_fused_convolutional_layer(convolutional_layer l,
+                                              network net, layer *s) {
+  int m = l.n;
+  int k = l.size * l.size * l.c;
+  int n = l.out_h * l.out_w;
+  gemm_epilogue ep = {0};
+  int i;
+  ep.biases = l.biases;
+  ep.act = l.activation;
+  for (i = 0; i < l.batch; ++i) {
+    float *input = net.input + (size_t)i * l.inputs;
+    float *output = (s ? s->output : l.output) + (size_t)i * l.outputs;
+    if (s) {
+      ep.add = net.layers[s->index].output + (size_t)i * l.outputs;
+      ep.add_act = s->activation;
+    }
+    if (l.algorithm == CONV_1X1) {
+      gemm_fused(0, 0, m, n, k, 1, l.weights, k, input, n, 0, output, n, &ep);
+    } else {
+      gemm_im2col(m, n, k, 1, l.weights, k, input, l.h, l.w, l.size, l.stride,
+                  l.pad, 0, output, n, &ep);
+    }
+  }
+}
+
+void forward_convolutional_layer(convolutional_layer l, network net) {
+  layer *s =
+      (l.fused_shortcut && !net.train) ? net.layers + l.fused_shortcut : 0;
+  if (l.algorithm == CONV_DIRECT) {
+    forward_depthwise_convolutional_layer(l, net);
+  } else if (l.qweights && !net.train) {
+    forward_int8_convolutional_layer(l, net);
+  } else if (!net.train && !l.batch_normalize && l.groups == 1 && !l.xnor &&
+             !l.binary && (l.algorithm == CONV_1X1 || l.algorithm == CONV_IM2COL)) {
+    forward_fused_convolutional_layer(l, net, s);
+    return;
+  } else {
+    forward_unfused_convolutional_layer(l, net);
+  }
+  if (s) {
+    // The fused shortcut skips its own forward pass, so do its work here.
+    copy_cpu(l.outputs * l.batch, l.output, 1, s->output, 1);
+    shortcut_cpu(l.batch, s->w, s->h, s->c, net.layers[s->index].output,
+                 s->out_w, s->out_h, s->out_c, s->output);
+    activate_array(s->output, s->outputs * s->batch, s->activation);
+  }
+}
+
 void backward_convolutional_layer(convolutional_layer l, network net) {
   int i, j;
   int m = l.n;
@@ -500,8 +1000,15 @@ void backward_convolutional_layer(convolutional_layer l, network net) {
     backward_bias(l.bias_updates, l.delta, l.batch, l.n, k);
   }
 
+  if (l.algorithm == CONV_DIRECT) {
+    depthwise_args d = {&l, &net, 0};
+    parallel_for(l.n, backward_depthwise_channel, &d);
+    return;
+  }
+
   int group_size = l.c / l.groups;
   int group_step = l.h * l.w * group_size;
+  int chunk = workspace_cols(l);
   n = n / l.groups;
   m = m / l.groups;
   for (i = 0; i < l.batch; ++i) {
@@ -511,21 +1018,32 @@ void backward_convolutional_layer(convolutional_layer l, network net) {
     for (j = 0; j < l.groups; j++) {
       float *im = input_data + j * group_step;
       float *aoffset = deltas + j * group_size * k;
-      float *boffset = net.workspace;
       float *coffset = l.weight_updates + j * n;
-
-      //得到权重的更新
-      im2col_cpu(im, group_size, l.h, l.w, l.size, l.stride, l.pad, boffset);
-      gemm(0, 1, m, n, k, 1, aoffset, k, boffset, k, 1, coffset, n);
-
-      if (net.delta) {
-        aoffset = l.weights + j * n;
-        boffset = deltas + j * group_size * k;
-        coffset = net.workspace;
-
-        gemm(1, 0, n, k, m, 1, aoffset, n, boffset, k, 0, coffset, k);
-        col2im_cpu(net.workspace, group_size, l.h, l.w, l.size, l.stride, l.pad,
-                   outdeltas + j * group_step);
+      float *woffset = l.weights + j * n;
+      float *doffset = outdeltas + j * group_step;
+      int p, cols;
+
+      if (l.algorithm == CONV_1X1) {
+        gemm(0, 1, m, n, k, 1, aoffset, k, im, k, 1, coffset, n);
+        if (net.delta)
+          gemm(1, 0, n, k, m, 1, woffset, n, aoffset, k, 1, doffset, k);
+        continue;
+      }
+      for (p = 0; p < k; p += cols) {
+        cols = (k - p < chunk) ? k - p : chunk;
+
+        //得到权重的更新
+        im2col_cpu_cols(im, group_size, l.h, l.w, l.size, l.stride, l.pad, p,
+                        cols, net.workspace);
+        gemm(0, 1, m, n, cols, 1, aoffset + p, k, net.workspace, cols, 1,
+             coffset, n);
+
+        if (net.delta) {
+          gemm(1, 0, n, cols, m, 1, woffset, n, aoffset + p, k, 0,
+               net.workspace, cols);
+          col2im_cpu_cols(net.workspace, group_size, l.h, l.w, l.size,
+                          l.stride, l.pad, p, cols, doffset);
+        }
       }
     }
   }
@@ -549,6 +1067,8 @@ void update_convolutional_layer(convolutional_layer l, update_args a) {
   axpy_cpu(l.nweights, learning_rate / batch, l.weight_updates, 1, l.weights,
            1);
   scal_cpu(l.nweights, momentum, l.weight_updates, 1);
+  update_winograd_weights(l);
+  update_xnor_weights(l);
 }
 
 image get_convolutional_weight(convolutional_layer l, int i) {
@@ -566,6 +1086,8 @@ void rgbgr_weights(convolutional_layer l) {
       rgbgr_image(im);
     }
   }
+  update_winograd_weights(l);
+  update_xnor_weights(l);
 }
 
 void rescale_weights(convolutional_layer l, float scale, float trans) {
@@ -578,6 +1100,8 @@ void rescale_weights(convolutional_layer l, float scale, float trans) {
       l.biases[i] += sum * trans;
     }
   }
+  update_winograd_weights(l);
+  update_xnor_weights(l);
 }
 
 image *get_weights(convolutional_layer l) {
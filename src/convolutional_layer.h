@@ -27,12 +27,14 @@ void cudnn_convolutional_setup(layer *l);
 
 convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, int groups, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam);
 void resize_convolutional_layer(convolutional_layer *layer, int w, int h);
+void fuse_batchnorm_convolutional_layer(convolutional_layer *layer);
 void forward_convolutional_layer(const convolutional_layer layer, network net);
 void update_convolutional_layer(convolutional_layer layer, update_args a);
 image *visualize_convolutional_layer(convolutional_layer layer, char *window, image *prev_weights);
 void binarize_weights(float *weights, int n, int size, float *binary);
 void swap_binary(convolutional_layer *l);
 void binarize_weights2(float *weights, int n, int size, char *binary, float *scales);
+void pack_binary_weights(float *weights, int n, int c, int size, uint64_t *packed, float *scales);
 
 void backward_convolutional_layer(convolutional_layer layer, network net);
 
@@ -43,6 +45,15 @@ image get_convolutional_image(convolutional_layer layer);
 image get_convolutional_delta(convolutional_layer layer);
 image get_convolutional_weight(convolutional_layer layer, int i);
 
+int is_depthwise_convolutional(convolutional_layer layer);
+int can_use_conv_algorithm(convolutional_layer layer, CONV_ALGORITHM a);
+CONV_ALGORITHM default_conv_algorithm(convolutional_layer layer);
+void set_conv_algorithm(convolutional_layer *layer, CONV_ALGORITHM a);
+CONV_ALGORITHM get_conv_algorithm(char *s);
+char *get_conv_algorithm_string(CONV_ALGORITHM a);
+float convolutional_algorithm_error(convolutional_layer layer);
+void update_winograd_weights(convolutional_layer layer);
+void update_xnor_weights(convolutional_layer layer);
 int convolutional_out_height(convolutional_layer layer);
 int convolutional_out_width(convolutional_layer layer);
 
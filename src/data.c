@@ -1,6 +1,7 @@
 #include "data.h"
 #include "utils.h"
 #include "image.h"
+#include "image_u8.h"
 #include "cuda.h"
 
 #include <stdio.h>
@@ -102,6 +103,33 @@ matrix load_image_paths(char **paths, int n, int w, int h)
     return X;
 }
 
+/* Crops, flips and distorts im like random_augment_image or
+ * center_crop_image, then random_distort_image, and writes the size x size
+ * result into x. */
+void augment_image_into(image_u8 im, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center, float *x)
+{
+    image_u8 crop;
+    if(center){
+        crop = center_crop_image_u8(im, size, size);
+    } else {
+        crop = random_augment_image_u8(im, angle, aspect, min, max, size, size);
+    }
+    int flip = rand()%2;
+    if (flip) flip_image_u8(crop);
+    float dhue = rand_uniform(-hue, hue);
+    float dsat = rand_scale(saturation);
+    float dexp = rand_scale(exposure);
+    distort_image_u8_into(crop, dhue, dsat, dexp, x);
+    free_image_u8(crop);
+}
+
+void load_augment_image_into(char *path, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center, float *x)
+{
+    image_u8 im = load_image_u8_cached(path);
+    augment_image_into(im, min, max, size, angle, aspect, hue, saturation, exposure, center, x);
+    free_image_u8(im);
+}
+
 matrix load_image_augment_paths(char **paths, int n, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center)
 {
     int i;
@@ -111,25 +139,9 @@ matrix load_image_augment_paths(char **paths, int n, int min, int max, int size,
     X.cols = 0;
 
     for(i = 0; i < n; ++i){
-        image im = load_image_color(paths[i], 0, 0);
-        image crop;
-        if(center){
-            crop = center_crop_image(im, size, size);
-        } else {
-            crop = random_augment_image(im, angle, aspect, min, max, size, size);
-        }
-        int flip = rand()%2;
-        if (flip) flip_image(crop);
-        random_distort_image(crop, hue, saturation, exposure);
-
-        /*
-        show_image(im, "orig");
-        show_image(crop, "crop");
-        cvWaitKey(0);
-        */
-        free_image(im);
-        X.vals[i] = crop.data;
-        X.cols = crop.h*crop.w*crop.c;
+        X.vals[i] = calloc(size*size*3, sizeof(float));
+        X.cols = size*size*3;
+        load_augment_image_into(paths[i], min, max, size, angle, aspect, hue, saturation, exposure, center, X.vals[i]);
     }
     return X;
 }
@@ -401,9 +413,8 @@ void fill_truth_iseg(char *path, int num_boxes, float *truth, int classes, int w
 }
 
 
-void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+void detection_label_path(char *path, char *labelpath)
 {
-    char labelpath[4096];
     find_replace(path, "images", "labels", labelpath);
     find_replace(labelpath, "JPEGImages", "labels", labelpath);
 
@@ -412,8 +423,12 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
     find_replace(labelpath, ".png", ".txt", labelpath);
     find_replace(labelpath, ".JPG", ".txt", labelpath);
     find_replace(labelpath, ".JPEG", ".txt", labelpath);
-    int count = 0;
-    box_label *boxes = read_boxes(labelpath, &count);
+}
+
+/* Shuffles and corrects boxes in place for the augmentation, then writes up
+ * to num_boxes of them into truth. */
+void fill_truth_boxes(box_label *boxes, int count, int num_boxes, float *truth, int flip, float dx, float dy, float sx, float sy)
+{
     randomize_boxes(boxes, count);
     correct_boxes(boxes, count, dx, dy, sx, sy, flip);
     if(count > num_boxes) count = num_boxes;
@@ -436,6 +451,15 @@ void fill_truth_detection(char *path, int num_boxes, float *truth, int classes,
         truth[i*5+3] = h;
         truth[i*5+4] = id;
     }
+}
+
+void fill_truth_detection(char *path, int num_boxes, float *truth, int classes, int flip, float dx, float dy, float sx, float sy)
+{
+    char labelpath[4096];
+    detection_label_path(path, labelpath);
+    int count = 0;
+    box_label *boxes = read_boxes(labelpath, &count);
+    fill_truth_boxes(boxes, count, num_boxes, truth, flip, dx, dy, sx, sy);
     free(boxes);
 }
 
@@ -937,59 +961,114 @@ data load_data_swag(char **paths, int n, int classes, float jitter)
     return d;
 }
 
-data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+/* Writes an augmented w x h copy of orig into x and the matching 5*boxes
+ * truth into truth. Shuffles and corrects labels in place. The canvas is
+ * gray (128) where the image doesn't cover it. */
+static void place_detection_sample(image_u8 orig, box_label *labels, int count, int w, int h, int boxes, float jitter, float hue, float saturation, float exposure, float *x, float *truth)
 {
-    char **random_paths = get_random_paths(paths, n, m);
-    int i;
-    data d = {0};
-    d.shallow = 0;
+    image_u8 sized = make_image_u8(w, h, orig.c);
+    fill_image_u8(sized, 128);
 
-    d.X.rows = n;
-    d.X.vals = calloc(d.X.rows, sizeof(float*));
-    d.X.cols = h*w*3;
+    float dw = jitter * orig.w;
+    float dh = jitter * orig.h;
 
-    d.y = make_matrix(n, 5*boxes);
-    for(i = 0; i < n; ++i){
-        image orig = load_image_color(random_paths[i], 0, 0);
-        image sized = make_image(w, h, orig.c);
-        fill_image(sized, .5);
+    float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
+    float scale = rand_uniform(.25, 2);
 
-        float dw = jitter * orig.w;
-        float dh = jitter * orig.h;
+    float nw, nh;
 
-        float new_ar = (orig.w + rand_uniform(-dw, dw)) / (orig.h + rand_uniform(-dh, dh));
-        float scale = rand_uniform(.25, 2);
+    if(new_ar < 1){
+        nh = scale * h;
+        nw = nh * new_ar;
+    } else {
+        nw = scale * w;
+        nh = nw / new_ar;
+    }
 
-        float nw, nh;
+    float dx = rand_uniform(0, w - nw);
+    float dy = rand_uniform(0, h - nh);
 
-        if(new_ar < 1){
-            nh = scale * h;
-            nw = nh * new_ar;
-        } else {
-            nw = scale * w;
-            nh = nw / new_ar;
-        }
+    place_image_u8(orig, nw, nh, dx, dy, sized);
 
-        float dx = rand_uniform(0, w - nw);
-        float dy = rand_uniform(0, h - nh);
+    float dhue = rand_uniform(-hue, hue);
+    float dsat = rand_scale(saturation);
+    float dexp = rand_scale(exposure);
+    int flip = rand()%2;
+    if(flip) flip_image_u8(sized);
+    distort_image_u8_into(sized, dhue, dsat, dexp, x);
+    free_image_u8(sized);
 
-        place_image(orig, nw, nh, dx, dy, sized);
+    memset(truth, 0, 5*boxes*sizeof(float));
+    fill_truth_boxes(labels, count, boxes, truth, flip, -dx/w, -dy/h, nw/w, nh/h);
+}
 
-        random_distort_image(sized, hue, saturation, exposure);
-        int flip = rand()%2;
-        if(flip) flip_image(sized);
-        d.X.vals[i] = sized.data;
+void load_detection_sample(char *path, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure, float *x, float *truth)
+{
+    char labelpath[4096];
+    int count = 0;
+    image_u8 orig = load_image_u8_cached(path);
+    detection_label_path(path, labelpath);
+    box_label *labels = read_boxes(labelpath, &count);
+    place_detection_sample(orig, labels, count, w, h, boxes, jitter, hue, saturation, exposure, x, truth);
+    free(labels);
+    free_image_u8(orig);
+}
+
+/* One sample of a packed dataset, loaded the way a.type loads files. */
+void load_packed_sample(load_args a, int index, float *x, float *y)
+{
+    image_u8 im = packed_image_u8(a.packed, index);
+    if(a.type == DETECTION_DATA){
+        int count = 0;
+        box_label *labels = packed_boxes(a.packed, index, &count);
+        place_detection_sample(im, labels, count, a.w, a.h, a.num_boxes, a.jitter, a.hue, a.saturation, a.exposure, x, y);
+        free(labels);
+    } else {
+        char *path = packed_path(a.packed, index);
+        if(a.type == CLASSIFICATION_DATA){
+            augment_image_into(im, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure, a.center, x);
+        } else {
+            resize_image_u8_into(im, a.w, a.h, x);
+        }
+        if(a.labels) fill_truth(path, a.labels, a.classes, y);
+        if(a.labels && a.hierarchy) fill_hierarchy(y, a.classes, a.hierarchy);
+    }
+}
 
+data load_data_packed(load_args a)
+{
+    int i;
+    int n = packed_data_size(a.packed);
+    int cols = (a.type == CLASSIFICATION_DATA) ? a.size*a.size*3 : a.w*a.h*3;
+    data d = {0};
+    d.shallow = 0;
+    d.w = a.w;
+    d.h = a.h;
+    d.X = make_matrix(a.n, cols);
+    d.y = make_matrix(a.n, a.type == DETECTION_DATA ? 5*a.num_boxes : a.classes);
+    for(i = 0; i < a.n; ++i){
+        load_packed_sample(a, rand()%n, d.X.vals[i], d.y.vals[i]);
+    }
+    return d;
+}
 
-        fill_truth_detection(random_paths[i], boxes, d.y.vals[i], classes, flip, -dx/w, -dy/h, nw/w, nh/h);
+data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure)
+{
+    char **random_paths = get_random_paths(paths, n, m);
+    int i;
+    data d = {0};
+    d.shallow = 0;
 
-        free_image(orig);
+    d.X = make_matrix(n, h*w*3);
+    d.y = make_matrix(n, 5*boxes);
+    for(i = 0; i < n; ++i){
+        load_detection_sample(random_paths[i], w, h, boxes, classes, jitter, hue, saturation, exposure, d.X.vals[i], d.y.vals[i]);
     }
     free(random_paths);
     return d;
 }
 
-void *load_thread(void *ptr)
+void load_thread(void *ptr)
 {
     //printf("Loading data: %d\n", rand());
     load_args a = *(struct load_args*)ptr;
@@ -997,7 +1076,9 @@ void *load_thread(void *ptr)
     if(a.saturation == 0) a.saturation = 1;
     if(a.aspect == 0) a.aspect = 1;
 
-    if (a.type == OLD_CLASSIFICATION_DATA){
+    if (a.packed && (a.type == DETECTION_DATA || a.type == CLASSIFICATION_DATA || a.type == OLD_CLASSIFICATION_DATA)){
+        *a.d = load_data_packed(a);
+    } else if (a.type == OLD_CLASSIFICATION_DATA){
         *a.d = load_data_old(a.paths, a.n, a.m, a.labels, a.classes, a.w, a.h);
     } else if (a.type == REGRESSION_DATA){
         *a.d = load_data_regression(a.paths, a.n, a.m, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure);
@@ -1023,25 +1104,25 @@ void *load_thread(void *ptr)
         *(a.im) = load_image_color(a.path, 0, 0);
         *(a.resized) = resize_image(*(a.im), a.w, a.h);
     } else if (a.type == LETTERBOX_DATA){
-        *(a.im) = load_image_color(a.path, 0, 0);
-        *(a.resized) = letterbox_image(*(a.im), a.w, a.h);
+        /* Only the source size is kept; the validators need nothing else. */
+        int w, h;
+        *(a.resized) = make_image(a.w, a.h, 3);
+        load_image_letterbox(a.path, *(a.resized), &w, &h);
+        *(a.im) = make_empty_image(w, h, 3);
     } else if (a.type == TAG_DATA){
         *a.d = load_data_tag(a.paths, a.n, a.m, a.classes, a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure);
     }
     free(ptr);
-    return 0;
 }
 
-pthread_t load_data_in_thread(load_args args)
+task *load_data_in_thread(load_args args)
 {
-    pthread_t thread;
     struct load_args *ptr = calloc(1, sizeof(struct load_args));
     *ptr = args;
-    if(pthread_create(&thread, 0, load_thread, ptr)) error("Thread creation failed");
-    return thread;
+    return submit_task(load_thread, ptr);
 }
 
-void *load_threads(void *ptr)
+void load_threads(void *ptr)
 {
     int i;
     load_args args = *(load_args *)ptr;
@@ -1050,14 +1131,14 @@ void *load_threads(void *ptr)
     int total = args.n;
     free(ptr);
     data *buffers = calloc(args.threads, sizeof(data));
-    pthread_t *threads = calloc(args.threads, sizeof(pthread_t));
+    task **threads = calloc(args.threads, sizeof(task *));
     for(i = 0; i < args.threads; ++i){
         args.d = buffers + i;
         args.n = (i+1) * total/args.threads - i * total/args.threads;
         threads[i] = load_data_in_thread(args);
     }
     for(i = 0; i < args.threads; ++i){
-        pthread_join(threads[i], 0);
+        wait_task(threads[i]);
     }
     *out = concat_datas(buffers, args.threads);
     out->shallow = 0;
@@ -1067,7 +1148,6 @@ void *load_threads(void *ptr)
     }
     free(buffers);
     free(threads);
-    return 0;
 }
 
 void load_data_blocking(load_args args)
@@ -1077,13 +1157,11 @@ void load_data_blocking(load_args args)
     load_thread(ptr);
 }
 
-pthread_t load_data(load_args args)
+task *load_data(load_args args)
 {
-    pthread_t thread;
     struct load_args *ptr = calloc(1, sizeof(struct load_args));
     *ptr = args;
-    if(pthread_create(&thread, 0, load_threads, ptr)) error("Thread creation failed");
-    return thread;
+    return submit_task(load_threads, ptr);
 }
 
 data load_data_writing(char **paths, int n, int m, int w, int h, int out_w, int out_h)
@@ -26,6 +26,13 @@ data load_data_captcha(char **paths, int n, int m, int k, int w, int h);
 data load_data_captcha_encode(char **paths, int n, int m, int w, int h);
 data load_data_detection(int n, char **paths, int m, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure);
 data load_data_tag(char **paths, int n, int m, int k, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure);
+void detection_label_path(char *path, char *labelpath);
+void fill_truth_boxes(box_label *boxes, int count, int num_boxes, float *truth, int flip, float dx, float dy, float sx, float sy);
+void load_packed_sample(load_args a, int index, float *x, float *y);
+data load_data_packed(load_args a);
+void augment_image_into(image_u8 im, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center, float *x);
+void load_detection_sample(char *path, int w, int h, int boxes, int classes, float jitter, float hue, float saturation, float exposure, float *x, float *truth);
+void load_augment_image_into(char *path, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center, float *x);
 matrix load_image_augment_paths(char **paths, int n, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center);
 data load_data_super(char **paths, int n, int m, int w, int h, int scale);
 data load_data_augment(char **paths, int n, int m, char **labels, int k, tree *hierarchy, int min, int max, int size, float angle, float aspect, float hue, float saturation, float exposure, int center);
@@ -46,5 +53,7 @@ void randomize_data(data d);
 data *split_data(data d, int part, int total);
 data concat_datas(data *d, int n);
 void fill_truth(char *path, char **labels, int k, float *truth);
+void fill_hierarchy(float *truth, int k, tree *hierarchy);
+char **get_random_paths(char **paths, int n, int m);
 
 #endif
@@ -0,0 +1,197 @@
+#include "data.h"
+#include "image_u8.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Long-lived training data loader. It owns a ring of depth + 1 batches,
+ * allocated once with every matrix in one block. The thread pool keeps
+ * filling every batch except the one the trainer is using. Each
+ * batch is split into args.threads parts, and a part loads its samples
+ * straight into its rows, so steady-state training allocates no batch
+ * buffers and concatenates nothing. The batch the trainer was given is
+ * refilled when it asks for the next one.
+ */
+
+typedef struct{
+    data d;
+    task **parts;
+} loader_slot;
+
+struct data_loader{
+    load_args args;
+    int depth;
+    int parts;
+    int next;
+    int current;
+    loader_slot *slots;
+};
+
+typedef struct{
+    load_args args;
+    matrix X;
+    matrix y;
+    int start;
+    int end;
+} loader_part;
+
+static int loader_supports(data_type type)
+{
+    return type == DETECTION_DATA || type == CLASSIFICATION_DATA || type == OLD_CLASSIFICATION_DATA;
+}
+
+static matrix make_block_matrix(int rows, int cols)
+{
+    int i;
+    matrix m;
+    m.rows = rows;
+    m.cols = cols;
+    m.vals = calloc(rows, sizeof(float *));
+    m.vals[0] = calloc((size_t)rows*cols, sizeof(float));
+    for(i = 1; i < rows; ++i) m.vals[i] = m.vals[0] + (size_t)i*cols;
+    return m;
+}
+
+static void free_block_matrix(matrix m)
+{
+    free(m.vals[0]);
+    free(m.vals);
+}
+
+static void load_part(void *ptr)
+{
+    loader_part p = *(loader_part *)ptr;
+    load_args a = p.args;
+    int n = p.end - p.start;
+    int i;
+    char **paths = 0;
+    free(ptr);
+    if(a.exposure == 0) a.exposure = 1;
+    if(a.saturation == 0) a.saturation = 1;
+    if(a.aspect == 0) a.aspect = 1;
+
+    if(!a.packed) paths = get_random_paths(a.paths, n, a.m);
+    for(i = 0; i < n; ++i){
+        float *x = p.X.vals[p.start + i];
+        float *y = p.y.vals[p.start + i];
+        if(a.packed){
+            load_packed_sample(a, rand()%a.m, x, y);
+        } else if(a.type == DETECTION_DATA){
+            load_detection_sample(paths[i], a.w, a.h, a.num_boxes, a.classes, a.jitter, a.hue, a.saturation, a.exposure, x, y);
+        } else {
+            if(a.type == CLASSIFICATION_DATA){
+                load_augment_image_into(paths[i], a.min, a.max, a.size, a.angle, a.aspect, a.hue, a.saturation, a.exposure, a.center, x);
+            } else {
+                image_u8 im = load_image_u8(paths[i]);
+                resize_image_u8_into(im, a.w, a.h, x);
+                free_image_u8(im);
+            }
+            if(a.labels) fill_truth(paths[i], a.labels, a.classes, y);
+            if(a.labels && a.hierarchy) fill_hierarchy(y, a.classes, a.hierarchy);
+        }
+    }
+    free(paths);
+}
+
+static void fill_slot(data_loader *l, loader_slot *s)
+{
+    int i;
+    for(i = 0; i < l->parts; ++i){
+        loader_part *p = calloc(1, sizeof(loader_part));
+        p->args = l->args;
+        p->X = s->d.X;
+        p->y = s->d.y;
+        p->start = i*l->args.n/l->parts;
+        p->end = (i+1)*l->args.n/l->parts;
+        s->parts[i] = submit_task(load_part, p);
+    }
+}
+
+static void wait_slot(data_loader *l, loader_slot *s)
+{
+    int i;
+    for(i = 0; i < l->parts; ++i){
+        wait_task(s->parts[i]);
+        s->parts[i] = 0;
+    }
+}
+
+static void make_slots(data_loader *l)
+{
+    int i;
+    load_args a = l->args;
+    int cols = (a.type == CLASSIFICATION_DATA) ? a.size*a.size*3 : a.w*a.h*3;
+    int truths = (a.type == DETECTION_DATA) ? 5*a.num_boxes : a.classes;
+    l->slots = calloc(l->depth + 1, sizeof(loader_slot));
+    for(i = 0; i <= l->depth; ++i){
+        loader_slot *s = l->slots + i;
+        s->d.X = make_block_matrix(a.n, cols);
+        s->d.y = make_block_matrix(a.n, truths);
+        s->d.w = a.w;
+        s->d.h = a.h;
+        s->d.shallow = 1;
+        s->parts = calloc(l->parts, sizeof(task *));
+    }
+    for(i = 0; i <= l->depth; ++i) fill_slot(l, l->slots + i);
+    l->next = 0;
+    l->current = -1;
+}
+
+static void free_slots(data_loader *l)
+{
+    int i;
+    for(i = 0; i <= l->depth; ++i){
+        loader_slot *s = l->slots + i;
+        wait_slot(l, s);
+        free_block_matrix(s->d.X);
+        free_block_matrix(s->d.y);
+        free(s->parts);
+    }
+    free(l->slots);
+}
+
+/* Keeps depth batches loading ahead of the trainer. Supports detection and
+ * classification data; load_data still serves the other types. */
+data_loader *make_data_loader(load_args args, int depth)
+{
+    data_loader *l;
+    if(!loader_supports(args.type)) error("Data type not supported by the data loader, use load_data");
+    if(args.n <= 0) error("Data loader needs a batch size");
+    l = calloc(1, sizeof(data_loader));
+    l->args = args;
+    l->depth = depth > 0 ? depth : 1;
+    l->parts = args.threads > 0 ? args.threads : 1;
+    if(l->parts > args.n) l->parts = args.n;
+    make_slots(l);
+    return l;
+}
+
+/* The batch belongs to the loader and stays valid until the next call. */
+data get_data_loader_batch(data_loader *l)
+{
+    loader_slot *s = l->slots + l->next;
+    if(l->current >= 0) fill_slot(l, l->slots + l->current);
+    wait_slot(l, s);
+    l->current = l->next;
+    l->next = (l->next + 1) % (l->depth + 1);
+    return s->d;
+}
+
+/* Drops the batches loaded at the old size and starts over at w x h. */
+void resize_data_loader(data_loader *l, int w, int h)
+{
+    free_slots(l);
+    l->args.w = w;
+    l->args.h = h;
+    make_slots(l);
+}
+
+void free_data_loader(data_loader *l)
+{
+    if(!l) return;
+    free_slots(l);
+    free(l);
+}
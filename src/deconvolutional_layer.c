@@ -33,13 +33,13 @@ layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size
     l.nweights = c*n*size*size;
     l.nbiases = n;
 
-    l.weights = calloc(c*n*size*size, sizeof(float));
-    l.weight_updates = calloc(c*n*size*size, sizeof(float));
+    l.weights = weights_calloc(c*n*size*size, sizeof(float));
+    l.weight_updates = training_calloc(c*n*size*size, sizeof(float));
 
     l.biases = calloc(n, sizeof(float));
-    l.bias_updates = calloc(n, sizeof(float));
+    l.bias_updates = training_calloc(n, sizeof(float));
     float scale = .02;
-    for(i = 0; i < c*n*size*size; ++i) l.weights[i] = scale*rand_normal();
+    for(i = 0; l.weights && i < c*n*size*size; ++i) l.weights[i] = scale*rand_normal();
     for(i = 0; i < n; ++i){
         l.biases[i] = 0;
     }
@@ -52,7 +52,7 @@ layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size
     l.inputs = l.w * l.h * l.c;
 
     l.output = calloc(l.batch*l.outputs, sizeof(float));
-    l.delta  = calloc(l.batch*l.outputs, sizeof(float));
+    l.delta  = training_calloc(l.batch*l.outputs, sizeof(float));
 
     l.forward = forward_deconvolutional_layer;
     l.backward = backward_deconvolutional_layer;
@@ -62,29 +62,29 @@ layer make_deconvolutional_layer(int batch, int h, int w, int c, int n, int size
 
     if(batch_normalize){
         l.scales = calloc(n, sizeof(float));
-        l.scale_updates = calloc(n, sizeof(float));
+        l.scale_updates = training_calloc(n, sizeof(float));
         for(i = 0; i < n; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(n, sizeof(float));
-        l.variance = calloc(n, sizeof(float));
+        l.mean = training_calloc(n, sizeof(float));
+        l.variance = training_calloc(n, sizeof(float));
 
-        l.mean_delta = calloc(n, sizeof(float));
-        l.variance_delta = calloc(n, sizeof(float));
+        l.mean_delta = training_calloc(n, sizeof(float));
+        l.variance_delta = training_calloc(n, sizeof(float));
 
         l.rolling_mean = calloc(n, sizeof(float));
         l.rolling_variance = calloc(n, sizeof(float));
-        l.x = calloc(l.batch*l.outputs, sizeof(float));
-        l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        l.x = training_calloc(l.batch*l.outputs, sizeof(float));
+        l.x_norm = training_calloc(l.batch*l.outputs, sizeof(float));
     }
     if(adam){
-        l.m = calloc(c*n*size*size, sizeof(float));
-        l.v = calloc(c*n*size*size, sizeof(float));
-        l.bias_m = calloc(n, sizeof(float));
-        l.scale_m = calloc(n, sizeof(float));
-        l.bias_v = calloc(n, sizeof(float));
-        l.scale_v = calloc(n, sizeof(float));
+        l.m = training_calloc(c*n*size*size, sizeof(float));
+        l.v = training_calloc(c*n*size*size, sizeof(float));
+        l.bias_m = training_calloc(n, sizeof(float));
+        l.scale_m = training_calloc(n, sizeof(float));
+        l.bias_v = training_calloc(n, sizeof(float));
+        l.scale_v = training_calloc(n, sizeof(float));
     }
 
 #ifdef GPU
@@ -170,8 +170,8 @@ void resize_deconvolutional_layer(layer *l, int h, int w)
     l->inputs = l->w * l->h * l->c;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
-    if(l->batch_normalize){
+    if(l->delta) l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+    if(l->x){
         l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
         l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
     }
@@ -51,7 +51,7 @@ double get_wall_time()
     return (double)time.tv_sec + (double)time.tv_usec * .000001;
 }
 
-void *detect_in_thread(void *ptr)
+void detect_in_thread(void *ptr)
 {
     running = 1;
     float nms = .4;
@@ -81,15 +81,13 @@ void *detect_in_thread(void *ptr)
 
     demo_index = (demo_index + 1)%demo_frame;
     running = 0;
-    return 0;
 }
 
-void *fetch_in_thread(void *ptr)
+void fetch_in_thread(void *ptr)
 {
     int status = fill_image_from_stream(cap, buff[buff_index]);
     letterbox_image_into(buff[buff_index], net.w, net.h, buff_letter[buff_index]);
     if(status == 0) demo_done = 1;
-    return 0;
 }
 
 void *display_in_thread(void *ptr)
@@ -139,13 +137,10 @@ void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const ch
     demo_thresh = thresh;
     demo_hier = hier;
     printf("Demo\n");
-    net = parse_network_cfg(cfgfile);
-    if(weightfile){
-        load_weights(&net, weightfile);
-    }
+    net = load_network_inference(cfgfile, weightfile);
     set_batch_network(&net, 1);
-    pthread_t detect_thread;
-    pthread_t fetch_thread;
+    task *detect_thread;
+    task *fetch_thread;
 
     srand(2222222);
 
@@ -202,8 +197,8 @@ void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const ch
 
     while(!demo_done){
         buff_index = (buff_index + 1) %3;
-        if(pthread_create(&fetch_thread, 0, fetch_in_thread, 0)) error("Thread creation failed");
-        if(pthread_create(&detect_thread, 0, detect_in_thread, 0)) error("Thread creation failed");
+        fetch_thread = submit_task(fetch_in_thread, 0);
+        detect_thread = submit_task(detect_in_thread, 0);
         if(!prefix){
             fps = 1./(get_wall_time() - demo_time);
             demo_time = get_wall_time();
@@ -213,8 +208,8 @@ void demo(char *cfgfile, char *weightfile, float thresh, int cam_index, const ch
             sprintf(name, "%s_%08d", prefix, count);
             save_image(buff[(buff_index + 1)%3], name);
         }
-        pthread_join(fetch_thread, 0);
-        pthread_join(detect_thread, 0);
+        wait_task(fetch_thread);
+        wait_task(detect_thread);
         ++count;
     }
 }
@@ -230,10 +225,10 @@ void demo_compare(char *cfg1, char *weight1, char *cfg2, char *weight2, float th
     demo_thresh = thresh;
     demo_hier = hier;
     printf("Demo\n");
-    net = load_network(cfg1, weight1, 0);
+    net = load_network_inference(cfg1, weight1);
     set_batch_network(&net, 1);
-    pthread_t detect_thread;
-    pthread_t fetch_thread;
+    task *detect_thread;
+    task *fetch_thread;
 
     srand(2222222);
 
@@ -290,8 +285,8 @@ void demo_compare(char *cfg1, char *weight1, char *cfg2, char *weight2, float th
 
     while(!demo_done){
         buff_index = (buff_index + 1) %3;
-        if(pthread_create(&fetch_thread, 0, fetch_in_thread, 0)) error("Thread creation failed");
-        if(pthread_create(&detect_thread, 0, detect_in_thread, 0)) error("Thread creation failed");
+        fetch_thread = submit_task(fetch_in_thread, 0);
+        detect_thread = submit_task(detect_in_thread, 0);
         if(!prefix){
             fps = 1./(get_wall_time() - demo_time);
             demo_time = get_wall_time();
@@ -301,8 +296,8 @@ void demo_compare(char *cfg1, char *weight1, char *cfg2, char *weight2, float th
             sprintf(name, "%s_%08d", prefix, count);
             save_image(buff[(buff_index + 1)%3], name);
         }
-        pthread_join(fetch_thread, 0);
-        pthread_join(detect_thread, 0);
+        wait_task(fetch_thread);
+        wait_task(detect_thread);
         ++count;
     }
 }
@@ -0,0 +1,346 @@
+#include "depthwise.h"
+#include "activations.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Direct depthwise convolution of a single channel plane. im2col + GEMM is a
+ * poor fit here: every filter has only size*size taps, so the GEMM degenerates
+ * to M=1 and spends its time packing. Instead the plane is copied once into a
+ * zero-padded buffer and each output row is computed as a sum of size*size
+ * shifted input rows by a SIMD kernel that keeps the outputs in registers.
+ * With the padding explicit there are no border cases; the buffer has DW_SLACK
+ * extra columns so the last vector of a row may run past out_w.
+ *
+ * The forward pass applies out = act(scale*conv + bias) while the row is
+ * still in L1, which lets inference fold batchnorm into scale/bias.
+ */
+
+#define DW_SLACK 80
+
+typedef void (*dw_row_fn)(const float *in, int pw, const float *k, int size, int stride, int out_w, float *out);
+
+static float *dw_pad_plane(const float *in, int h, int w, int pad, int pw)
+{
+    float *p = calloc((size_t)(h + 2*pad)*pw, sizeof(float));
+    int i;
+    for(i = 0; i < h; ++i) memcpy(p + (size_t)(i + pad)*pw + pad, in + (size_t)i*w, w*sizeof(float));
+    return p;
+}
+
+static void dw_row_scalar(const float *in, int pw, const float *k, int size, int stride, int out_w, float *out)
+{
+    int ky, kx, ow;
+    memset(out, 0, out_w*sizeof(float));
+    for(ky = 0; ky < size; ++ky){
+        for(kx = 0; kx < size; ++kx){
+            const float *r = in + ky*pw + kx;
+            float kv = k[ky*size + kx];
+            for(ow = 0; ow < out_w; ++ow) out[ow] += kv*r[ow*stride];
+        }
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DEPTHWISE_X86
+#include <immintrin.h>
+
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) __m256 dw_load_avx2(const float *p, int stride)
+{
+    __m256 a, b;
+    if(stride == 1) return _mm256_loadu_ps(p);
+    a = _mm256_loadu_ps(p);
+    b = _mm256_loadu_ps(p + 8);
+    a = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(a), _MM_SHUFFLE(3,1,2,0)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void dw_row_avx2_impl(const float *in, int pw, const float *k,
+        int size, int stride, int out_w, float *out)
+{
+    int ky, kx, ow;
+    for(ow = 0; ow + 8 < out_w; ow += 16){
+        const float *r = in + ow*stride;
+        __m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps();
+        for(ky = 0; ky < size; ++ky, r += pw){
+            for(kx = 0; kx < size; ++kx){
+                __m256 kv = _mm256_broadcast_ss(k + ky*size + kx);
+                c0 = _mm256_fmadd_ps(kv, dw_load_avx2(r + kx, stride), c0);
+                c1 = _mm256_fmadd_ps(kv, dw_load_avx2(r + kx + 8*stride, stride), c1);
+            }
+        }
+        _mm256_storeu_ps(out + ow, c0);
+        _mm256_storeu_ps(out + ow + 8, c1);
+    }
+    if(ow < out_w){
+        const float *r = in + ow*stride;
+        __m256 c0 = _mm256_setzero_ps();
+        for(ky = 0; ky < size; ++ky, r += pw){
+            for(kx = 0; kx < size; ++kx){
+                c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(k + ky*size + kx), dw_load_avx2(r + kx, stride), c0);
+            }
+        }
+        _mm256_storeu_ps(out + ow, c0);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void dw_row_avx2(const float *in, int pw, const float *k, int size, int stride, int out_w, float *out)
+{
+    if(size == 3 && stride == 1) dw_row_avx2_impl(in, pw, k, 3, 1, out_w, out);
+    else if(size == 3 && stride == 2) dw_row_avx2_impl(in, pw, k, 3, 2, out_w, out);
+    else if(size == 5 && stride == 1) dw_row_avx2_impl(in, pw, k, 5, 1, out_w, out);
+    else if(size == 5 && stride == 2) dw_row_avx2_impl(in, pw, k, 5, 2, out_w, out);
+    else if(stride == 1) dw_row_avx2_impl(in, pw, k, size, 1, out_w, out);
+    else if(stride == 2) dw_row_avx2_impl(in, pw, k, size, 2, out_w, out);
+    else dw_row_scalar(in, pw, k, size, stride, out_w, out);
+}
+
+__attribute__((target("avx512f")))
+static inline __attribute__((always_inline)) __m512 dw_load_avx512(const float *p, int stride)
+{
+    if(stride == 1) return _mm512_loadu_ps(p);
+    return _mm512_permutex2var_ps(_mm512_loadu_ps(p),
+            _mm512_setr_epi32(0,2,4,6,8,10,12,14,16,18,20,22,24,26,28,30), _mm512_loadu_ps(p + 16));
+}
+
+__attribute__((target("avx512f")))
+static inline __attribute__((always_inline)) void dw_row_avx512_impl(const float *in, int pw, const float *k,
+        int size, int stride, int out_w, float *out)
+{
+    int ky, kx, ow;
+    for(ow = 0; ow + 16 < out_w; ow += 32){
+        const float *r = in + ow*stride;
+        __m512 c0 = _mm512_setzero_ps(), c1 = _mm512_setzero_ps();
+        for(ky = 0; ky < size; ++ky, r += pw){
+            for(kx = 0; kx < size; ++kx){
+                __m512 kv = _mm512_set1_ps(k[ky*size + kx]);
+                c0 = _mm512_fmadd_ps(kv, dw_load_avx512(r + kx, stride), c0);
+                c1 = _mm512_fmadd_ps(kv, dw_load_avx512(r + kx + 16*stride, stride), c1);
+            }
+        }
+        _mm512_storeu_ps(out + ow, c0);
+        _mm512_storeu_ps(out + ow + 16, c1);
+    }
+    if(ow < out_w){
+        const float *r = in + ow*stride;
+        __m512 c0 = _mm512_setzero_ps();
+        for(ky = 0; ky < size; ++ky, r += pw){
+            for(kx = 0; kx < size; ++kx){
+                c0 = _mm512_fmadd_ps(_mm512_set1_ps(k[ky*size + kx]), dw_load_avx512(r + kx, stride), c0);
+            }
+        }
+        _mm512_storeu_ps(out + ow, c0);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void dw_row_avx512(const float *in, int pw, const float *k, int size, int stride, int out_w, float *out)
+{
+    if(size == 3 && stride == 1) dw_row_avx512_impl(in, pw, k, 3, 1, out_w, out);
+    else if(size == 3 && stride == 2) dw_row_avx512_impl(in, pw, k, 3, 2, out_w, out);
+    else if(size == 5 && stride == 1) dw_row_avx512_impl(in, pw, k, 5, 1, out_w, out);
+    else if(size == 5 && stride == 2) dw_row_avx512_impl(in, pw, k, 5, 2, out_w, out);
+    else if(stride == 1) dw_row_avx512_impl(in, pw, k, size, 1, out_w, out);
+    else if(stride == 2) dw_row_avx512_impl(in, pw, k, size, 2, out_w, out);
+    else dw_row_scalar(in, pw, k, size, stride, out_w, out);
+}
+#endif
+
+static pthread_once_t dw_row_once = PTHREAD_ONCE_INIT;
+static dw_row_fn dw_row_selected;
+
+static void init_dw_row()
+{
+    dw_row_fn r = dw_row_scalar;
+#ifdef DEPTHWISE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) r = dw_row_avx512;
+    else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) r = dw_row_avx2;
+#endif
+    dw_row_selected = r;
+}
+
+static dw_row_fn get_dw_row()
+{
+    pthread_once(&dw_row_once, init_dw_row);
+    return dw_row_selected;
+}
+
+static void dw_epilogue(const float *x, int n, float scale, float bias, ACTIVATION a, float *y)
+{
+    int i;
+    if(a == LEAKY){
+        for(i = 0; i < n; ++i){
+            float v = scale*x[i] + bias;
+            y[i] = (v > 0) ? v : .1f*v;
+        }
+    } else if(a == RELU){
+        for(i = 0; i < n; ++i){
+            float v = scale*x[i] + bias;
+            y[i] = (v > 0) ? v : 0;
+        }
+    } else {
+        for(i = 0; i < n; ++i) y[i] = scale*x[i] + bias;
+        if(a != LINEAR) activate_array(y, n, a);
+    }
+}
+
+void depthwise_conv2d(const float *in, int h, int w, const float *k, int size, int stride, int pad,
+        float scale, float bias, ACTIVATION a, float *out)
+{
+    dw_row_fn row = get_dw_row();
+    int out_h = (h + 2*pad - size)/stride + 1;
+    int out_w = (w + 2*pad - size)/stride + 1;
+    int pw = w + 2*pad + DW_SLACK;
+    float *p = dw_pad_plane(in, h, w, pad, pw);
+    float *acc = calloc(out_w + DW_SLACK/2, sizeof(float));
+    int oh;
+    for(oh = 0; oh < out_h; ++oh){
+        row(p + (size_t)oh*stride*pw, pw, k, size, stride, out_w, acc);
+        dw_epilogue(acc, out_w, scale, bias, a, out + (size_t)oh*out_w);
+    }
+    free(acc);
+    free(p);
+}
+
+/*
+ * Backward for one channel plane. The filter gradient is the correlation of
+ * the padded input with delta, one dot product per tap and output row. The
+ * input gradient is a transposed convolution; it is computed as a forward
+ * stride-1 correlation of the flipped filter with delta, after delta is
+ * spread out by the stride and padded by size-1-pad, so it reuses the row
+ * kernels above.
+ */
+static inline __attribute__((always_inline)) void dw_filter_updates(const float *p, int pw, int out_h, int out_w,
+        int size, int stride, const float *delta, float *k_updates)
+{
+    int oh, ky, kx, ow;
+    for(oh = 0; oh < out_h; ++oh){
+        const float *d = delta + oh*out_w;
+        for(ky = 0; ky < size; ++ky){
+            const float *r = p + (size_t)(oh*stride + ky)*pw;
+            for(kx = 0; kx < size; ++kx){
+                float sum = 0;
+                if(stride == 1){
+                    for(ow = 0; ow < out_w; ++ow) sum += d[ow]*r[ow + kx];
+                } else {
+                    for(ow = 0; ow < out_w; ++ow) sum += d[ow]*r[ow*stride + kx];
+                }
+                k_updates[ky*size + kx] += sum;
+            }
+        }
+    }
+}
+
+typedef void (*dw_filter_updates_fn)(const float *p, int pw, int out_h, int out_w,
+        int size, int stride, const float *delta, float *k_updates);
+
+static void dw_filter_updates_scalar(const float *p, int pw, int out_h, int out_w,
+        int size, int stride, const float *delta, float *k_updates)
+{
+    dw_filter_updates(p, pw, out_h, out_w, size, stride, delta, k_updates);
+}
+
+#ifdef DEPTHWISE_X86
+__attribute__((target("avx2,fma")))
+static void dw_filter_updates_avx2(const float *p, int pw, int out_h, int out_w,
+        int size, int stride, const float *delta, float *k_updates)
+{
+    dw_filter_updates(p, pw, out_h, out_w, size, stride, delta, k_updates);
+}
+
+__attribute__((target("avx512f")))
+static void dw_filter_updates_avx512(const float *p, int pw, int out_h, int out_w,
+        int size, int stride, const float *delta, float *k_updates)
+{
+    dw_filter_updates(p, pw, out_h, out_w, size, stride, delta, k_updates);
+}
+#endif
+
+static pthread_once_t dw_filter_updates_once = PTHREAD_ONCE_INIT;
+static dw_filter_updates_fn dw_filter_updates_selected;
+
+static void init_dw_filter_updates()
+{
+    dw_filter_updates_fn u = dw_filter_updates_scalar;
+#ifdef DEPTHWISE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) u = dw_filter_updates_avx512;
+    else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) u = dw_filter_updates_avx2;
+#endif
+    dw_filter_updates_selected = u;
+}
+
+static dw_filter_updates_fn get_dw_filter_updates()
+{
+    pthread_once(&dw_filter_updates_once, init_dw_filter_updates);
+    return dw_filter_updates_selected;
+}
+
+static void dw_input_delta(int h, int w, const float *k, int size, int stride, int pad,
+        const float *delta, float *in_delta)
+{
+    dw_row_fn row = get_dw_row();
+    int out_h = (h + 2*pad - size)/stride + 1;
+    int out_w = (w + 2*pad - size)/stride + 1;
+    int edge = size - 1 - pad;
+    int pw = w + size - 1 + DW_SLACK;
+    float *flip = calloc(size*size, sizeof(float));
+    float *d = calloc((size_t)(h + size - 1)*pw, sizeof(float));
+    float *acc = calloc(w + DW_SLACK/2, sizeof(float));
+    int i, j;
+    for(i = 0; i < size*size; ++i) flip[i] = k[size*size - 1 - i];
+    for(i = 0; i < out_h; ++i){
+        float *dr = d + (size_t)(i*stride + edge)*pw + edge;
+        for(j = 0; j < out_w; ++j) dr[j*stride] = delta[i*out_w + j];
+    }
+    for(i = 0; i < h; ++i){
+        float *y = in_delta + (size_t)i*w;
+        row(d + (size_t)i*pw, pw, flip, size, 1, w, acc);
+        for(j = 0; j < w; ++j) y[j] += acc[j];
+    }
+    free(acc);
+    free(d);
+    free(flip);
+}
+
+/* Scatter form of dw_input_delta for padding wider than the filter. */
+static void dw_input_delta_scatter(int h, int w, const float *k, int size, int stride, int pad,
+        const float *delta, float *in_delta)
+{
+    int out_h = (h + 2*pad - size)/stride + 1;
+    int out_w = (w + 2*pad - size)/stride + 1;
+    int oh, ow, ky, kx;
+    for(oh = 0; oh < out_h; ++oh){
+        for(ow = 0; ow < out_w; ++ow){
+            float dv = delta[oh*out_w + ow];
+            for(ky = 0; ky < size; ++ky){
+                int ih = oh*stride - pad + ky;
+                if(ih < 0 || ih >= h) continue;
+                for(kx = 0; kx < size; ++kx){
+                    int iw = ow*stride - pad + kx;
+                    if(iw < 0 || iw >= w) continue;
+                    in_delta[ih*w + iw] += k[ky*size + kx]*dv;
+                }
+            }
+        }
+    }
+}
+
+void depthwise_conv2d_backward(const float *in, int h, int w, const float *k, int size, int stride, int pad,
+        const float *delta, float *k_updates, float *in_delta)
+{
+    int out_h = (h + 2*pad - size)/stride + 1;
+    int out_w = (w + 2*pad - size)/stride + 1;
+    int pw = w + 2*pad + DW_SLACK;
+    float *p = dw_pad_plane(in, h, w, pad, pw);
+    get_dw_filter_updates()(p, pw, out_h, out_w, size, stride, delta, k_updates);
+    free(p);
+    if(!in_delta) return;
+    if(pad < size) dw_input_delta(h, w, k, size, stride, pad, delta, in_delta);
+    else dw_input_delta_scatter(h, w, k, size, stride, pad, delta, in_delta);
+}
@@ -0,0 +1,11 @@
+#ifndef DEPTHWISE_H
+#define DEPTHWISE_H
+
+#include "activations.h"
+
+void depthwise_conv2d(const float *in, int h, int w, const float *k, int size, int stride, int pad,
+        float scale, float bias, ACTIVATION a, float *out);
+void depthwise_conv2d_backward(const float *in, int h, int w, const float *k, int size, int stride, int pad,
+        const float *delta, float *k_updates, float *in_delta);
+
+#endif
@@ -1,9 +1,12 @@
 #include "gemm.h"
 #include "utils.h"
 #include "cuda.h"
+#include "activations.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <pthread.h>
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -71,76 +74,1021 @@ void gemm(int TA, int TB, int M, int N, int K, float ALPHA,
     gemm_cpu( TA,  TB,  M, N, K, ALPHA,A,lda, B, ldb,BETA,C,ldc);
 }
 
-void gemm_nn(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
-        float *C, int ldc)
+/*
+ * Packed SGEMM, in the spirit of Goto/BLIS: C is walked in NC x MC blocks,
+ * K in KC slices, and for every block the needed pieces of A and B are
+ * copied ("packed") into contiguous MR-row and NR-column panels that stay
+ * in L2/L1 while a register-tiled microkernel runs over them. Transposes
+ * and ALPHA are folded into packing, so one kernel serves all four cases.
+ */
+
+#define GEMM_MC 120
+#define GEMM_KC 256
+#define GEMM_NC 4096
+#define GEMM_MAX_MR 12
+#define GEMM_MAX_NR 32
+
+typedef void (*gemm_kernel_fn)(int kc, const float *a, const float *b, float *c, int ldc, int m, int n);
+typedef void (*gemm_epilogue_fn)(const gemm_epilogue *ep, int row, float *c, const float *add, int ldc, int m, int n);
+
+typedef struct{
+    int mr;
+    int nr;
+    gemm_kernel_fn kernel;
+    gemm_epilogue_fn epilogue;
+    const char *name;
+} gemm_engine;
+
+/* Linear, relu and leaky stay in the loops so they vectorize; the rest go
+ * through activate() one element at a time. */
+static inline __attribute__((always_inline)) void epilogue_activate(float *x, int n, ACTIVATION a)
 {
-    int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(k = 0; k < K; ++k){
-            register float A_PART = ALPHA*A[i*lda+k];
-            for(j = 0; j < N; ++j){
-                C[i*ldc+j] += A_PART*B[k*ldb+j];
+    int j;
+    switch(a){
+        case LINEAR:
+            return;
+        case RELU:
+            for(j = 0; j < n; ++j) x[j] = (x[j] > 0) ? x[j] : 0;
+            return;
+        case LEAKY:
+            for(j = 0; j < n; ++j) x[j] = (x[j] > 0) ? x[j] : .1f*x[j];
+            return;
+        default:
+            for(j = 0; j < n; ++j) x[j] = activate(x[j], a);
+    }
+}
+
+static inline __attribute__((always_inline)) void epilogue_tile(const gemm_epilogue *ep, int row,
+        float *c, const float *add, int ldc, int m, int n)
+{
+    int i, j;
+    for(i = 0; i < m; ++i){
+        float *ci = c + (size_t)i*ldc;
+        float s = ep->scales ? ep->scales[row + i] : 1;
+        float b = ep->biases ? ep->biases[row + i] : 0;
+        for(j = 0; j < n; ++j) ci[j] = s*ci[j] + b;
+        epilogue_activate(ci, n, ep->act);
+        if(add){
+            const float *ai = add + (size_t)i*ldc;
+            for(j = 0; j < n; ++j) ci[j] += ai[j];
+            epilogue_activate(ci, n, ep->add_act);
+        }
+    }
+}
+
+static void gemm_epilogue_scalar(const gemm_epilogue *ep, int row, float *c, const float *add, int ldc, int m, int n)
+{
+    epilogue_tile(ep, row, c, add, ldc, m, n);
+}
+
+static void gemm_kernel_add(const float *tile, int nr, float *c, int ldc, int m, int n)
+{
+    int i, j;
+    for(i = 0; i < m; ++i){
+        for(j = 0; j < n; ++j){
+            c[i*ldc + j] += tile[i*nr + j];
+        }
+    }
+}
+
+#define SCALAR_MR 4
+#define SCALAR_NR 8
+
+static void gemm_kernel_scalar(int kc, const float *a, const float *b, float *c, int ldc, int m, int n)
+{
+    float acc[SCALAR_MR*SCALAR_NR] = {0};
+    int i, j, p;
+    for(p = 0; p < kc; ++p){
+        for(i = 0; i < SCALAR_MR; ++i){
+            register float A_PART = a[i];
+            for(j = 0; j < SCALAR_NR; ++j){
+                acc[i*SCALAR_NR + j] += A_PART*b[j];
             }
         }
+        a += SCALAR_MR;
+        b += SCALAR_NR;
     }
+    gemm_kernel_add(acc, SCALAR_NR, c, ldc, m, n);
 }
 
-void gemm_nt(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
-        float *C, int ldc)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86
+#include <immintrin.h>
+
+/* Accumulators are named registers rather than an array: GCC will not keep
+ * an array of vectors out of memory across the k loop. */
+#define AVX2_MR 6
+#define AVX2_NR 16
+
+#define AVX2_ZERO(i) __m256 c##i##_0 = _mm256_setzero_ps(), c##i##_1 = _mm256_setzero_ps();
+#define AVX2_FMA(i) \
+    ai = _mm256_broadcast_ss(a + i); \
+    c##i##_0 = _mm256_fmadd_ps(ai, b0, c##i##_0); \
+    c##i##_1 = _mm256_fmadd_ps(ai, b1, c##i##_1);
+#define AVX2_STORE(i) \
+    _mm256_storeu_ps(tile + i*AVX2_NR, c##i##_0); \
+    _mm256_storeu_ps(tile + i*AVX2_NR + 8, c##i##_1);
+
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2(int kc, const float *a, const float *b, float *c, int ldc, int m, int n)
 {
-    int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
-            register float sum = 0;
-            for(k = 0; k < K; ++k){
-                sum += ALPHA*A[i*lda+k]*B[j*ldb + k];
+    float tile[AVX2_MR*AVX2_NR];
+    __m256 ai, b0, b1;
+    int i, p;
+    AVX2_ZERO(0) AVX2_ZERO(1) AVX2_ZERO(2) AVX2_ZERO(3) AVX2_ZERO(4) AVX2_ZERO(5)
+    for(p = 0; p < kc; ++p){
+        b0 = _mm256_load_ps(b);
+        b1 = _mm256_load_ps(b + 8);
+        AVX2_FMA(0) AVX2_FMA(1) AVX2_FMA(2) AVX2_FMA(3) AVX2_FMA(4) AVX2_FMA(5)
+        a += AVX2_MR;
+        b += AVX2_NR;
+    }
+    AVX2_STORE(0) AVX2_STORE(1) AVX2_STORE(2) AVX2_STORE(3) AVX2_STORE(4) AVX2_STORE(5)
+    if(m == AVX2_MR && n == AVX2_NR){
+        for(i = 0; i < AVX2_MR; ++i){
+            float *ci = c + i*ldc;
+            _mm256_storeu_ps(ci, _mm256_add_ps(_mm256_loadu_ps(ci), _mm256_loadu_ps(tile + i*AVX2_NR)));
+            _mm256_storeu_ps(ci + 8, _mm256_add_ps(_mm256_loadu_ps(ci + 8), _mm256_loadu_ps(tile + i*AVX2_NR + 8)));
+        }
+    } else {
+        gemm_kernel_add(tile, AVX2_NR, c, ldc, m, n);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void gemm_epilogue_avx2(const gemm_epilogue *ep, int row, float *c, const float *add, int ldc, int m, int n)
+{
+    epilogue_tile(ep, row, c, add, ldc, m, n);
+}
+
+#define AVX512_MR 12
+#define AVX512_NR 32
+
+#define AVX512_ZERO(i) __m512 c##i##_0 = _mm512_setzero_ps(), c##i##_1 = _mm512_setzero_ps();
+#define AVX512_FMA(i) \
+    ai = _mm512_set1_ps(a[i]); \
+    c##i##_0 = _mm512_fmadd_ps(ai, b0, c##i##_0); \
+    c##i##_1 = _mm512_fmadd_ps(ai, b1, c##i##_1);
+#define AVX512_STORE(i) \
+    _mm512_storeu_ps(tile + i*AVX512_NR, c##i##_0); \
+    _mm512_storeu_ps(tile + i*AVX512_NR + 16, c##i##_1);
+
+__attribute__((target("avx512f")))
+static void gemm_kernel_avx512(int kc, const float *a, const float *b, float *c, int ldc, int m, int n)
+{
+    float tile[AVX512_MR*AVX512_NR];
+    __m512 ai, b0, b1;
+    int i, p;
+    AVX512_ZERO(0) AVX512_ZERO(1) AVX512_ZERO(2) AVX512_ZERO(3) AVX512_ZERO(4) AVX512_ZERO(5)
+    AVX512_ZERO(6) AVX512_ZERO(7) AVX512_ZERO(8) AVX512_ZERO(9) AVX512_ZERO(10) AVX512_ZERO(11)
+    for(p = 0; p < kc; ++p){
+        b0 = _mm512_load_ps(b);
+        b1 = _mm512_load_ps(b + 16);
+        AVX512_FMA(0) AVX512_FMA(1) AVX512_FMA(2) AVX512_FMA(3) AVX512_FMA(4) AVX512_FMA(5)
+        AVX512_FMA(6) AVX512_FMA(7) AVX512_FMA(8) AVX512_FMA(9) AVX512_FMA(10) AVX512_FMA(11)
+        a += AVX512_MR;
+        b += AVX512_NR;
+    }
+    AVX512_STORE(0) AVX512_STORE(1) AVX512_STORE(2) AVX512_STORE(3) AVX512_STORE(4) AVX512_STORE(5)
+    AVX512_STORE(6) AVX512_STORE(7) AVX512_STORE(8) AVX512_STORE(9) AVX512_STORE(10) AVX512_STORE(11)
+    if(m == AVX512_MR && n == AVX512_NR){
+        for(i = 0; i < AVX512_MR; ++i){
+            float *ci = c + i*ldc;
+            _mm512_storeu_ps(ci, _mm512_add_ps(_mm512_loadu_ps(ci), _mm512_loadu_ps(tile + i*AVX512_NR)));
+            _mm512_storeu_ps(ci + 16, _mm512_add_ps(_mm512_loadu_ps(ci + 16), _mm512_loadu_ps(tile + i*AVX512_NR + 16)));
+        }
+    } else {
+        gemm_kernel_add(tile, AVX512_NR, c, ldc, m, n);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gemm_epilogue_avx512(const gemm_epilogue *ep, int row, float *c, const float *add, int ldc, int m, int n)
+{
+    epilogue_tile(ep, row, c, add, ldc, m, n);
+}
+#endif
+
+static gemm_engine select_gemm_engine()
+{
+    gemm_engine e = {SCALAR_MR, SCALAR_NR, gemm_kernel_scalar, gemm_epilogue_scalar, "scalar"};
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")){
+        e.mr = AVX512_MR;
+        e.nr = AVX512_NR;
+        e.kernel = gemm_kernel_avx512;
+        e.epilogue = gemm_epilogue_avx512;
+        e.name = "avx512";
+    } else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        e.mr = AVX2_MR;
+        e.nr = AVX2_NR;
+        e.kernel = gemm_kernel_avx2;
+        e.epilogue = gemm_epilogue_avx2;
+        e.name = "avx2";
+    }
+#endif
+    return e;
+}
+
+static pthread_once_t gemm_engine_once = PTHREAD_ONCE_INIT;
+static gemm_engine gemm_engine_selected;
+
+static void init_gemm_engine()
+{
+    gemm_engine_selected = select_gemm_engine();
+}
+
+static gemm_engine get_gemm_engine()
+{
+    pthread_once(&gemm_engine_once, init_gemm_engine);
+    return gemm_engine_selected;
+}
+
+const char *gemm_engine_name()
+{
+    return get_gemm_engine().name;
+}
+
+static float *gemm_aligned_buffer(float **buf, size_t *cap, size_t n)
+{
+    if(n > *cap){
+        free(*buf);
+        if(posix_memalign((void **)buf, 64, n*sizeof(float))) malloc_error();
+        *cap = n;
+    }
+    return *buf;
+}
+
+/* Operands of one packing pass; each pool iteration packs one panel. */
+typedef struct{
+    int trans;
+    int rows, cols;
+    float ALPHA;
+    float *src;
+    int ld;
+    int r;
+    float *dst;
+    const struct im2col_src *im;
+    int k0, j0;
+} pack_args;
+
+/* A(i,p) of the mc x kc block at (row, col), MR rows per panel, zero padded. */
+static void pack_a_panel(int ip, void *ptr)
+{
+    pack_args *a = ptr;
+    int mc = a->rows, kc = a->cols, mr = a->r, lda = a->ld, TA = a->trans;
+    float *A = a->src;
+    float *dst = a->dst + (size_t)ip*mr*kc;
+    int i0 = ip*mr;
+    int m = (mc - i0 < mr) ? mc - i0 : mr;
+    int i, p;
+    for(p = 0; p < kc; ++p){
+        for(i = 0; i < m; ++i){
+            dst[p*mr + i] = a->ALPHA*(TA ? A[p*lda + i0 + i] : A[(i0 + i)*lda + p]);
+        }
+        for(; i < mr; ++i) dst[p*mr + i] = 0;
+    }
+}
+
+static void pack_a(int TA, int mc, int kc, float ALPHA, float *A, int lda, int mr, float *pa)
+{
+    pack_args a = {TA, mc, kc, ALPHA, A, lda, mr, pa};
+    parallel_for((mc + mr - 1)/mr, pack_a_panel, &a);
+}
+
+/* B(p,j) of the kc x nc block, NR columns per panel, zero padded. */
+static void pack_b_panel(int jp, void *ptr)
+{
+    pack_args *a = ptr;
+    int kc = a->rows, nc = a->cols, nr = a->r, ldb = a->ld, TB = a->trans;
+    float *B = a->src;
+    float *dst = a->dst + (size_t)jp*nr*kc;
+    int j0 = jp*nr;
+    int n = (nc - j0 < nr) ? nc - j0 : nr;
+    int j, p;
+    for(p = 0; p < kc; ++p){
+        if(!TB && n == nr){
+            memcpy(dst + p*nr, B + p*ldb + j0, nr*sizeof(float));
+            continue;
+        }
+        for(j = 0; j < n; ++j){
+            dst[p*nr + j] = TB ? B[(j0 + j)*ldb + p] : B[p*ldb + j0 + j];
+        }
+        for(; j < nr; ++j) dst[p*nr + j] = 0;
+    }
+}
+
+static void pack_b(int TB, int kc, int nc, float *B, int ldb, int nr, float *pb)
+{
+    pack_args a = {TB, kc, nc, 1, B, ldb, nr, pb};
+    parallel_for((nc + nr - 1)/nr, pack_b_panel, &a);
+}
+
+/* Implicit GEMM source: B is the im2col matrix of this image, never stored. */
+typedef struct im2col_src{
+    float *im;
+    int height, width, ksize, stride, pad;
+    int width_col;
+} im2col_src;
+
+/* Same panels as pack_b, gathered straight from the image: row k0 + p is
+ * tap (c, ky, kx) and column j0 + j is output pixel (h, w), exactly the
+ * element im2col_cpu would have written. */
+static void pack_b_im2col_panel(int jp, void *ptr)
+{
+    pack_args *a = ptr;
+    const im2col_src *g = a->im;
+    int kc = a->rows, nc = a->cols, nr = a->r, k0 = a->k0, j0 = a->j0;
+    float *dst = a->dst + (size_t)jp*nr*kc;
+    int n = (nc - jp*nr < nr) ? nc - jp*nr : nr;
+    int row0[GEMM_MAX_NR], col0[GEMM_MAX_NR];
+    int kx = k0 % g->ksize;
+    int ky = (k0 / g->ksize) % g->ksize;
+    int c = k0 / g->ksize / g->ksize;
+    int one_row, j, p;
+    for(j = 0; j < n; ++j){
+        int out = j0 + jp*nr + j;
+        row0[j] = (out / g->width_col)*g->stride - g->pad;
+        col0[j] = (out % g->width_col)*g->stride - g->pad;
+    }
+    one_row = g->stride == 1 && row0[0] == row0[n-1];
+    for(p = 0; p < kc; ++p){
+        const float *chan = g->im + (size_t)c*g->height*g->width;
+        float *d = dst + p*nr;
+        int r = row0[0] + ky;
+        int q = col0[0] + kx;
+        if(one_row && r >= 0 && r < g->height && q >= 0 && q + n <= g->width){
+            memcpy(d, chan + r*g->width + q, n*sizeof(float));
+        } else {
+            for(j = 0; j < n; ++j){
+                r = row0[j] + ky;
+                q = col0[j] + kx;
+                d[j] = (r >= 0 && r < g->height && q >= 0 && q < g->width) ? chan[r*g->width + q] : 0;
+            }
+        }
+        for(j = n; j < nr; ++j) d[j] = 0;
+        if(++kx == g->ksize){
+            kx = 0;
+            if(++ky == g->ksize){
+                ky = 0;
+                ++c;
             }
-            C[i*ldc+j] += sum;
         }
     }
 }
 
-void gemm_tn(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
+static void pack_b_im2col(const im2col_src *g, int k0, int kc, int j0, int nc, int nr, float *pb)
+{
+    pack_args a = {0, kc, nc, 1, 0, 0, nr, pb, g, k0, j0};
+    parallel_for((nc + nr - 1)/nr, pack_b_im2col_panel, &a);
+}
+
+/* One mc x nc block of C, split over pool iterations by MR x NR tile. */
+typedef struct{
+    gemm_engine *e;
+    const gemm_epilogue *ep;
+    float *a_buf, *b_buf;
+    float *C;
+    int ldc;
+    int ic, jc, mc, nc, kc;
+    int last;
+} gemm_block;
+
+static void gemm_block_tile(int t, void *ptr)
+{
+    gemm_block *b = ptr;
+    int mr = b->e->mr;
+    int nr = b->e->nr;
+    int mpanels = (b->mc + mr - 1)/mr;
+    int jr = t / mpanels;
+    int ir = t % mpanels;
+    int m = (b->mc - ir*mr < mr) ? b->mc - ir*mr : mr;
+    int n = (b->nc - jr*nr < nr) ? b->nc - jr*nr : nr;
+    size_t offset = (size_t)(b->ic + ir*mr)*b->ldc + b->jc + jr*nr;
+    b->e->kernel(b->kc, b->a_buf + (size_t)ir*mr*b->kc, b->b_buf + (size_t)jr*nr*b->kc,
+            b->C + offset, b->ldc, m, n);
+    if(b->ep && b->last){
+        b->e->epilogue(b->ep, b->ic + ir*mr, b->C + offset, b->ep->add ? b->ep->add + offset : 0, b->ldc, m, n);
+    }
+}
+
+static void gemm_packed(gemm_engine e, int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
         float *B, int ldb,
-        float *C, int ldc)
+        const im2col_src *im,
+        float *C, int ldc, const gemm_epilogue *ep)
 {
-    int i,j,k;
-    #pragma omp parallel for
+    static __thread float *pa = 0, *pb = 0;
+    static __thread size_t pa_cap = 0, pb_cap = 0;
+    int mr = e.mr;
+    int nr = e.nr;
+    int mc_max = (GEMM_MC/mr)*mr;
+    int nc_max = (N < GEMM_NC) ? N : GEMM_NC;
+    int kc_max = (K < GEMM_KC) ? K : GEMM_KC;
+    float *a_buf = gemm_aligned_buffer(&pa, &pa_cap, (size_t)(mc_max + mr)*kc_max);
+    float *b_buf = gemm_aligned_buffer(&pb, &pb_cap, (size_t)(nc_max + nr)*kc_max);
+    gemm_block b = {&e, ep, a_buf, b_buf, C, ldc};
+    int jc, pc, ic;
+
+    for(jc = 0; jc < N; jc += GEMM_NC){
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        int npanels = (nc + nr - 1)/nr;
+        for(pc = 0; pc < K; pc += GEMM_KC){
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            if(im) pack_b_im2col(im, pc, kc, jc, nc, nr, b_buf);
+            else pack_b(TB, kc, nc, TB ? B + jc*ldb + pc : B + pc*ldb + jc, ldb, nr, b_buf);
+            for(ic = 0; ic < M; ic += mc_max){
+                int mc = (M - ic < mc_max) ? M - ic : mc_max;
+                pack_a(TA, mc, kc, ALPHA, TA ? A + pc*lda + ic : A + ic*lda + pc, lda, mr, a_buf);
+                b.ic = ic;
+                b.jc = jc;
+                b.mc = mc;
+                b.nc = nc;
+                b.kc = kc;
+                b.last = pc + kc == K;
+                parallel_for(npanels*((mc + mr - 1)/mr), gemm_block_tile, &b);
+            }
+        }
+    }
+}
+
+/*
+ * XNOR GEMM over sign bits: A holds M filters and B holds N im2col columns,
+ * each as words 64-bit words. For +-1 vectors, dot = valid - 2*popcount(a^b),
+ * with mask dropping padded taps. Each row is scaled by its filter scale.
+ */
+
+typedef int (*xnor_dot_fn)(const uint64_t *a, const uint64_t *b, const uint64_t *m, int words);
+typedef void (*xnor_tile_fn)(int M, int j0, int j1, int words, float *scales,
+        uint64_t *A, uint64_t *B, uint64_t *mask, float *C, int ldc);
+
+#define XNOR_TILE 64
+
+static int xnor_dot_scalar(const uint64_t *a, const uint64_t *b, const uint64_t *m, int words)
+{
+    int k, s = 0;
+    for(k = 0; k < words; ++k) s += __builtin_popcountll((a[k] ^ b[k]) & m[k]);
+    return s;
+}
+
+static inline __attribute__((always_inline)) void xnor_tile(xnor_dot_fn dot, int M, int j0, int j1, int words,
+        float *scales, uint64_t *A, uint64_t *B, uint64_t *mask, float *C, int ldc)
+{
+    int i, j, k;
+    int valid[XNOR_TILE];
+    for(j = j0; j < j1; ++j){
+        int v = 0;
+        for(k = 0; k < words; ++k) v += __builtin_popcountll(mask[j*words + k]);
+        valid[j - j0] = v;
+    }
     for(i = 0; i < M; ++i){
-        for(k = 0; k < K; ++k){
-            register float A_PART = ALPHA*A[k*lda+i];
-            for(j = 0; j < N; ++j){
-                C[i*ldc+j] += A_PART*B[k*ldb+j];
+        const uint64_t *a = A + (size_t)i*words;
+        for(j = j0; j < j1; ++j){
+            int diff = dot(a, B + (size_t)j*words, mask + (size_t)j*words, words);
+            C[i*ldc + j] += scales[i]*(valid[j - j0] - 2*diff);
+        }
+    }
+}
+
+static void xnor_tile_scalar(int M, int j0, int j1, int words, float *scales,
+        uint64_t *A, uint64_t *B, uint64_t *mask, float *C, int ldc)
+{
+    xnor_tile(xnor_dot_scalar, M, j0, j1, words, scales, A, B, mask, C, ldc);
+}
+
+#ifdef GEMM_X86
+__attribute__((target("popcnt")))
+static int xnor_dot_popcnt(const uint64_t *a, const uint64_t *b, const uint64_t *m, int words)
+{
+    int k, s = 0;
+    for(k = 0; k < words; ++k) s += __builtin_popcountll((a[k] ^ b[k]) & m[k]);
+    return s;
+}
+
+__attribute__((target("popcnt")))
+static void xnor_tile_popcnt(int M, int j0, int j1, int words, float *scales,
+        uint64_t *A, uint64_t *B, uint64_t *mask, float *C, int ldc)
+{
+    xnor_tile(xnor_dot_popcnt, M, j0, j1, words, scales, A, B, mask, C, ldc);
+}
+
+/* Nibble lookup popcount (Mula et al.), summed per 64-bit lane with psadbw. */
+__attribute__((target("avx2,popcnt")))
+static int xnor_dot_avx2(const uint64_t *a, const uint64_t *b, const uint64_t *m, int words)
+{
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                         0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    int k, s = 0;
+    for(k = 0; k + 4 <= words; k += 4){
+        __m256i x = _mm256_and_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + k)),
+                    _mm256_loadu_si256((const __m256i *)(b + k))), _mm256_loadu_si256((const __m256i *)(m + k)));
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+                _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    s = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1)
+      + _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+    for(; k < words; ++k) s += __builtin_popcountll((a[k] ^ b[k]) & m[k]);
+    return s;
+}
+
+__attribute__((target("avx2,popcnt")))
+static void xnor_tile_avx2(int M, int j0, int j1, int words, float *scales,
+        uint64_t *A, uint64_t *B, uint64_t *mask, float *C, int ldc)
+{
+    xnor_tile(xnor_dot_avx2, M, j0, j1, words, scales, A, B, mask, C, ldc);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static int xnor_dot_avx512(const uint64_t *a, const uint64_t *b, const uint64_t *m, int words)
+{
+    __m512i acc = _mm512_setzero_si512();
+    int k;
+    for(k = 0; k < words; k += 8){
+        __mmask8 live = (words - k >= 8) ? 0xff : (__mmask8)((1u << (words - k)) - 1);
+        __m512i x = _mm512_and_si512(_mm512_xor_si512(_mm512_maskz_loadu_epi64(live, a + k),
+                    _mm512_maskz_loadu_epi64(live, b + k)), _mm512_maskz_loadu_epi64(live, m + k));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    return _mm512_reduce_add_epi64(acc);
+}
+
+/* Four filters per pass so each column word is loaded once for all four. */
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static void xnor_tile_avx512(int M, int j0, int j1, int words, float *scales,
+        uint64_t *A, uint64_t *B, uint64_t *mask, float *C, int ldc)
+{
+    int i, j, k;
+    int valid[XNOR_TILE];
+    for(j = j0; j < j1; ++j){
+        int v = 0;
+        for(k = 0; k < words; ++k) v += __builtin_popcountll(mask[j*words + k]);
+        valid[j - j0] = v;
+    }
+    for(i = 0; i + 4 <= M; i += 4){
+        const uint64_t *a = A + (size_t)i*words;
+        for(j = j0; j < j1; ++j){
+            const uint64_t *b = B + (size_t)j*words;
+            const uint64_t *m = mask + (size_t)j*words;
+            __m512i s0 = _mm512_setzero_si512(), s1 = s0, s2 = s0, s3 = s0;
+            for(k = 0; k < words; k += 8){
+                __mmask8 live = (words - k >= 8) ? 0xff : (__mmask8)((1u << (words - k)) - 1);
+                __m512i bk = _mm512_maskz_loadu_epi64(live, b + k);
+                __m512i mk = _mm512_maskz_loadu_epi64(live, m + k);
+                s0 = _mm512_add_epi64(s0, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_xor_si512(_mm512_maskz_loadu_epi64(live, a + k), bk), mk)));
+                s1 = _mm512_add_epi64(s1, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_xor_si512(_mm512_maskz_loadu_epi64(live, a + words + k), bk), mk)));
+                s2 = _mm512_add_epi64(s2, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_xor_si512(_mm512_maskz_loadu_epi64(live, a + 2*words + k), bk), mk)));
+                s3 = _mm512_add_epi64(s3, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_xor_si512(_mm512_maskz_loadu_epi64(live, a + 3*words + k), bk), mk)));
             }
+            C[i*ldc + j]       += scales[i]*(valid[j - j0] - 2*(int)_mm512_reduce_add_epi64(s0));
+            C[(i+1)*ldc + j]   += scales[i+1]*(valid[j - j0] - 2*(int)_mm512_reduce_add_epi64(s1));
+            C[(i+2)*ldc + j]   += scales[i+2]*(valid[j - j0] - 2*(int)_mm512_reduce_add_epi64(s2));
+            C[(i+3)*ldc + j]   += scales[i+3]*(valid[j - j0] - 2*(int)_mm512_reduce_add_epi64(s3));
         }
     }
+    if(i < M){
+        xnor_tile(xnor_dot_avx512, M - i, j0, j1, words, scales + i, A + (size_t)i*words, B, mask, C + i*ldc, ldc);
+    }
 }
+#endif
 
-void gemm_tt(int M, int N, int K, float ALPHA, 
-        float *A, int lda, 
-        float *B, int ldb,
+static pthread_once_t xnor_tile_once = PTHREAD_ONCE_INIT;
+static xnor_tile_fn xnor_tile_selected;
+
+static void init_xnor_tile()
+{
+    xnor_tile_fn t = xnor_tile_scalar;
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512vpopcntdq")) t = xnor_tile_avx512;
+    else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) t = xnor_tile_avx2;
+    else if(__builtin_cpu_supports("popcnt")) t = xnor_tile_popcnt;
+#endif
+    xnor_tile_selected = t;
+}
+
+static xnor_tile_fn get_xnor_tile()
+{
+    pthread_once(&xnor_tile_once, init_xnor_tile);
+    return xnor_tile_selected;
+}
+
+typedef struct{
+    xnor_tile_fn tile;
+    int M, N, words;
+    float *scales;
+    uint64_t *A, *B, *mask;
+    float *C;
+    int ldc;
+} xnor_args;
+
+static void gemm_bin_tile(int t, void *ptr)
+{
+    xnor_args *a = ptr;
+    int j0 = t*XNOR_TILE;
+    int j1 = (j0 + XNOR_TILE < a->N) ? j0 + XNOR_TILE : a->N;
+    a->tile(a->M, j0, j1, a->words, a->scales, a->A, a->B, a->mask, a->C, a->ldc);
+}
+
+void gemm_bin_packed(int M, int N, int words, float *scales,
+        uint64_t *A,
+        uint64_t *B, uint64_t *mask,
         float *C, int ldc)
 {
-    int i,j,k;
-    #pragma omp parallel for
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
-            register float sum = 0;
-            for(k = 0; k < K; ++k){
-                sum += ALPHA*A[i+k*lda]*B[k+j*ldb];
+    xnor_args a = {get_xnor_tile(), M, N, words, scales, A, B, mask, C, ldc};
+    parallel_for((N + XNOR_TILE - 1)/XNOR_TILE, gemm_bin_tile, &a);
+}
+
+/*
+ * INT8 GEMM: A holds M rows of signed 8-bit weights with lda a multiple of 4
+ * (K zero padded) and B is a K x N matrix of unsigned activations no larger
+ * than gemm_int8_input_max(). Accumulation is exact in int32 and each tile
+ * is requantized on the way out as act(scales[i]*acc + biases[i]), so no
+ * int32 or unscaled output is ever written. The kernels fuse linear, relu and
+ * leaky; other activations are applied to the tile right after it is stored.
+ */
+
+typedef void (*int8_kernel_fn)(int k4, const int8_t *a, int lda, const uint8_t *b,
+        const float *scales, const float *biases, ACTIVATION act, float *c, int ldc);
+typedef int32_t (*int8_dot_fn)(int K, const int8_t *a, const uint8_t *x);
+
+typedef struct{
+    int mr;
+    int nr;
+    int input_max;
+    int8_kernel_fn kernel;
+    int8_dot_fn dot;
+} int8_engine;
+
+#define INT8_MAX_NR 32
+
+static inline float int8_activate(float x, ACTIVATION act)
+{
+    if(act == LEAKY) return (x > 0) ? x : .1*x;
+    if(act == RELU) return (x > 0) ? x : 0;
+    return x;
+}
+
+static void int8_kernel_scalar(int k4, const int8_t *a, int lda, const uint8_t *b,
+        const float *scales, const float *biases, ACTIVATION act, float *c, int ldc)
+{
+    int32_t acc[SCALAR_MR][SCALAR_NR] = {{0}};
+    int i, j, p, t;
+    for(p = 0; p < k4; ++p){
+        for(i = 0; i < SCALAR_MR; ++i){
+            const int8_t *ai = a + i*lda + 4*p;
+            for(j = 0; j < SCALAR_NR; ++j){
+                const uint8_t *bj = b + (p*SCALAR_NR + j)*4;
+                for(t = 0; t < 4; ++t) acc[i][j] += ai[t]*bj[t];
+            }
+        }
+    }
+    for(i = 0; i < SCALAR_MR; ++i){
+        for(j = 0; j < SCALAR_NR; ++j){
+            c[i*ldc + j] = int8_activate(scales[i]*acc[i][j] + biases[i], act);
+        }
+    }
+}
+
+static int32_t int8_dot_scalar(int K, const int8_t *a, const uint8_t *x)
+{
+    int32_t s = 0;
+    int k;
+    for(k = 0; k < K; ++k) s += a[k]*x[k];
+    return s;
+}
+
+#ifdef GEMM_X86
+/* pmaddubsw adds pairs of u8*s8 products into saturating int16 lanes, which
+ * is exact only while activations stay below 128: gemm_int8_input_max()
+ * reports 127 on this path and the layers quantize their inputs to 7 bits. */
+#define INT8_AVX2_MR 4
+#define INT8_AVX2_NR 16
+
+#define INT8_AVX2_ZERO(i) __m256i c##i##_0 = _mm256_setzero_si256(), c##i##_1 = _mm256_setzero_si256();
+#define INT8_AVX2_MADD(i) \
+    w = _mm256_set1_epi32(*(const int32_t *)(a + i*lda + 4*p)); \
+    c##i##_0 = _mm256_add_epi32(c##i##_0, _mm256_madd_epi16(_mm256_maddubs_epi16(b0, w), ones)); \
+    c##i##_1 = _mm256_add_epi32(c##i##_1, _mm256_madd_epi16(_mm256_maddubs_epi16(b1, w), ones));
+#define INT8_AVX2_STORE(i) \
+    s = _mm256_set1_ps(scales[i]); \
+    t = _mm256_set1_ps(biases[i]); \
+    y0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(c##i##_0), s, t); \
+    y1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(c##i##_1), s, t); \
+    if(act == LEAKY){ \
+        y0 = _mm256_max_ps(y0, _mm256_mul_ps(y0, _mm256_set1_ps(.1f))); \
+        y1 = _mm256_max_ps(y1, _mm256_mul_ps(y1, _mm256_set1_ps(.1f))); \
+    } else if(act == RELU){ \
+        y0 = _mm256_max_ps(y0, _mm256_setzero_ps()); \
+        y1 = _mm256_max_ps(y1, _mm256_setzero_ps()); \
+    } \
+    _mm256_storeu_ps(c + i*ldc, y0); \
+    _mm256_storeu_ps(c + i*ldc + 8, y1);
+
+__attribute__((target("avx2,fma")))
+static void int8_kernel_avx2(int k4, const int8_t *a, int lda, const uint8_t *b,
+        const float *scales, const float *biases, ACTIVATION act, float *c, int ldc)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i b0, b1, w;
+    __m256 s, t, y0, y1;
+    int p;
+    INT8_AVX2_ZERO(0) INT8_AVX2_ZERO(1) INT8_AVX2_ZERO(2) INT8_AVX2_ZERO(3)
+    for(p = 0; p < k4; ++p){
+        b0 = _mm256_load_si256((const __m256i *)b);
+        b1 = _mm256_load_si256((const __m256i *)(b + 32));
+        INT8_AVX2_MADD(0) INT8_AVX2_MADD(1) INT8_AVX2_MADD(2) INT8_AVX2_MADD(3)
+        b += 4*INT8_AVX2_NR;
+    }
+    INT8_AVX2_STORE(0) INT8_AVX2_STORE(1) INT8_AVX2_STORE(2) INT8_AVX2_STORE(3)
+}
+
+__attribute__((target("avx2")))
+static int32_t int8_dot_avx2(int K, const int8_t *a, const uint8_t *x)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    __m128i s;
+    int k;
+    for(k = 0; k + 32 <= K; k += 32){
+        __m256i p = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(x + k)),
+                _mm256_loadu_si256((const __m256i *)(a + k)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+    }
+    s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+    return _mm_cvtsi128_si32(s) + int8_dot_scalar(K - k, a + k, x + k);
+}
+
+/* vpdpbusd multiplies unsigned activations by signed weights and adds each
+ * group of four products straight into an int32 lane. */
+#define INT8_AVX512_MR 8
+#define INT8_AVX512_NR 32
+
+#define INT8_AVX512_ZERO(i) __m512i c##i##_0 = _mm512_setzero_si512(), c##i##_1 = _mm512_setzero_si512();
+#define INT8_AVX512_DOT(i) \
+    w = _mm512_set1_epi32(*(const int32_t *)(a + i*lda + 4*p)); \
+    c##i##_0 = _mm512_dpbusd_epi32(c##i##_0, b0, w); \
+    c##i##_1 = _mm512_dpbusd_epi32(c##i##_1, b1, w);
+#define INT8_AVX512_STORE(i) \
+    s = _mm512_set1_ps(scales[i]); \
+    t = _mm512_set1_ps(biases[i]); \
+    y0 = _mm512_fmadd_ps(_mm512_cvtepi32_ps(c##i##_0), s, t); \
+    y1 = _mm512_fmadd_ps(_mm512_cvtepi32_ps(c##i##_1), s, t); \
+    if(act == LEAKY){ \
+        y0 = _mm512_max_ps(y0, _mm512_mul_ps(y0, _mm512_set1_ps(.1f))); \
+        y1 = _mm512_max_ps(y1, _mm512_mul_ps(y1, _mm512_set1_ps(.1f))); \
+    } else if(act == RELU){ \
+        y0 = _mm512_max_ps(y0, _mm512_setzero_ps()); \
+        y1 = _mm512_max_ps(y1, _mm512_setzero_ps()); \
+    } \
+    _mm512_storeu_ps(c + i*ldc, y0); \
+    _mm512_storeu_ps(c + i*ldc + 16, y1);
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void int8_kernel_avx512(int k4, const int8_t *a, int lda, const uint8_t *b,
+        const float *scales, const float *biases, ACTIVATION act, float *c, int ldc)
+{
+    __m512i b0, b1, w;
+    __m512 s, t, y0, y1;
+    int p;
+    INT8_AVX512_ZERO(0) INT8_AVX512_ZERO(1) INT8_AVX512_ZERO(2) INT8_AVX512_ZERO(3)
+    INT8_AVX512_ZERO(4) INT8_AVX512_ZERO(5) INT8_AVX512_ZERO(6) INT8_AVX512_ZERO(7)
+    for(p = 0; p < k4; ++p){
+        b0 = _mm512_load_si512(b);
+        b1 = _mm512_load_si512(b + 64);
+        INT8_AVX512_DOT(0) INT8_AVX512_DOT(1) INT8_AVX512_DOT(2) INT8_AVX512_DOT(3)
+        INT8_AVX512_DOT(4) INT8_AVX512_DOT(5) INT8_AVX512_DOT(6) INT8_AVX512_DOT(7)
+        b += 4*INT8_AVX512_NR;
+    }
+    INT8_AVX512_STORE(0) INT8_AVX512_STORE(1) INT8_AVX512_STORE(2) INT8_AVX512_STORE(3)
+    INT8_AVX512_STORE(4) INT8_AVX512_STORE(5) INT8_AVX512_STORE(6) INT8_AVX512_STORE(7)
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int32_t int8_dot_avx512(int K, const int8_t *a, const uint8_t *x)
+{
+    __m512i acc = _mm512_setzero_si512();
+    int k;
+    for(k = 0; k + 64 <= K; k += 64){
+        acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(x + k), _mm512_loadu_si512(a + k));
+    }
+    if(k < K){
+        __mmask64 m = ((__mmask64)-1) >> (64 - (K - k));
+        acc = _mm512_dpbusd_epi32(acc, _mm512_maskz_loadu_epi8(m, x + k), _mm512_maskz_loadu_epi8(m, a + k));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+#endif
+
+static pthread_once_t int8_engine_once = PTHREAD_ONCE_INIT;
+static int8_engine int8_engine_selected;
+
+static void init_int8_engine()
+{
+    int8_engine s = {SCALAR_MR, SCALAR_NR, 255, int8_kernel_scalar, int8_dot_scalar};
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")){
+        s.mr = INT8_AVX512_MR;
+        s.nr = INT8_AVX512_NR;
+        s.kernel = int8_kernel_avx512;
+        s.dot = int8_dot_avx512;
+    } else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+        s.mr = INT8_AVX2_MR;
+        s.nr = INT8_AVX2_NR;
+        s.input_max = 127;
+        s.kernel = int8_kernel_avx2;
+        s.dot = int8_dot_avx2;
+    }
+#endif
+    int8_engine_selected = s;
+}
+
+static int8_engine get_int8_engine()
+{
+    pthread_once(&int8_engine_once, init_int8_engine);
+    return int8_engine_selected;
+}
+
+/* Largest activation code the int8 kernels handle exactly. */
+int gemm_int8_input_max()
+{
+    return get_int8_engine().input_max;
+}
+
+/* B(k, j) into nr-column panels holding the 4 consecutive k of each column
+ * together, which is the operand layout of pmaddubsw and vpdpbusd. */
+typedef struct{
+    int K, N;
+    const uint8_t *B;
+    int ldb;
+    int nr;
+    uint8_t *pb;
+} pack_int8_args;
+
+static void pack_b_int8_panel(int jp, void *ptr)
+{
+    pack_int8_args *a = ptr;
+    int K = a->K, N = a->N, ldb = a->ldb, nr = a->nr;
+    int k4 = (K + 3)/4;
+    const uint8_t *B = a->B;
+    uint8_t *dst = a->pb + (size_t)jp*k4*nr*4;
+    int j0 = jp*nr;
+    int n = (N - j0 < nr) ? N - j0 : nr;
+    int p, j, t;
+    for(p = 0; p < k4; ++p){
+        const uint8_t *src = B + (size_t)4*p*ldb + j0;
+        uint8_t *d = dst + (size_t)p*nr*4;
+        j = 0;
+#ifdef __SSE2__
+        if(4*p + 4 <= K){
+            for(; j + 16 <= n; j += 16){
+                __m128i r0 = _mm_loadu_si128((const __m128i *)(src + j));
+                __m128i r1 = _mm_loadu_si128((const __m128i *)(src + ldb + j));
+                __m128i r2 = _mm_loadu_si128((const __m128i *)(src + 2*ldb + j));
+                __m128i r3 = _mm_loadu_si128((const __m128i *)(src + 3*ldb + j));
+                __m128i lo01 = _mm_unpacklo_epi8(r0, r1), hi01 = _mm_unpackhi_epi8(r0, r1);
+                __m128i lo23 = _mm_unpacklo_epi8(r2, r3), hi23 = _mm_unpackhi_epi8(r2, r3);
+                _mm_storeu_si128((__m128i *)(d + 4*j), _mm_unpacklo_epi16(lo01, lo23));
+                _mm_storeu_si128((__m128i *)(d + 4*j + 16), _mm_unpackhi_epi16(lo01, lo23));
+                _mm_storeu_si128((__m128i *)(d + 4*j + 32), _mm_unpacklo_epi16(hi01, hi23));
+                _mm_storeu_si128((__m128i *)(d + 4*j + 48), _mm_unpackhi_epi16(hi01, hi23));
             }
-            C[i*ldc+j] += sum;
         }
+#endif
+        for(; j < n; ++j){
+            for(t = 0; t < 4; ++t){
+                d[4*j + t] = (4*p + t < K) ? src[(size_t)t*ldb + j] : 0;
+            }
+        }
+        if(n < nr) memset(d + 4*n, 0, (nr - n)*4);
     }
 }
 
+static void pack_b_int8(int K, int N, const uint8_t *B, int ldb, int nr, uint8_t *pb)
+{
+    pack_int8_args a = {K, N, B, ldb, nr, pb};
+    parallel_for((N + nr - 1)/nr, pack_b_int8_panel, &a);
+}
+
+typedef struct{
+    int8_engine *e;
+    int M, N, k4;
+    int8_t *A;
+    int lda;
+    uint8_t *b_buf;
+    float *scales, *biases;
+    ACTIVATION act, fused;
+    float *C;
+    int ldc;
+} int8_args;
+
+static void gemm_int8_tile(int t, void *ptr)
+{
+    int8_args *g = ptr;
+    int mr = g->e->mr;
+    int nr = g->e->nr;
+    int mpanels = (g->M + mr - 1)/mr;
+    int jr = t / mpanels;
+    int ir = t % mpanels;
+    int m = (g->M - ir*mr < mr) ? g->M - ir*mr : mr;
+    int n = (g->N - jr*nr < nr) ? g->N - jr*nr : nr;
+    const int8_t *a = g->A + (size_t)ir*mr*g->lda;
+    const uint8_t *b = g->b_buf + (size_t)jr*nr*g->k4*4;
+    float *c = g->C + (size_t)ir*mr*g->ldc + jr*nr;
+    int i, j;
+    if(m == mr && n == nr){
+        g->e->kernel(g->k4, a, g->lda, b, g->scales + ir*mr, g->biases + ir*mr, g->fused, c, g->ldc);
+    } else {
+        float tile[GEMM_INT8_MR*INT8_MAX_NR];
+        g->e->kernel(g->k4, a, g->lda, b, g->scales + ir*mr, g->biases + ir*mr, g->fused, tile, nr);
+        for(i = 0; i < m; ++i){
+            memcpy(c + i*g->ldc, tile + i*nr, n*sizeof(float));
+        }
+    }
+    if(g->fused != g->act){
+        for(i = 0; i < m; ++i){
+            for(j = 0; j < n; ++j){
+                c[i*g->ldc + j] = activate(c[i*g->ldc + j], g->act);
+            }
+        }
+    }
+}
+
+void gemm_int8(int M, int N, int K, int8_t *A, int lda, uint8_t *B, int ldb,
+        float *scales, float *biases, ACTIVATION act, float *C, int ldc)
+{
+    static __thread float *pb = 0;
+    static __thread size_t pb_cap = 0;
+    int8_engine e = get_int8_engine();
+    int nr = e.nr;
+    int k4 = (K + 3)/4;
+    int npanels = (N + nr - 1)/nr;
+    int mpanels = (M + e.mr - 1)/e.mr;
+    ACTIVATION fused = (act == LINEAR || act == RELU || act == LEAKY) ? act : LINEAR;
+    int8_args g;
+    if(M <= 0 || N <= 0) return;
+    g.e = &e;
+    g.M = M;
+    g.N = N;
+    g.k4 = k4;
+    g.A = A;
+    g.lda = lda;
+    g.b_buf = (uint8_t *)gemm_aligned_buffer(&pb, &pb_cap, (size_t)npanels*nr*k4);
+    g.scales = scales;
+    g.biases = biases;
+    g.act = act;
+    g.fused = fused;
+    g.C = C;
+    g.ldc = ldc;
+    pack_b_int8(K, N, B, ldb, nr, g.b_buf);
+    parallel_for(npanels*mpanels, gemm_int8_tile, &g);
+}
+
+typedef struct{
+    int8_dot_fn dot;
+    int K;
+    int8_t *A;
+    int lda;
+    uint8_t *x;
+    float *scales, *biases;
+    ACTIVATION act;
+    float *y;
+} gemv_int8_args;
+
+static void gemv_int8_row(int i, void *ptr)
+{
+    gemv_int8_args *g = ptr;
+    g->y[i] = activate(g->scales[i]*g->dot(g->K, g->A + (size_t)i*g->lda, g->x) + g->biases[i], g->act);
+}
+
+void gemv_int8(int M, int K, int8_t *A, int lda, uint8_t *x,
+        float *scales, float *biases, ACTIVATION act, float *y)
+{
+    gemv_int8_args g = {get_int8_engine().dot, K, A, lda, x, scales, biases, act, y};
+    parallel_for(M, gemv_int8_row, &g);
+}
+
+static void scale_c(int M, int N, float BETA, float *C, int ldc)
+{
+    int i, j;
+    if(BETA == 0){
+        for(i = 0; i < M; ++i){
+            memset(C + i*ldc, 0, N*sizeof(float));
+        }
+    } else if(BETA != 1){
+        for(i = 0; i < M; ++i){
+            for(j = 0; j < N; ++j){
+                C[i*ldc + j] *= BETA;
+            }
+        }
+    }
+}
 
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
@@ -149,20 +1097,30 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float *C, int ldc)
 {
     //printf("cpu: %d %d %d %d %d %f %d %d %f %d\n",TA, TB, M, N, K, ALPHA, lda, ldb, BETA, ldc);
-    int i, j;
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA;
-        }
-    }
-    if(!TA && !TB)
-        gemm_nn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
-    else if(TA && !TB)
-        gemm_tn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
-    else if(!TA && TB)
-        gemm_nt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
-    else
-        gemm_tt(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
+    gemm_fused(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc, 0);
+}
+
+void gemm_fused(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc, const gemm_epilogue *ep)
+{
+    scale_c(M, N, BETA, C, ldc);
+    if(M <= 0 || N <= 0 || K <= 0) return;
+    gemm_packed(get_gemm_engine(), TA, TB, M, N, K, ALPHA, A, lda, B, ldb, 0, C, ldc, ep);
+}
+
+void gemm_im2col(int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *im, int height, int width, int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc, const gemm_epilogue *ep)
+{
+    im2col_src g = {im, height, width, ksize, stride, pad, (width + 2*pad - ksize)/stride + 1};
+    scale_c(M, N, BETA, C, ldc);
+    if(M <= 0 || N <= 0 || K <= 0) return;
+    gemm_packed(get_gemm_engine(), 0, 0, M, N, K, ALPHA, A, lda, 0, 0, &g, C, ldc, ep);
 }
 
 #ifdef GPU
@@ -1,10 +1,30 @@
 #ifndef GEMM_H
 #define GEMM_H
 
+#include <stdint.h>
+#include "activations.h"
+
+/* Tallest int8 microkernel: A, scales and biases passed to gemm_int8 must
+ * stay readable GEMM_INT8_MR - 1 rows past M. */
+#define GEMM_INT8_MR 8
+
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
         float *B, int ldb,
         float *C, int ldc);
+
+void gemm_bin_packed(int M, int N, int words, float *scales,
+        uint64_t *A,
+        uint64_t *B, uint64_t *mask,
+        float *C, int ldc);
+
+void gemm_int8(int M, int N, int K, int8_t *A, int lda, uint8_t *B, int ldb,
+        float *scales, float *biases, ACTIVATION act, float *C, int ldc);
+
+int gemm_int8_input_max();
+
+void gemv_int8(int M, int K, int8_t *A, int lda, uint8_t *x,
+        float *scales, float *biases, ACTIVATION act, float *y);
         
 void gemm(int TA, int TB, int M, int N, int K, float ALPHA, 
                     float *A, int lda, 
@@ -12,6 +32,35 @@ void gemm(int TA, int TB, int M, int N, int K, float ALPHA,
                     float BETA,
                     float *C, int ldc);
 
+/* Applied to each tile of C once its last K slice is accumulated, while the
+ * tile is still in cache: C = act(scales*C + biases) per row, then, when add
+ * is set, C = add_act(C + add) with add laid out like C. Null scales or
+ * biases stand for 1 and 0. */
+typedef struct{
+    float *scales;
+    float *biases;
+    ACTIVATION act;
+    float *add;
+    ACTIVATION add_act;
+} gemm_epilogue;
+
+void gemm_fused(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc, const gemm_epilogue *ep);
+
+/* C = ALPHA*A*B + BETA*C where B is the im2col matrix of im (K rows of
+ * taps, N output pixels), gathered while packing instead of materialized.
+ * ep, if not null, is applied as in gemm_fused. */
+void gemm_im2col(int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *im, int height, int width, int ksize, int stride, int pad,
+        float BETA,
+        float *C, int ldc, const gemm_epilogue *ep);
+
+const char *gemm_engine_name();
+
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
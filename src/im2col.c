@@ -1,5 +1,7 @@
 #include "im2col.h"
+#include "darknet.h"
 #include <stdio.h>
+#include <string.h>
 float im2col_get_pixel(float *im, int height, int width, int channels,
                         int row, int col, int channel, int pad)
 {
@@ -38,3 +40,134 @@ void im2col_cpu(float* data_im,
     }
 }
 
+// Columns [col0, col0 + ncols) of the im2col matrix, stored ncols wide, so
+// large layers can be processed in slices of a small workspace.
+void im2col_cpu_cols(float* data_im,
+     int channels,  int height,  int width,
+     int ksize,  int stride, int pad,
+     int col0, int ncols, float* data_col)
+{
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    int channels_col = channels * ksize * ksize;
+    int c, i;
+    for (c = 0; c < channels_col; ++c) {
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        int h = col0 / width_col;
+        int w = col0 % width_col;
+        float *dst = data_col + (size_t)c * ncols;
+        for (i = 0; i < ncols; ++i) {
+            dst[i] = im2col_get_pixel(data_im, height, width, channels,
+                    h_offset + h * stride, w_offset + w * stride, c_im, pad);
+            if (++w == width_col) {
+                w = 0;
+                ++h;
+            }
+        }
+    }
+}
+
+typedef struct {
+    int channels, height, width, ksize, stride, pad;
+    int width_col, cw, words;
+    uint64_t *pixels, *bits, *mask;
+} im2col_bits_args;
+
+static void im2col_bits_row(int h, void *ptr)
+{
+    im2col_bits_args *a = ptr;
+    int cw = a->cw, width = a->width, height = a->height;
+    int w, ky, kx, k;
+    for (w = 0; w < a->width_col; ++w) {
+        uint64_t *b = a->bits + (size_t)(h * a->width_col + w) * a->words;
+        uint64_t *m = a->mask + (size_t)(h * a->width_col + w) * a->words;
+        for (ky = 0; ky < a->ksize; ++ky) {
+            int im_row = h * a->stride + ky - a->pad;
+            for (kx = 0; kx < a->ksize; ++kx) {
+                int im_col = w * a->stride + kx - a->pad;
+                if (im_row < 0 || im_col < 0 || im_row >= height || im_col >= width) {
+                    memset(b, 0, cw * sizeof(uint64_t));
+                    memset(m, 0, cw * sizeof(uint64_t));
+                } else {
+                    memcpy(b, a->pixels + (size_t)(im_row * width + im_col) * cw, cw * sizeof(uint64_t));
+                    for (k = 0; k < cw - 1; ++k) m[k] = ~0ULL;
+                    m[cw - 1] = (a->channels & 63) ? (1ULL << (a->channels & 63)) - 1 : ~0ULL;
+                }
+                b += cw;
+                m += cw;
+            }
+        }
+    }
+}
+
+// Binary im2col for the XNOR path. Sign bits are first packed per pixel
+// across channels (cw = ceil(channels/64) words), then each output column is
+// the concatenation of its ksize*ksize taps, so filter taps are ordered
+// (ky, kx, c) rather than (c, ky, kx); pack_binary_weights matches this.
+// mask marks live bits: padded taps and the unused tail of each tap are 0.
+void im2col_cpu_bits(float* data_im,
+     int channels,  int height,  int width,
+     int ksize,  int stride, int pad,
+     uint64_t *pixels, uint64_t *bits, uint64_t *mask)
+{
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    int cw = (channels + 63) / 64;
+    int words = ksize * ksize * cw;
+    int c, i;
+    im2col_bits_args a = {channels, height, width, ksize, stride, pad,
+        width_col, cw, words, pixels, bits, mask};
+
+    memset(pixels, 0, (size_t)height * width * cw * sizeof(uint64_t));
+    for (c = 0; c < channels; ++c) {
+        float *im = data_im + c * height * width;
+        uint64_t *p = pixels + c / 64;
+        uint64_t bit = 1ULL << (c & 63);
+        for (i = 0; i < height * width; ++i) {
+            if (im[i] > 0) p[i * cw] |= bit;
+        }
+    }
+
+    parallel_for(height_col, im2col_bits_row, &a);
+}
+
+// 8-bit im2col for the quantized path. Same layout as im2col_cpu; padded
+// taps take the zero point of the quantized input rather than 0.
+void im2col_cpu_u8(uint8_t* data_im,
+     int channels,  int height,  int width,
+     int ksize,  int stride, int pad, uint8_t zero, uint8_t* data_col)
+{
+    int height_col = (height + 2*pad - ksize) / stride + 1;
+    int width_col = (width + 2*pad - ksize) / stride + 1;
+    int channels_col = channels * ksize * ksize;
+    int c, h, w;
+    for (c = 0; c < channels_col; ++c) {
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        // Output columns whose input column lands inside the image.
+        int w0 = (pad - w_offset + stride - 1) / stride;
+        int w1 = (width + pad - w_offset + stride - 1) / stride;
+        if (w0 < 0) w0 = 0;
+        if (w1 > width_col) w1 = width_col;
+        if (w1 < w0) w1 = w0;
+        for (h = 0; h < height_col; ++h) {
+            int im_row = h_offset + h * stride - pad;
+            uint8_t *col = data_col + ((size_t)c * height_col + h) * width_col;
+            uint8_t *row;
+            if (im_row < 0 || im_row >= height) {
+                memset(col, zero, width_col);
+                continue;
+            }
+            row = data_im + ((size_t)c_im * height + im_row) * width;
+            memset(col, zero, w0);
+            if (stride == 1) {
+                memcpy(col + w0, row + w_offset - pad + w0, w1 - w0);
+            } else {
+                for (w = w0; w < w1; ++w) col[w] = row[w_offset + w * stride - pad];
+            }
+            memset(col + w1, zero, width_col - w1);
+        }
+    }
+}
@@ -1,10 +1,26 @@
 #ifndef IM2COL_H
 #define IM2COL_H
 
+#include <stdint.h>
+
 void im2col_cpu(float* data_im,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_col);
 
+void im2col_cpu_cols(float* data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad,
+        int col0, int ncols, float* data_col);
+
+void im2col_cpu_bits(float* data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad,
+        uint64_t *pixels, uint64_t *bits, uint64_t *mask);
+
+void im2col_cpu_u8(uint8_t* data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad, uint8_t zero, uint8_t* data_col);
+
 #ifdef GPU
 
 void im2col_gpu(float *im,
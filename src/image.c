@@ -190,6 +190,56 @@ image **load_alphabet()
     return alphabets;
 }
 
+static void draw_detection(image im, box b, int class, float prob, float *mask, char **names, image **alphabet, int classes)
+{
+    int width = im.h * .006;
+
+    if(0){
+        width = pow(prob, 1./2.)*10+1;
+        alphabet = 0;
+    }
+
+    //printf("%d %s: %.0f%%\n", i, names[class], prob*100);
+    printf("%s: %.0f%%\n", names[class], prob*100);
+    int offset = class*123457 % classes;
+    float red = get_color(2,offset,classes);
+    float green = get_color(1,offset,classes);
+    float blue = get_color(0,offset,classes);
+    float rgb[3];
+
+    //width = prob*20+2;
+
+    rgb[0] = red;
+    rgb[1] = green;
+    rgb[2] = blue;
+
+    int left  = (b.x-b.w/2.)*im.w;
+    int right = (b.x+b.w/2.)*im.w;
+    int top   = (b.y-b.h/2.)*im.h;
+    int bot   = (b.y+b.h/2.)*im.h;
+
+    if(left < 0) left = 0;
+    if(right > im.w-1) right = im.w-1;
+    if(top < 0) top = 0;
+    if(bot > im.h-1) bot = im.h-1;
+
+    draw_box_width(im, left, top, right, bot, width, red, green, blue);
+    if (alphabet) {
+        image label = get_label(alphabet, names[class], (im.h*.03)/10);
+        draw_label(im, top + width, left, label, rgb);
+        free_image(label);
+    }
+    if (mask){
+        image mask_im = float_to_image(14, 14, 1, mask);
+        image resized_mask = resize_image(mask_im, b.w*im.w, b.h*im.h);
+        image tmask = threshold_image(resized_mask, .5);
+        embed_image(tmask, im, left, top);
+        free_image(mask_im);
+        free_image(resized_mask);
+        free_image(tmask);
+    }
+}
+
 void draw_detections(image im, int num, float thresh, box *boxes, float **probs, float **masks, char **names, image **alphabet, int classes)
 {
     int i;
@@ -198,53 +248,23 @@ void draw_detections(image im, int num, float thresh, box *boxes, float **probs,
         int class = max_index(probs[i], classes);
         float prob = probs[i][class];
         if(prob > thresh){
-            int width = im.h * .006;
-
-            if(0){
-                width = pow(prob, 1./2.)*10+1;
-                alphabet = 0;
-            }
+            draw_detection(im, boxes[i], class, prob, masks ? masks[i] : 0, names, alphabet, classes);
+        }
+    }
+}
 
-            //printf("%d %s: %.0f%%\n", i, names[class], prob*100);
-            printf("%s: %.0f%%\n", names[class], prob*100);
-            int offset = class*123457 % classes;
-            float red = get_color(2,offset,classes);
-            float green = get_color(1,offset,classes);
-            float blue = get_color(0,offset,classes);
-            float rgb[3];
-
-            //width = prob*20+2;
-
-            rgb[0] = red;
-            rgb[1] = green;
-            rgb[2] = blue;
-            box b = boxes[i];
-
-            int left  = (b.x-b.w/2.)*im.w;
-            int right = (b.x+b.w/2.)*im.w;
-            int top   = (b.y-b.h/2.)*im.h;
-            int bot   = (b.y+b.h/2.)*im.h;
-
-            if(left < 0) left = 0;
-            if(right > im.w-1) right = im.w-1;
-            if(top < 0) top = 0;
-            if(bot > im.h-1) bot = im.h-1;
-
-            draw_box_width(im, left, top, right, bot, width, red, green, blue);
-            if (alphabet) {
-                image label = get_label(alphabet, names[class], (im.h*.03)/10);
-                draw_label(im, top + width, left, label, rgb);
-                free_image(label);
-            }
-            if (masks){
-                image mask = float_to_image(14, 14, 1, masks[i]);
-                image resized_mask = resize_image(mask, b.w*im.w, b.h*im.h);
-                image tmask = threshold_image(resized_mask, .5);
-                embed_image(tmask, im, left, top);
-                free_image(mask);
-                free_image(resized_mask);
-                free_image(tmask);
-            }
+/* Draws the best class of every anchor, like draw_detections. dets must
+ * keep the anchor order of get_region_detections. */
+void draw_region_detections(image im, detection *dets, int n, float thresh, char **names, image **alphabet, int classes)
+{
+    int i = 0;
+    while(i < n){
+        int best = i;
+        for(++i; i < n && dets[i].index == dets[best].index; ++i){
+            if(dets[i].prob > dets[best].prob) best = i;
+        }
+        if(dets[best].prob > thresh){
+            draw_detection(im, dets[best].bbox, dets[best].class, dets[best].prob, dets[best].mask, names, alphabet, classes);
         }
     }
 }
@@ -852,43 +872,6 @@ void composite_3d(char *f1, char *f2, char *out, int delta)
 #endif
 }
 
-void letterbox_image_into(image im, int w, int h, image boxed)
-{
-    int new_w = im.w;
-    int new_h = im.h;
-    if (((float)w/im.w) < ((float)h/im.h)) {
-        new_w = w;
-        new_h = (im.h * w)/im.w;
-    } else {
-        new_h = h;
-        new_w = (im.w * h)/im.h;
-    }
-    image resized = resize_image(im, new_w, new_h);
-    embed_image(resized, boxed, (w-new_w)/2, (h-new_h)/2); 
-    free_image(resized);
-}
-
-image letterbox_image(image im, int w, int h)
-{
-    int new_w = im.w;
-    int new_h = im.h;
-    if (((float)w/im.w) < ((float)h/im.h)) {
-        new_w = w;
-        new_h = (im.h * w)/im.w;
-    } else {
-        new_h = h;
-        new_w = (im.w * h)/im.h;
-    }
-    image resized = resize_image(im, new_w, new_h);
-    image boxed = make_image(w, h, im.c);
-    fill_image(boxed, .5);
-    //int i;
-    //for(i = 0; i < boxed.w*boxed.h*boxed.c; ++i) boxed.data[i] = 0;
-    embed_image(resized, boxed, (w-new_w)/2, (h-new_h)/2); 
-    free_image(resized);
-    return boxed;
-}
-
 image resize_max(image im, int max)
 {
     int w = im.w;
@@ -1270,51 +1253,6 @@ float bilinear_interpolate(image im, float x, float y, int c)
     return val;
 }
 
-image resize_image(image im, int w, int h)
-{
-    image resized = make_image(w, h, im.c);   
-    image part = make_image(w, im.h, im.c);
-    int r, c, k;
-    float w_scale = (float)(im.w - 1) / (w - 1);
-    float h_scale = (float)(im.h - 1) / (h - 1);
-    for(k = 0; k < im.c; ++k){
-        for(r = 0; r < im.h; ++r){
-            for(c = 0; c < w; ++c){
-                float val = 0;
-                if(c == w-1 || im.w == 1){
-                    val = get_pixel(im, im.w-1, r, k);
-                } else {
-                    float sx = c*w_scale;
-                    int ix = (int) sx;
-                    float dx = sx - ix;
-                    val = (1 - dx) * get_pixel(im, ix, r, k) + dx * get_pixel(im, ix+1, r, k);
-                }
-                set_pixel(part, c, r, k, val);
-            }
-        }
-    }
-    for(k = 0; k < im.c; ++k){
-        for(r = 0; r < h; ++r){
-            float sy = r*h_scale;
-            int iy = (int) sy;
-            float dy = sy - iy;
-            for(c = 0; c < w; ++c){
-                float val = (1-dy) * get_pixel(part, c, iy, k);
-                set_pixel(resized, c, r, k, val);
-            }
-            if(r == h-1 || im.h == 1) continue;
-            for(c = 0; c < w; ++c){
-                float val = dy * get_pixel(part, c, iy+1, k);
-                add_pixel(resized, c, r, k, val);
-            }
-        }
-    }
-
-    free_image(part);
-    return resized;
-}
-
-
 void test_resize(char *filename)
 {
     image im = load_image(filename, 0,0, 3);
@@ -0,0 +1,202 @@
+#include "darknet.h"
+#include "image_u8.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Decoded image cache for training. Small datasets are loaded again every
+ * epoch and decoding dominates the loader, so load_image_u8_cached keeps
+ * the decoded images, before any augmentation, as the decoder's 8-bit
+ * pixels keyed by path. The cache holds at most its byte budget and drops
+ * the least recently used images first. All loader threads share it:
+ * lookups and the LRU list are guarded by one lock, while decoding and
+ * copying run outside it. An entry being copied is pinned and never
+ * evicted.
+ *
+ * The cache is off unless image_cache_init was called or
+ * $DARKNET_IMAGE_CACHE sets a budget in MB.
+ */
+
+#define CACHE_BUCKETS (1 << 16)
+
+typedef struct cache_entry{
+    char *path;
+    unsigned int hash;
+    int w, h, c;
+    int refs;
+    size_t bytes;
+    unsigned char *data;
+    struct cache_entry *chain;
+    struct cache_entry *prev;
+    struct cache_entry *next;
+} cache_entry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static size_t cache_budget;
+static size_t cache_used;
+static size_t cache_hits;
+static size_t cache_misses;
+static cache_entry **cache_buckets;
+static cache_entry *cache_head;
+static cache_entry *cache_tail;
+
+static unsigned int hash_path(char *s)
+{
+    unsigned int h = 2166136261u;
+    while(*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static void unlink_entry(cache_entry *e)
+{
+    if(e->prev) e->prev->next = e->next;
+    else cache_head = e->next;
+    if(e->next) e->next->prev = e->prev;
+    else cache_tail = e->prev;
+    e->prev = e->next = 0;
+}
+
+static void push_front(cache_entry *e)
+{
+    e->next = cache_head;
+    e->prev = 0;
+    if(cache_head) cache_head->prev = e;
+    cache_head = e;
+    if(!cache_tail) cache_tail = e;
+}
+
+static void free_entry(cache_entry *e)
+{
+    free(e->path);
+    free(e->data);
+    free(e);
+}
+
+static void remove_entry(cache_entry *e)
+{
+    cache_entry **p = cache_buckets + (e->hash % CACHE_BUCKETS);
+    while(*p != e) p = &(*p)->chain;
+    *p = e->chain;
+    unlink_entry(e);
+    cache_used -= e->bytes;
+    free_entry(e);
+}
+
+static cache_entry *find_entry(char *path, unsigned int hash)
+{
+    cache_entry *e = cache_buckets[hash % CACHE_BUCKETS];
+    for(; e; e = e->chain){
+        if(e->hash == hash && !strcmp(e->path, path)) return e;
+    }
+    return 0;
+}
+
+/* Evicts unpinned entries from the cold end until bytes more fit. */
+static int make_room(size_t bytes)
+{
+    cache_entry *e = cache_tail;
+    while(e && cache_used + bytes > cache_budget){
+        cache_entry *prev = e->prev;
+        if(!e->refs) remove_entry(e);
+        e = prev;
+    }
+    return cache_used + bytes <= cache_budget;
+}
+
+static void clear_cache()
+{
+    while(cache_head) remove_entry(cache_head);
+    free(cache_buckets);
+    cache_buckets = 0;
+    cache_used = cache_hits = cache_misses = 0;
+}
+
+/* Call before loading starts, not while loader threads use the cache. */
+void image_cache_init(size_t bytes)
+{
+    pthread_mutex_lock(&cache_lock);
+    clear_cache();
+    cache_budget = bytes;
+    if(bytes) cache_buckets = calloc(CACHE_BUCKETS, sizeof(cache_entry *));
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void init_from_env()
+{
+    char *env = getenv("DARKNET_IMAGE_CACHE");
+    if(env && !cache_buckets) image_cache_init((size_t)atoi(env) << 20);
+}
+
+void print_image_cache()
+{
+    pthread_mutex_lock(&cache_lock);
+    if(cache_budget){
+        fprintf(stderr, "Image cache: %zu / %zu MB, %zu hits, %zu misses\n", cache_used >> 20, cache_budget >> 20, cache_hits, cache_misses);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static image_u8 entry_image(cache_entry *e)
+{
+    image_u8 im = make_image_u8(e->w, e->h, e->c);
+    memcpy(im.data, e->data, e->bytes);
+    return im;
+}
+
+/* Same as load_image_u8(path); the caller owns the image. */
+image_u8 load_image_u8_cached(char *path)
+{
+    unsigned int hash;
+    cache_entry *e;
+    image_u8 im;
+    pthread_once(&cache_once, init_from_env);
+    if(!cache_budget) return load_image_u8(path);
+
+    hash = hash_path(path);
+    pthread_mutex_lock(&cache_lock);
+    e = find_entry(path, hash);
+    if(e){
+        ++cache_hits;
+        ++e->refs;
+        unlink_entry(e);
+        push_front(e);
+        pthread_mutex_unlock(&cache_lock);
+        im = entry_image(e);
+        pthread_mutex_lock(&cache_lock);
+        --e->refs;
+        pthread_mutex_unlock(&cache_lock);
+        return im;
+    }
+    ++cache_misses;
+    pthread_mutex_unlock(&cache_lock);
+
+    im = load_image_u8(path);
+    e = calloc(1, sizeof(cache_entry));
+    e->hash = hash;
+    e->w = im.w;
+    e->h = im.h;
+    e->c = im.c;
+    e->bytes = (size_t)im.w*im.h*im.c;
+    e->data = malloc(e->bytes);
+    memcpy(e->data, im.data, e->bytes);
+
+    pthread_mutex_lock(&cache_lock);
+    /* Another thread may have decoded the same image meanwhile. */
+    if(find_entry(path, hash) || e->bytes > cache_budget || !make_room(e->bytes)){
+        pthread_mutex_unlock(&cache_lock);
+        free_entry(e);
+        return im;
+    }
+    e->path = copy_string(path);
+    e->chain = cache_buckets[hash % CACHE_BUCKETS];
+    cache_buckets[hash % CACHE_BUCKETS] = e;
+    push_front(e);
+    cache_used += e->bytes;
+    pthread_mutex_unlock(&cache_lock);
+    return im;
+}
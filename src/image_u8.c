@@ -0,0 +1,289 @@
+#include "image_u8.h"
+#include "image.h"
+#include "utils.h"
+#include "stb_image.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * 8-bit interleaved images for the training loaders. Decoders hand out
+ * interleaved bytes, so a sample stays in that form, at a quarter of the
+ * size of a float image, through cropping, placing and flipping, and is
+ * turned into planar floats (/255) only when it is written into its row
+ * of the batch. The colour distortion happens in that same write:
+ * distorting the bytes in place would round every pixel a second time.
+ * Geometric operations that only move pixels are exact, the ones that
+ * interpolate round to the nearest byte.
+ */
+
+image_u8 make_image_u8(int w, int h, int c)
+{
+    image_u8 out;
+    out.w = w;
+    out.h = h;
+    out.c = c;
+    out.data = calloc((size_t)w*h*c, 1);
+    return out;
+}
+
+void free_image_u8(image_u8 m)
+{
+    free(m.data);
+}
+
+image_u8 copy_image_u8(image_u8 m)
+{
+    image_u8 copy = make_image_u8(m.w, m.h, m.c);
+    memcpy(copy.data, m.data, (size_t)m.w*m.h*m.c);
+    return copy;
+}
+
+static unsigned char to_byte(float v)
+{
+    return (unsigned char)(constrain(0, 1, v)*255 + .5);
+}
+
+static float from_byte(unsigned char v)
+{
+    return (float)v/255.;
+}
+
+image_u8 image_to_u8(image im)
+{
+    image_u8 out = make_image_u8(im.w, im.h, im.c);
+    int i, k;
+    for(k = 0; k < im.c; ++k){
+        for(i = 0; i < im.w*im.h; ++i){
+            out.data[i*im.c + k] = to_byte(im.data[k*im.w*im.h + i]);
+        }
+    }
+    return out;
+}
+
+/* Three channels, as load_image_color. */
+image_u8 load_image_u8(char *filename)
+{
+#ifdef OPENCV
+    image im = load_image_color(filename, 0, 0);
+    image_u8 out = image_to_u8(im);
+    free_image(im);
+    return out;
+#else
+    int c;
+    image_u8 out;
+    out.data = stbi_load(filename, &out.w, &out.h, &c, 3);
+    if (!out.data) {
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", filename, stbi_failure_reason());
+        exit(0);
+    }
+    out.c = 3;
+    return out;
+#endif
+}
+
+void fill_image_u8(image_u8 m, unsigned char v)
+{
+    memset(m.data, v, (size_t)m.w*m.h*m.c);
+}
+
+void flip_image_u8(image_u8 m)
+{
+    int x, y, k;
+    for(y = 0; y < m.h; ++y){
+        unsigned char *row = m.data + (size_t)y*m.w*m.c;
+        for(x = 0; x < m.w/2; ++x){
+            unsigned char *a = row + x*m.c;
+            unsigned char *b = row + (m.w - x - 1)*m.c;
+            for(k = 0; k < m.c; ++k){
+                unsigned char swap = a[k];
+                a[k] = b[k];
+                b[k] = swap;
+            }
+        }
+    }
+}
+
+/* Pixels outside im repeat its edge, as crop_image. */
+image_u8 crop_image_u8(image_u8 im, int dx, int dy, int w, int h)
+{
+    image_u8 cropped = make_image_u8(w, h, im.c);
+    int x, y;
+    for(y = 0; y < h; ++y){
+        int r = constrain_int(y + dy, 0, im.h-1);
+        unsigned char *src = im.data + (size_t)r*im.w*im.c;
+        unsigned char *dst = cropped.data + (size_t)y*w*im.c;
+        for(x = 0; x < w; ++x){
+            int c = constrain_int(x + dx, 0, im.w-1);
+            memcpy(dst + x*im.c, src + c*im.c, im.c);
+        }
+    }
+    return cropped;
+}
+
+image_u8 center_crop_image_u8(image_u8 im, int w, int h)
+{
+    int m = (im.w < im.h) ? im.w : im.h;
+    image_u8 c = crop_image_u8(im, (im.w - m)/2, (im.h - m)/2, m, m);
+    image_u8 r = resize_image_u8(c, w, h);
+    free_image_u8(c);
+    return r;
+}
+
+static float pixel_extend_u8(image_u8 m, int x, int y, int c)
+{
+    if(x < 0 || x >= m.w || y < 0 || y >= m.h) return 0;
+    return from_byte(m.data[((size_t)y*m.w + x)*m.c + c]);
+}
+
+/* Same sampling as rotate_crop_image, outside im is black. */
+image_u8 rotate_crop_image_u8(image_u8 im, float rad, float s, int w, int h, float dx, float dy, float aspect)
+{
+    int x, y, c;
+    float cx = im.w/2.;
+    float cy = im.h/2.;
+    image_u8 rot = make_image_u8(w, h, im.c);
+    for(y = 0; y < h; ++y){
+        for(x = 0; x < w; ++x){
+            float rx = cos(rad)*((x - w/2.)/s*aspect + dx/s*aspect) - sin(rad)*((y - h/2.)/s + dy/s) + cx;
+            float ry = sin(rad)*((x - w/2.)/s*aspect + dx/s*aspect) + cos(rad)*((y - h/2.)/s + dy/s) + cy;
+            int ix = (int) floorf(rx);
+            int iy = (int) floorf(ry);
+            float fx = rx - ix;
+            float fy = ry - iy;
+            unsigned char *dst = rot.data + ((size_t)y*w + x)*im.c;
+            for(c = 0; c < im.c; ++c){
+                float val = (1-fy) * (1-fx) * pixel_extend_u8(im, ix, iy, c) +
+                    fy     * (1-fx) * pixel_extend_u8(im, ix, iy+1, c) +
+                    (1-fy) *   fx   * pixel_extend_u8(im, ix+1, iy, c) +
+                    fy     *   fx   * pixel_extend_u8(im, ix+1, iy+1, c);
+                dst[c] = to_byte(val);
+            }
+        }
+    }
+    return rot;
+}
+
+image_u8 random_augment_image_u8(image_u8 im, float angle, float aspect, int low, int high, int w, int h)
+{
+    augment_args a = random_augment_args(make_empty_image(im.w, im.h, im.c), angle, aspect, low, high, w, h);
+    return rotate_crop_image_u8(im, a.rad, a.scale, a.w, a.h, a.dx, a.dy, a.aspect);
+}
+
+/* Nearest-neighbour scaling of im to w x h at (dx, dy) of canvas, clipped
+ * to the canvas, as place_image. */
+void place_image_u8(image_u8 im, int w, int h, int dx, int dy, image_u8 canvas)
+{
+    int x0 = (dx < 0) ? -dx : 0;
+    int y0 = (dy < 0) ? -dy : 0;
+    int x1 = (dx + w > canvas.w) ? canvas.w - dx : w;
+    int y1 = (dy + h > canvas.h) ? canvas.h - dy : h;
+    int *cols;
+    int x, y;
+    if(x1 <= x0 || y1 <= y0) return;
+    cols = calloc(w, sizeof(int));
+    for(x = x0; x < x1; ++x){
+        int rx = ((float)x / w) * im.w;
+        cols[x] = (rx < im.w ? rx : im.w - 1)*im.c;
+    }
+    for(y = y0; y < y1; ++y){
+        int ry = ((float)y / h) * im.h;
+        unsigned char *src = im.data + (size_t)(ry < im.h ? ry : im.h - 1)*im.w*im.c;
+        unsigned char *dst = canvas.data + ((size_t)(y + dy)*canvas.w + dx)*canvas.c;
+        for(x = x0; x < x1; ++x) memcpy(dst + x*im.c, src + cols[x], im.c);
+    }
+    free(cols);
+}
+
+/* Writes im as a planar float image into out. */
+void image_u8_into(image_u8 im, float *out)
+{
+    int i, k;
+    int n = im.w*im.h;
+    for(k = 0; k < im.c; ++k){
+        unsigned char *p = im.data + k;
+        float *o = out + (size_t)k*n;
+        for(i = 0; i < n; ++i) o[i] = from_byte(p[i*im.c]);
+    }
+}
+
+/* distort_image on one pixel: scales saturation and value, shifts hue. */
+static void distort_pixel(float *px, float hue, float sat, float val)
+{
+    float r = px[0], g = px[1], b = px[2];
+    float max = three_way_max(r,g,b);
+    float min = three_way_min(r,g,b);
+    float delta = max - min;
+    float h, s, v;
+    v = max;
+    if(max == 0){
+        s = 0;
+        h = 0;
+    }else{
+        s = delta/max;
+        if(r == max){
+            h = (g - b) / delta;
+        } else if (g == max) {
+            h = 2 + (b - r) / delta;
+        } else {
+            h = 4 + (r - g) / delta;
+        }
+        if (h < 0) h += 6;
+        h = h/6.;
+    }
+    s = s*sat;
+    v = v*val;
+    h = h + hue;
+    if (h > 1) h -= 1;
+    if (h < 0) h += 1;
+
+    h = 6 * h;
+    if (s == 0) {
+        r = g = b = v;
+    } else {
+        int index = floor(h);
+        float f = h - index;
+        float p = v*(1-s);
+        float q = v*(1-s*f);
+        float t = v*(1-s*(1-f));
+        if(index == 0){
+            r = v; g = t; b = p;
+        } else if(index == 1){
+            r = q; g = v; b = p;
+        } else if(index == 2){
+            r = p; g = v; b = t;
+        } else if(index == 3){
+            r = p; g = q; b = v;
+        } else if(index == 4){
+            r = t; g = p; b = v;
+        } else {
+            r = v; g = p; b = q;
+        }
+    }
+    px[0] = constrain(0, 1, r);
+    px[1] = constrain(0, 1, g);
+    px[2] = constrain(0, 1, b);
+}
+
+/* image_u8_into followed by distort_image(hue, sat, val) on the result,
+ * without the intermediate float image. im has three channels. */
+void distort_image_u8_into(image_u8 im, float hue, float sat, float val, float *out)
+{
+    int i;
+    int n = im.w*im.h;
+    assert(im.c == 3);
+    for(i = 0; i < n; ++i){
+        unsigned char *p = im.data + (size_t)i*3;
+        float px[3];
+        px[0] = from_byte(p[0]);
+        px[1] = from_byte(p[1]);
+        px[2] = from_byte(p[2]);
+        distort_pixel(px, hue, sat, val);
+        out[i] = px[0];
+        out[i + n] = px[1];
+        out[i + 2*n] = px[2];
+    }
+}
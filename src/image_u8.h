@@ -0,0 +1,24 @@
+#ifndef IMAGE_U8_H
+#define IMAGE_U8_H
+
+#include "darknet.h"
+
+image_u8 make_image_u8(int w, int h, int c);
+image_u8 copy_image_u8(image_u8 m);
+image_u8 image_to_u8(image im);
+void fill_image_u8(image_u8 m, unsigned char v);
+void flip_image_u8(image_u8 m);
+image_u8 crop_image_u8(image_u8 im, int dx, int dy, int w, int h);
+image_u8 center_crop_image_u8(image_u8 im, int w, int h);
+image_u8 rotate_crop_image_u8(image_u8 im, float rad, float s, int w, int h, float dx, float dy, float aspect);
+image_u8 random_augment_image_u8(image_u8 im, float angle, float aspect, int low, int high, int w, int h);
+void place_image_u8(image_u8 im, int w, int h, int dx, int dy, image_u8 canvas);
+
+void image_u8_into(image_u8 im, float *out);
+void distort_image_u8_into(image_u8 im, float hue, float sat, float val, float *out);
+
+image_u8 resize_image_u8(image_u8 im, int w, int h);
+void resize_image_u8_into(image_u8 im, int w, int h, float *out);
+void letterbox_image_u8_into(image_u8 im, image boxed);
+
+#endif
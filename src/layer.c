@@ -27,14 +27,21 @@ void free_layer(layer l)
     if(l.concat)             free(l.concat);
     if(l.concat_delta)       free(l.concat_delta);
     if(l.binary_weights)     free(l.binary_weights);
+    if(l.xnor_weights)       free(l.xnor_weights);
+    if(l.xnor_scales)        free(l.xnor_scales);
+    if(l.winograd_weights)   free(l.winograd_weights);
+    if(l.qweights)           free(l.qweights);
+    if(l.qweight_scales)     free(l.qweight_scales);
+    if(l.qscales)            free(l.qscales);
+    if(l.qbiases)            free(l.qbiases);
     if(l.biases)             free(l.biases);
     if(l.bias_updates)       free(l.bias_updates);
     if(l.scales)             free(l.scales);
     if(l.scale_updates)      free(l.scale_updates);
     if(l.weights)            free(l.weights);
     if(l.weight_updates)     free(l.weight_updates);
-    if(l.delta)              free(l.delta);
-    if(l.output)             free(l.output);
+    if(l.delta && !l.shared_output) free(l.delta);
+    if(l.output && !l.shared_output) free(l.output);
     if(l.squared)            free(l.squared);
     if(l.norms)              free(l.norms);
     if(l.spatial_mean)       free(l.spatial_mean);
@@ -95,3 +102,69 @@ void free_layer(layer l)
     if(l.norms_gpu)               cuda_free(l.norms_gpu);
 #endif
 }
+
+static __thread int inference_only = 0;
+
+/* While set, layers are built for forward passes only; see training_calloc. */
+void set_inference_only(int on)
+{
+    inference_only = on;
+}
+
+/* For buffers only backward and update use: gradients, weight updates, saved
+ * activations, batch statistics and optimizer state. Layers built while
+ * inference_only is set get none, and every use of them checks for null or
+ * only runs in training. */
+void *training_calloc(size_t nmemb, size_t size)
+{
+    return inference_only ? 0 : calloc(nmemb, size);
+}
+
+static __thread int external_weights = 0;
+
+/* While set, layers are built for weights that will be pointed at memory
+ * owned elsewhere, e.g. a mapped compiled model; see weights_calloc. */
+void set_external_weights(int on)
+{
+    external_weights = on;
+}
+
+/* The parameters weight files store for l, in their order within a layer's
+ * record. Fills b and returns how many there are. */
+int layer_param_blobs(layer *l, param_blob *b)
+{
+    int n = 0;
+    int bn = 0;
+    if(l->type == CONVOLUTIONAL || l->type == DECONVOLUTIONAL){
+        b[n++] = (param_blob){&l->biases, l->n};
+        bn = l->batch_normalize ? l->n : 0;
+    } else if(l->type == CONNECTED || l->type == LOCAL){
+        b[n++] = (param_blob){&l->biases, l->outputs};
+    } else if(l->type == BATCHNORM){
+        bn = l->c;
+    }
+    if(bn){
+        b[n++] = (param_blob){&l->scales, bn};
+        b[n++] = (param_blob){&l->rolling_mean, bn};
+        b[n++] = (param_blob){&l->rolling_variance, bn};
+    }
+    if(l->type == CONVOLUTIONAL) b[n++] = (param_blob){&l->weights, l->nweights};
+    if(l->type == DECONVOLUTIONAL) b[n++] = (param_blob){&l->weights, (size_t)l->c*l->n*l->size*l->size};
+    if(l->type == LOCAL) b[n++] = (param_blob){&l->weights, (size_t)l->size*l->size*l->c*l->n*l->out_w*l->out_h};
+    if(l->type == CONNECTED){
+        b[n++] = (param_blob){&l->weights, (size_t)l->outputs*l->inputs};
+        if(l->batch_normalize){
+            b[n++] = (param_blob){&l->scales, l->outputs};
+            b[n++] = (param_blob){&l->rolling_mean, l->outputs};
+            b[n++] = (param_blob){&l->rolling_variance, l->outputs};
+        }
+    }
+    return n;
+}
+
+/* For the weight matrices. Layers built while external_weights is set get
+ * none and skip their random initialization. */
+void *weights_calloc(size_t nmemb, size_t size)
+{
+    return external_weights ? 0 : calloc(nmemb, size);
+}
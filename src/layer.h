@@ -1 +1,18 @@
+#ifndef LAYER_H
+#define LAYER_H
 #include "darknet.h"
+
+#define MAX_PARAM_BLOBS 5
+
+typedef struct{
+    float **data;
+    size_t n;
+} param_blob;
+
+void set_inference_only(int on);
+void *training_calloc(size_t nmemb, size_t size);
+void set_external_weights(int on);
+void *weights_calloc(size_t nmemb, size_t size);
+int layer_param_blobs(layer *l, param_blob *b);
+
+#endif
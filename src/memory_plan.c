@@ -0,0 +1,247 @@
+#include "darknet.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Static activation memory planning for inference. Once a network is built,
+ * every layer's output is only needed from the layer that writes it until
+ * the last layer that reads it, through the implicit previous-layer input,
+ * a shortcut's from= or a route's layers=. Outputs with disjoint lifetimes
+ * share memory: each planned output gets an offset in one network-owned
+ * arena, placed greedily from the largest buffer down at the lowest offset
+ * that does not collide with a buffer alive at the same time.
+ *
+ * Route inputs are concatenated in place: a layer read by exactly one route
+ * writes its output (and accumulates its delta) straight into its slice of
+ * the route's buffers, and the route skips the copy. Slices are contiguous
+ * only for batch 1, so with larger batches only single-input routes alias.
+ * The producer's lifetime then extends the route buffer's.
+ *
+ * Outputs read after the forward pass (the network output and any other
+ * layer nobody consumes, e.g. extra region layers) keep their own buffers,
+ * as do layers whose output pointer is aliased elsewhere (dropout, the
+ * recurrent layers).
+ */
+
+/* Offsets are kept 64-byte aligned for the vector kernels, and so is the
+ * arena. */
+#define PLAN_ALIGN 16
+
+typedef struct{
+    int layer;
+    int first;
+    int last;
+    size_t size;
+    size_t offset;
+} planned_output;
+
+static int aliases_output(LAYER_TYPE t)
+{
+    return t == DROPOUT || t == RNN || t == GRU || t == LSTM || t == CRNN || t == COST;
+}
+
+static void mark_read(int *last, int producer, int reader)
+{
+    if(producer >= 0 && reader > last[producer]) last[producer] = reader;
+}
+
+static int route_readers(network *net, int index)
+{
+    int i, j, count = 0;
+    for(i = index + 1; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type != ROUTE) continue;
+        for(j = 0; j < l.n; ++j) count += l.input_layers[j] == index;
+    }
+    return count;
+}
+
+/* Marks the route slice each producer can write in place: into[p] = r. */
+static int find_route_slices(network *net, int out, int *into, size_t *slice)
+{
+    int i, j, count = 0;
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        size_t offset = 0;
+        if(l.type != ROUTE || (l.batch > 1 && l.n > 1)) continue;
+        for(j = 0; j < l.n; ++j){
+            int p = l.input_layers[j];
+            layer in = net->layers[p];
+            if(in.output && p != out && in.outputs == l.input_sizes[j] && !in.delta == !l.delta
+                    && !aliases_output(in.type) && !aliases_output(net->layers[p+1].type)
+                    && route_readers(net, p) == 1){
+                into[p] = i;
+                slice[p] = offset;
+                ++count;
+            }
+            offset += l.input_sizes[j];
+        }
+    }
+    return count;
+}
+
+static int compare_planned_size(const void *a, const void *b)
+{
+    const planned_output *pa = a;
+    const planned_output *pb = b;
+    if(pa->size != pb->size) return pa->size < pb->size ? 1 : -1;
+    return pa->layer - pb->layer;
+}
+
+static int compare_planned_offset(const void *a, const void *b)
+{
+    const planned_output *pa = *(planned_output * const *)a;
+    const planned_output *pb = *(planned_output * const *)b;
+    if(pa->offset == pb->offset) return 0;
+    return pa->offset < pb->offset ? -1 : 1;
+}
+
+static size_t place_output(planned_output *p, planned_output *placed, int n, planned_output **live)
+{
+    size_t offset = 0;
+    int i, m = 0;
+    for(i = 0; i < n; ++i){
+        if(placed[i].last < p->first || p->last < placed[i].first) continue;
+        live[m++] = placed + i;
+    }
+    qsort(live, m, sizeof(planned_output *), compare_planned_offset);
+    for(i = 0; i < m; ++i){
+        if(offset + p->size <= live[i]->offset) break;
+        if(live[i]->offset + live[i]->size > offset) offset = live[i]->offset + live[i]->size;
+    }
+    return offset;
+}
+
+int unplan_network_memory(network *net)
+{
+    int i, planned = 0;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(!l->shared_output) continue;
+        l->output = calloc(l->outputs*l->batch, sizeof(float));
+        if(l->delta) l->delta = calloc(l->outputs*l->batch, sizeof(float));
+        l->shared_output = 0;
+        planned = 1;
+    }
+    free(net->arena);
+    net->arena = 0;
+    return planned;
+}
+
+static void plan_memory(network *net, int verbose)
+{
+    int i, j, n = 0, routed;
+    int out = net->n - 1;
+    int *first, *last, *into;
+    size_t *slice;
+    size_t total = 0, arena = 0;
+    planned_output *plan;
+    planned_output **live;
+
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    unplan_network_memory(net);
+    while(out > 0 && net->layers[out].type == COST) --out;
+
+    first = calloc(net->n, sizeof(int));
+    last = calloc(net->n, sizeof(int));
+    into = calloc(net->n, sizeof(int));
+    slice = calloc(net->n, sizeof(size_t));
+    for(i = 0; i < net->n; ++i){
+        first[i] = i;
+        last[i] = -1;
+        into[i] = -1;
+    }
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        if(l.type == ROUTE){
+            for(j = 0; j < l.n; ++j) mark_read(last, l.input_layers[j], i);
+        } else {
+            mark_read(last, i - 1, i);
+        }
+        if(l.type == SHORTCUT) mark_read(last, l.index, i);
+        /* A fused convolution writes its shortcut's output. */
+        if(l.fused_shortcut) first[l.fused_shortcut] = i;
+    }
+
+    /* A route buffer lives as long as every output written into it. */
+    routed = find_route_slices(net, out, into, slice);
+    for(i = 0; i < net->n; ++i){
+        int r = i;
+        if(into[i] < 0) continue;
+        while(into[r] >= 0) r = into[r];
+        if(first[i] < first[r]) first[r] = first[i];
+        if(last[i] > last[r]) last[r] = last[i];
+    }
+
+    plan = calloc(net->n, sizeof(planned_output));
+    live = calloc(net->n, sizeof(planned_output *));
+    for(i = 0; i < net->n; ++i){
+        layer l = net->layers[i];
+        /* Backward needs every output, so only inference buffers share. */
+        if(!l.output || l.delta || i == out || into[i] >= 0 || last[i] < 0 || aliases_output(l.type)) continue;
+        if(i + 1 < net->n && aliases_output(net->layers[i+1].type)) continue;
+        plan[n].layer = i;
+        plan[n].first = first[i];
+        plan[n].last = last[i];
+        plan[n].size = ((size_t)l.outputs*l.batch + PLAN_ALIGN - 1) / PLAN_ALIGN * PLAN_ALIGN;
+        total += plan[n].size;
+        ++n;
+    }
+    qsort(plan, n, sizeof(planned_output), compare_planned_size);
+    for(i = 0; i < n; ++i){
+        plan[i].offset = place_output(plan + i, plan, i, live);
+        if(plan[i].offset + plan[i].size > arena) arena = plan[i].offset + plan[i].size;
+    }
+
+    if(n){
+        if(posix_memalign((void **)&net->arena, 64, arena*sizeof(float))) malloc_error();
+        memset(net->arena, 0, arena*sizeof(float));
+    }
+    for(i = 0; i < n; ++i){
+        layer *l = net->layers + plan[i].layer;
+        free(l->output);
+        l->output = net->arena + plan[i].offset;
+        l->shared_output = 1;
+    }
+    /* Routes come after their inputs, so walking back resolves nested routes. */
+    for(i = net->n - 1; i >= 0; --i){
+        layer *l = net->layers + i;
+        layer r;
+        if(into[i] < 0) continue;
+        r = net->layers[into[i]];
+        if(!l->shared_output) free(l->output);
+        l->output = r.output + slice[i];
+        if(l->delta){
+            free(l->delta);
+            l->delta = r.delta + slice[i];
+        }
+        l->shared_output = 1;
+    }
+    if(verbose && (n || routed)){
+        fprintf(stderr, "Memory plan: %d outputs, %d route inputs in place, %.1f MB -> %.1f MB\n", n, routed,
+                total*sizeof(float)/1048576., arena*sizeof(float)/1048576.);
+    }
+    free(live);
+    free(plan);
+    free(slice);
+    free(into);
+    free(last);
+    free(first);
+}
+
+void plan_network_memory(network *net)
+{
+    plan_memory(net, 1);
+}
+
+/* For a network planned before whose batch or input size changed: plans it
+ * again without printing the summary. */
+void replan_network_memory(network *net)
+{
+    plan_memory(net, 0);
+}
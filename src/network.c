@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <assert.h>
+#include <sys/mman.h>
 #include "network.h"
 #include "image.h"
 #include "data.h"
@@ -28,6 +29,8 @@
 #include "route_layer.h"
 #include "shortcut_layer.h"
 #include "parser.h"
+#include "profiler.h"
+#include "autotune.h"
 #include "data.h"
 
 load_args get_base_args(network net)
@@ -67,6 +70,80 @@ network *load_network_p(char *cfg, char *weights, int clear)
     return net;
 }
 
+// cfg may also be a compiled model, which already holds its weights.
+network load_network_inference(char *cfg, char *weights)
+{
+    if (is_compiled_network(cfg))
+        return load_compiled_network(cfg);
+    network net = parse_network_cfg_inference(cfg);
+    if (weights && weights[0] != 0)
+    {
+        load_weights_inference(&net, weights);
+    }
+    return net;
+}
+
+network *load_network_inference_p(char *cfg, char *weights)
+{
+    network *net = calloc(1, sizeof(network));
+    *net = load_network_inference(cfg, weights);
+    return net;
+}
+
+void fuse_batchnorm_network(network *net)
+{
+    int i;
+    for (i = 0; i < net->n; ++i)
+    {
+        if (net->layers[i].type == CONVOLUTIONAL)
+        {
+            fuse_batchnorm_convolutional_layer(net->layers + i);
+        }
+    }
+}
+
+static int layer_reads_output(layer l, int index)
+{
+    int i;
+    if (l.type == SHORTCUT)
+        return l.index == index;
+    if (l.type == ROUTE)
+    {
+        for (i = 0; i < l.n; ++i)
+        {
+            if (l.input_layers[i] == index)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// Inference only: let a convolution followed by a same-shape shortcut write
+// the shortcut's output directly, adding the residual in its GEMM epilogue.
+// The convolution's own output then goes stale, so no other layer may read it.
+void fuse_shortcut_network(network *net)
+{
+    int i, j;
+    for (i = 0; i + 1 < net->n; ++i)
+    {
+        layer *l = net->layers + i;
+        layer *s = net->layers + i + 1;
+        if (l->type != CONVOLUTIONAL || s->type != SHORTCUT || s->index == i)
+            continue;
+        if (s->w != s->out_w || s->h != s->out_h || s->c != s->out_c)
+            continue;
+        for (j = i + 2; j < net->n; ++j)
+        {
+            if (layer_reads_output(net->layers[j], i))
+                break;
+        }
+        if (j < net->n)
+            continue;
+        l->fused_shortcut = i + 1;
+        s->fused = 1;
+    }
+}
+
 size_t get_current_batch(network net)
 {
     size_t batch_num = (*net.seen) / (net.batch * net.subdivisions);
@@ -219,12 +296,19 @@ void forward_network(network net)
     for (i = 0; i < net.n; ++i)
     {
         net.index = i;
+        if (net.layers[i].type == CONVOLUTIONAL)
+        {
+            autotune_convolutional_layer(net.layers + i, net);
+        }
         layer l = net.layers[i];
         if (l.delta)
         {
             fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
+        double start = net.prof ? profile_clock() : 0;
         l.forward(l, net);
+        if (net.prof)
+            profile_layer(net.prof, i, PROFILE_FORWARD, start);
         net.input = l.output;
         if (l.truth)
         {
@@ -254,7 +338,10 @@ void update_network(network net)
         layer l = net.layers[i];
         if (l.update)
         {
+            double start = net.prof ? profile_clock() : 0;
             l.update(l, a);
+            if (net.prof)
+                profile_layer(net.prof, i, PROFILE_UPDATE, start);
         }
     }
 }
@@ -300,7 +387,10 @@ void backward_network(network net)
             net.delta = prev.delta;
         }
         net.index = i;
+        double start = net.prof ? profile_clock() : 0;
         l.backward(l, net);
+        if (net.prof)
+            profile_layer(net.prof, i, PROFILE_BACKWARD, start);
     }
 }
 
@@ -363,8 +453,11 @@ void set_temp_network(network net, float t)
 
 void set_batch_network(network *net, int b)
 {
+    if (b == net->batch)
+        return;
     net->batch = b;
     int i;
+    size_t workspace_size = 0;
     for (i = 0; i < net->n; ++i)
     {
         net->layers[i].batch = b;
@@ -380,7 +473,31 @@ void set_batch_network(network *net, int b)
             cudnnSetTensor4dDescriptor(l->normTensorDesc, CUDNN_TENSOR_NCHW, CUDNN_DATA_FLOAT, 1, l->out_c, 1, 1);
         }
 #endif
+        if (net->layers[i].type == CONVOLUTIONAL)
+        {
+            // Tuned algorithms and Winograd tile chunks depend on the batch.
+            layer *l = net->layers + i;
+            if (l->autotune)
+                l->autotune = 1;
+            set_conv_algorithm(l, l->algorithm);
+        }
+        if (net->layers[i].workspace_size > workspace_size)
+            workspace_size = net->layers[i].workspace_size;
+    }
+#ifdef GPU
+    if (gpu_index >= 0)
+        return;
+#endif
+    // Per-image callers switch batches back and forth, keep the larger buffer.
+    if (workspace_size > net->workspace_size)
+    {
+        free(net->workspace);
+        net->workspace = calloc(1, workspace_size);
+        net->workspace_size = workspace_size;
     }
+    // Output offsets and route slices were planned for the old batch size.
+    if (unplan_network_memory(net))
+        replan_network_memory(net);
 }
 
 int resize_network(network *net, int w, int h)
@@ -391,6 +508,7 @@ int resize_network(network *net, int w, int h)
 #endif
     int i;
     //if(w == net->w && h == net->h) return 0;
+    int planned = unplan_network_memory(net);
     net->w = w;
     net->h = h;
     int inputs = 0;
@@ -482,6 +600,9 @@ int resize_network(network *net, int w, int h)
     free(net->workspace);
     net->workspace = calloc(1, workspace_size);
 #endif
+    net->workspace_size = workspace_size;
+    if (planned)
+        replan_network_memory(net);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
@@ -605,11 +726,9 @@ float *network_predict_p(network *net, float *input)
 
 float *network_predict_image(network *net, image im)
 {
-    image imr = letterbox_image(im, net->w, net->h);
     set_batch_network(net, 1);
-    float *p = network_predict(*net, imr.data);
-    free_image(imr);
-    return p;
+    letterbox_image_into(im, net->w, net->h, float_to_image(net->w, net->h, im.c, net->input));
+    return network_predict(*net, net->input);
 }
 
 int network_width(network *net) { return net->w; }
@@ -767,14 +886,51 @@ float network_accuracy_multi(network net, data d, int n)
     return acc;
 }
 
+// Drops l's pointers to parameters the network does not own: a clone's,
+// which belong to the network it was cloned from, and those in a mapping.
+static void release_shared_params(network net, layer *l)
+{
+    param_blob b[MAX_PARAM_BLOBS];
+    char *map = net.mapping;
+    int i;
+    int blobs = layer_param_blobs(l, b);
+    for (i = 0; i < blobs; ++i)
+    {
+        char *p = (char *)*b[i].data;
+        if (net.shared_weights || (p >= map && p < map + net.mapping_size))
+            *b[i].data = 0;
+    }
+    if (net.shared_weights)
+    {
+        l->winograd_weights = 0;
+        l->xnor_weights = 0;
+        l->xnor_scales = 0;
+        l->qweights = 0;
+        l->qweight_scales = 0;
+        l->qscales = 0;
+        l->qbiases = 0;
+    }
+}
+
 void free_network(network net)
 {
     int i;
     for (i = 0; i < net.n; ++i)
     {
-        free_layer(net.layers[i]);
+        layer l = net.layers[i];
+        if (net.mapping || net.shared_weights)
+            release_shared_params(net, &l);
+        free_layer(l);
     }
     free(net.layers);
+    if (net.mapping)
+        munmap(net.mapping, net.mapping_size);
+    if (net.cfgfile)
+        free(net.cfgfile);
+    if (net.arena)
+        free(net.arena);
+    if (net.prof)
+        free_profiler(net.prof);
     if (net.input)
         free(net.input);
     if (net.truth)
@@ -138,24 +138,21 @@ typedef struct {
     float *err;
 } train_args;
 
-void *train_thread(void *ptr)
+void train_thread(void *ptr)
 {
     train_args args = *(train_args*)ptr;
     free(ptr);
     cuda_set_device(args.net.gpu_index);
     *args.err = train_network(args.net, args.d);
-    return 0;
 }
 
-pthread_t train_network_in_thread(network net, data d, float *err)
+task *train_network_in_thread(network net, data d, float *err)
 {
-    pthread_t thread;
     train_args *ptr = (train_args *)calloc(1, sizeof(train_args));
     ptr->net = net;
     ptr->d = d;
     ptr->err = err;
-    if(pthread_create(&thread, 0, train_thread, ptr)) error("Thread creation failed");
-    return thread;
+    return submit_task(train_thread, ptr);
 }
 
 void merge_weights(layer l, layer base)
@@ -331,45 +328,25 @@ void sync_layer(network *nets, int n, int j)
 typedef struct{
     network *nets;
     int n;
-    int j;
 } sync_args;
 
-void *sync_layer_thread(void *ptr)
+void sync_layer_thread(int j, void *ptr)
 {
     sync_args args = *(sync_args*)ptr;
-    sync_layer(args.nets, args.n, args.j);
-    free(ptr);
-    return 0;
-}
-
-pthread_t sync_layer_in_thread(network *nets, int n, int j)
-{
-    pthread_t thread;
-    sync_args *ptr = (sync_args *)calloc(1, sizeof(sync_args));
-    ptr->nets = nets;
-    ptr->n = n;
-    ptr->j = j;
-    if(pthread_create(&thread, 0, sync_layer_thread, ptr)) error("Thread creation failed");
-    return thread;
+    sync_layer(args.nets, args.n, j);
 }
 
 void sync_nets(network *nets, int n, int interval)
 {
     int j;
     int layers = nets[0].n;
-    pthread_t *threads = (pthread_t *) calloc(layers, sizeof(pthread_t));
+    sync_args args = {nets, n};
 
     *nets[0].seen += interval * (n-1) * nets[0].batch * nets[0].subdivisions;
     for (j = 0; j < n; ++j){
         *nets[j].seen = *nets[0].seen;
     }
-    for (j = 0; j < layers; ++j) {
-        threads[j] = sync_layer_in_thread(nets, n, j);
-    }
-    for (j = 0; j < layers; ++j) {
-        pthread_join(threads[j], 0);
-    }
-    free(threads);
+    parallel_for(layers, sync_layer_thread, &args);
 }
 
 float train_networks(network *nets, int n, data d, int interval)
@@ -378,7 +355,7 @@ float train_networks(network *nets, int n, data d, int interval)
     int batch = nets[0].batch;
     int subdivisions = nets[0].subdivisions;
     assert(batch * subdivisions * n == d.X.rows);
-    pthread_t *threads = (pthread_t *) calloc(n, sizeof(pthread_t));
+    task **threads = (task **) calloc(n, sizeof(task *));
     float *errors = (float *) calloc(n, sizeof(float));
 
     float sum = 0;
@@ -387,7 +364,7 @@ float train_networks(network *nets, int n, data d, int interval)
         threads[i] = train_network_in_thread(nets[i], p, errors + i);
     }
     for(i = 0; i < n; ++i){
-        pthread_join(threads[i], 0);
+        wait_task(threads[i]);
         //printf("%f\n", errors[i]);
         sum += errors[i];
     }
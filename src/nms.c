@@ -0,0 +1,512 @@
+#include "darknet.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Non-maximum suppression. Every variant reduces to the same step: boxes
+ * sorted by falling score, each box still standing suppresses the later
+ * ones it overlaps by more than thresh. Candidates are bucketed (per class,
+ * or per anchor for the objectness variants) and each bucket is sorted
+ * once.
+ *
+ * A bucket keeps its boxes as edges and areas in separate arrays. Above
+ * NMS_GRID_MIN boxes it also gets a uniform grid over their extent, with
+ * every box listed in each cell it touches, so a box is only tested
+ * against the boxes sharing one of its cells; boxes without a common cell
+ * cannot overlap. Boxes without a finite, positive area never suppress or
+ * get suppressed, box_iou makes them 0 or NaN. The IoUs of one box against a block of others are
+ * computed with AVX2 when the CPU has it, using the same operations in
+ * the same order as box_iou, so results match the scalar code exactly.
+ */
+
+#define NMS_GRID_MIN 48
+#define NMS_GRID_MAX 64
+
+typedef struct{
+    int n;
+    float *l, *r, *t, *b, *area;
+    int prune;
+    int g;
+    float x0, y0, sx, sy;
+    int *cells;
+    int *items;
+    int *stamp;
+    int *cand;
+    float *iou;
+} nms_set;
+
+typedef void (*nms_iou_fn)(const nms_set *s, int i, const int *idx, int m, float *iou);
+
+static void box_cells(const nms_set *s, int j, int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = (int)((s->l[j] - s->x0)*s->sx);
+    *x1 = (int)((s->r[j] - s->x0)*s->sx);
+    *y0 = (int)((s->t[j] - s->y0)*s->sy);
+    *y1 = (int)((s->b[j] - s->y0)*s->sy);
+    if(*x0 > s->g - 1) *x0 = s->g - 1;
+    if(*y0 > s->g - 1) *y0 = s->g - 1;
+    if(*x1 > s->g - 1) *x1 = s->g - 1;
+    if(*y1 > s->g - 1) *y1 = s->g - 1;
+}
+
+/* Tests the exponent bits: -Ofast lets the compiler assume isfinite. */
+static int is_finite(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return (u & 0x7f800000) != 0x7f800000;
+}
+
+/* Boxes with no area, or not finite, overlap nothing. */
+static int has_area(const nms_set *s, int j)
+{
+    return is_finite(s->l[j]) && is_finite(s->r[j]) && is_finite(s->t[j]) && is_finite(s->b[j])
+        && s->l[j] < s->r[j] && s->t[j] < s->b[j];
+}
+
+static void build_grid(nms_set *s)
+{
+    int i, j, x, y, x0, y0, x1, y1;
+    int *fill;
+    float minx = INFINITY, miny = INFINITY, maxx = -INFINITY, maxy = -INFINITY;
+    int g = (int)sqrt(s->n/4.);
+    if(g > NMS_GRID_MAX) g = NMS_GRID_MAX;
+    for(j = 0; j < s->n; ++j){
+        if(!has_area(s, j)) continue;
+        if(s->l[j] < minx) minx = s->l[j];
+        if(s->t[j] < miny) miny = s->t[j];
+        if(s->r[j] > maxx) maxx = s->r[j];
+        if(s->b[j] > maxy) maxy = s->b[j];
+    }
+    if(g < 2 || !(maxx > minx) || !(maxy > miny)) return;
+    s->g = g;
+    s->x0 = minx;
+    s->y0 = miny;
+    s->sx = g/(maxx - minx);
+    s->sy = g/(maxy - miny);
+    if(!is_finite(s->sx) || !is_finite(s->sy)){
+        s->g = 0;
+        return;
+    }
+
+    s->cells = calloc(g*g + 1, sizeof(int));
+    for(j = 0; j < s->n; ++j){
+        if(!has_area(s, j)) continue;
+        box_cells(s, j, &x0, &y0, &x1, &y1);
+        for(y = y0; y <= y1; ++y) for(x = x0; x <= x1; ++x) ++s->cells[y*g + x + 1];
+    }
+    for(i = 0; i < g*g; ++i) s->cells[i+1] += s->cells[i];
+    s->items = calloc(s->cells[g*g], sizeof(int));
+    fill = calloc(g*g, sizeof(int));
+    for(j = 0; j < s->n; ++j){
+        if(!has_area(s, j)) continue;
+        box_cells(s, j, &x0, &y0, &x1, &y1);
+        for(y = y0; y <= y1; ++y) for(x = x0; x <= x1; ++x){
+            int c = y*g + x;
+            s->items[s->cells[c] + fill[c]++] = j;
+        }
+    }
+    free(fill);
+    s->stamp = calloc(s->n, sizeof(int));
+    for(j = 0; j < s->n; ++j) s->stamp[j] = -1;
+}
+
+/* boxes must already be in the order NMS visits them. Pruning skips the
+ * pairs that cannot overlap, which is only sound for thresh >= 0. */
+static void make_nms_set(nms_set *s, box *boxes, int n, int prune)
+{
+    int j;
+    memset(s, 0, sizeof(nms_set));
+    s->n = n;
+    s->l = calloc(5*n + 1, sizeof(float));
+    s->r = s->l + n;
+    s->t = s->r + n;
+    s->b = s->t + n;
+    s->area = s->b + n;
+    s->cand = calloc(n + 1, sizeof(int));
+    s->iou = calloc(n + 1, sizeof(float));
+    for(j = 0; j < n; ++j){
+        box a = boxes[j];
+        s->l[j] = a.x - a.w/2;
+        s->r[j] = a.x + a.w/2;
+        s->t[j] = a.y - a.h/2;
+        s->b[j] = a.y + a.h/2;
+        s->area[j] = a.w*a.h;
+    }
+    s->prune = prune;
+    if(prune && n >= NMS_GRID_MIN) build_grid(s);
+}
+
+static void free_nms_set(nms_set *s)
+{
+    free(s->l);
+    free(s->cand);
+    free(s->iou);
+    free(s->cells);
+    free(s->items);
+    free(s->stamp);
+}
+
+/* Indices j >= from, j != i, that may overlap box i, in no particular order. */
+static int nms_candidates(nms_set *s, int i, int from)
+{
+    int j, k, x, y, x0, y0, x1, y1, m = 0;
+    if(!s->prune){
+        for(j = from; j < s->n; ++j) if(j != i) s->cand[m++] = j;
+        return m;
+    }
+    if(!has_area(s, i)) return 0;
+    if(!s->g){
+        for(j = from; j < s->n; ++j) if(j != i && has_area(s, j)) s->cand[m++] = j;
+        return m;
+    }
+    box_cells(s, i, &x0, &y0, &x1, &y1);
+    for(y = y0; y <= y1; ++y) for(x = x0; x <= x1; ++x){
+        int c = y*s->g + x;
+        for(k = s->cells[c]; k < s->cells[c+1]; ++k){
+            j = s->items[k];
+            if(j < from || j == i || s->stamp[j] == i) continue;
+            s->stamp[j] = i;
+            s->cand[m++] = j;
+        }
+    }
+    return m;
+}
+
+static inline float nms_iou_one(const nms_set *s, int i, int j)
+{
+    float left = s->l[i] > s->l[j] ? s->l[i] : s->l[j];
+    float right = s->r[i] < s->r[j] ? s->r[i] : s->r[j];
+    float top = s->t[i] > s->t[j] ? s->t[i] : s->t[j];
+    float bot = s->b[i] < s->b[j] ? s->b[i] : s->b[j];
+    float w = right - left;
+    float h = bot - top;
+    float inter = (w < 0 || h < 0) ? 0 : w*h;
+    return inter/(s->area[i] + s->area[j] - inter);
+}
+
+static void nms_iou_scalar(const nms_set *s, int i, const int *idx, int m, float *iou)
+{
+    int k;
+    for(k = 0; k < m; ++k) iou[k] = nms_iou_one(s, i, idx[k]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NMS_X86
+#include <immintrin.h>
+
+/* No fma in the target: a fused multiply-subtract in the union would round
+ * differently from box_iou. */
+__attribute__((target("avx2")))
+static void nms_iou_avx2(const nms_set *s, int i, const int *idx, int m, float *iou)
+{
+    __m256 li = _mm256_set1_ps(s->l[i]);
+    __m256 ri = _mm256_set1_ps(s->r[i]);
+    __m256 ti = _mm256_set1_ps(s->t[i]);
+    __m256 bi = _mm256_set1_ps(s->b[i]);
+    __m256 ai = _mm256_set1_ps(s->area[i]);
+    __m256 zero = _mm256_setzero_ps();
+    int k;
+    for(k = 0; k + 8 <= m; k += 8){
+        __m256i j = _mm256_loadu_si256((const __m256i *)(idx + k));
+        __m256 left = _mm256_max_ps(li, _mm256_i32gather_ps(s->l, j, 4));
+        __m256 right = _mm256_min_ps(ri, _mm256_i32gather_ps(s->r, j, 4));
+        __m256 top = _mm256_max_ps(ti, _mm256_i32gather_ps(s->t, j, 4));
+        __m256 bot = _mm256_min_ps(bi, _mm256_i32gather_ps(s->b, j, 4));
+        __m256 w = _mm256_sub_ps(right, left);
+        __m256 h = _mm256_sub_ps(bot, top);
+        __m256 none = _mm256_or_ps(_mm256_cmp_ps(w, zero, _CMP_LT_OQ), _mm256_cmp_ps(h, zero, _CMP_LT_OQ));
+        __m256 inter = _mm256_andnot_ps(none, _mm256_mul_ps(w, h));
+        __m256 uni = _mm256_sub_ps(_mm256_add_ps(ai, _mm256_i32gather_ps(s->area, j, 4)), inter);
+        _mm256_storeu_ps(iou + k, _mm256_div_ps(inter, uni));
+    }
+    for(; k < m; ++k) iou[k] = nms_iou_one(s, i, idx[k]);
+}
+#endif
+
+static pthread_once_t nms_iou_once = PTHREAD_ONCE_INIT;
+static nms_iou_fn nms_iou_selected;
+
+static void init_nms_iou()
+{
+    nms_iou_fn f = nms_iou_scalar;
+#ifdef NMS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) f = nms_iou_avx2;
+#endif
+    nms_iou_selected = f;
+}
+
+static nms_iou_fn get_nms_iou()
+{
+    pthread_once(&nms_iou_once, init_nms_iou);
+    return nms_iou_selected;
+}
+
+/* Greedy NMS over a set in visiting order; sets suppressed[j] for losers. */
+static void nms_suppress(nms_set *s, float thresh, unsigned char *suppressed)
+{
+    nms_iou_fn iou = get_nms_iou();
+    int i, k;
+    for(i = 0; i < s->n; ++i){
+        int m;
+        if(suppressed[i]) continue;
+        m = nms_candidates(s, i, i + 1);
+        iou(s, i, s->cand, m, s->iou);
+        for(k = 0; k < m; ++k){
+            if(s->iou[k] > thresh) suppressed[s->cand[k]] = 1;
+        }
+    }
+}
+
+typedef struct{
+    int index;
+    float prob;
+} nms_entry;
+
+static int nms_entry_comparator(const void *pa, const void *pb)
+{
+    const nms_entry *a = pa;
+    const nms_entry *b = pb;
+    if(a->prob < b->prob) return 1;
+    if(a->prob > b->prob) return -1;
+    return a->index - b->index;
+}
+
+/* Sorts entries by falling prob and marks the ones NMS suppresses. */
+static void nms_entries(nms_entry *e, int n, box *boxes, float thresh, unsigned char *suppressed)
+{
+    int i;
+    nms_set s;
+    box *sorted = calloc(n + 1, sizeof(box));
+    qsort(e, n, sizeof(nms_entry), nms_entry_comparator);
+    for(i = 0; i < n; ++i) sorted[i] = boxes[e[i].index];
+    make_nms_set(&s, sorted, n, thresh >= 0);
+    memset(suppressed, 0, n);
+    nms_suppress(&s, thresh, suppressed);
+    free_nms_set(&s);
+    free(sorted);
+}
+
+void do_nms_sort(box *boxes, float **probs, int total, int classes, float thresh)
+{
+    int i, k;
+    int *count = calloc(classes + 1, sizeof(int));
+    nms_entry *e;
+    unsigned char *suppressed = calloc(total + 1, 1);
+
+    for(i = 0; i < total; ++i){
+        for(k = 0; k < classes; ++k) if(probs[i][k] > 0) ++count[k+1];
+    }
+    for(k = 0; k < classes; ++k) count[k+1] += count[k];
+    e = calloc(count[classes] + 1, sizeof(nms_entry));
+    {
+        int *fill = calloc(classes, sizeof(int));
+        for(i = 0; i < total; ++i){
+            for(k = 0; k < classes; ++k){
+                if(probs[i][k] > 0){
+                    nms_entry *p = e + count[k] + fill[k]++;
+                    p->index = i;
+                    p->prob = probs[i][k];
+                }
+            }
+        }
+        free(fill);
+    }
+    for(k = 0; k < classes; ++k){
+        int n = count[k+1] - count[k];
+        nms_entry *b = e + count[k];
+        if(n < 2) continue;
+        nms_entries(b, n, boxes, thresh, suppressed);
+        for(i = 0; i < n; ++i) if(suppressed[i]) probs[b[i].index][k] = 0;
+    }
+    free(e);
+    free(count);
+    free(suppressed);
+}
+
+void do_nms_obj(box *boxes, float **probs, int total, int classes, float thresh)
+{
+    int i, k, n = 0;
+    nms_entry *e = calloc(total + 1, sizeof(nms_entry));
+    unsigned char *suppressed = calloc(total + 1, 1);
+    for(i = 0; i < total; ++i){
+        if(probs[i][classes] > 0){
+            e[n].index = i;
+            e[n].prob = probs[i][classes];
+            ++n;
+        }
+    }
+    nms_entries(e, n, boxes, thresh, suppressed);
+    for(i = 0; i < n; ++i){
+        if(!suppressed[i]) continue;
+        for(k = 0; k < classes+1; ++k) probs[e[i].index][k] = 0;
+    }
+    free(e);
+    free(suppressed);
+}
+
+static int detection_class_comparator(const void *pa, const void *pb)
+{
+    detection *a = *(detection **)pa;
+    detection *b = *(detection **)pb;
+    if(a->class != b->class) return a->class - b->class;
+    if(a->prob < b->prob) return 1;
+    if(a->prob > b->prob) return -1;
+    return a->index - b->index;
+}
+
+static int detection_max_comparator(const void *pa, const void *pb)
+{
+    detection *a = *(detection **)pa;
+    detection *b = *(detection **)pb;
+    if(a->max_prob < b->max_prob) return 1;
+    if(a->max_prob > b->max_prob) return -1;
+    return a->index - b->index;
+}
+
+/* Drops the records NMS zeroed, keeping the rest in order. */
+static int compact_detections(detection *dets, int n)
+{
+    int i, k = 0;
+    for(i = 0; i < n; ++i){
+        if(dets[i].prob == 0){
+            free(dets[i].mask);
+            continue;
+        }
+        dets[k++] = dets[i];
+    }
+    return k;
+}
+
+/* Runs NMS on s[0..n) in order, zeroing the probs of suppressed records. */
+static void nms_records(detection **s, int n, float thresh)
+{
+    int i;
+    nms_set set;
+    box *boxes = calloc(n + 1, sizeof(box));
+    unsigned char *suppressed = calloc(n + 1, 1);
+    for(i = 0; i < n; ++i) boxes[i] = s[i]->bbox;
+    make_nms_set(&set, boxes, n, thresh >= 0);
+    nms_suppress(&set, thresh, suppressed);
+    for(i = 0; i < n; ++i) if(suppressed[i]) s[i]->prob = 0;
+    free_nms_set(&set);
+    free(suppressed);
+    free(boxes);
+}
+
+/* do_nms_sort on records: per class, a record suppresses the lower scoring
+ * records of its class that overlap it. Returns the number kept. */
+int do_nms_detections(detection *dets, int n, float thresh)
+{
+    int i, j;
+    detection **s = calloc(n + 1, sizeof(detection *));
+    for(i = 0; i < n; ++i) s[i] = dets + i;
+    qsort(s, n, sizeof(detection *), detection_class_comparator);
+    for(i = 0; i < n; i = j){
+        for(j = i + 1; j < n && s[j]->class == s[i]->class; ++j);
+        if(j - i > 1) nms_records(s + i, j - i, thresh);
+    }
+    free(s);
+    return compact_detections(dets, n);
+}
+
+/* do_nms_obj on records: an anchor suppresses every record of the lower
+ * scoring anchors that overlap it, whatever their class. */
+int do_nms_obj_detections(detection *dets, int n, float thresh)
+{
+    int i, j, m = 0;
+    detection **s = calloc(n + 1, sizeof(detection *));
+    detection **anchors = calloc(n + 1, sizeof(detection *));
+    int *first = calloc(n + 1, sizeof(int));
+    for(i = 0; i < n; ++i) s[i] = dets + i;
+    qsort(s, n, sizeof(detection *), detection_max_comparator);
+    for(i = 0; i < n; ++i){
+        if(i && s[i]->index == s[i-1]->index) continue;
+        first[m] = i;
+        anchors[m++] = s[i];
+    }
+    first[m] = n;
+    nms_records(anchors, m, thresh);
+    for(i = 0; i < m; ++i){
+        if(anchors[i]->prob != 0) continue;
+        for(j = first[i]; j < first[i+1]; ++j) s[j]->prob = 0;
+    }
+    free(first);
+    free(anchors);
+    free(s);
+    return compact_detections(dets, n);
+}
+
+/*
+ * Gaussian soft-NMS (Bodla et al.) on records, per class: the best
+ * remaining record is kept and every record of its class it overlaps has
+ * its prob scaled by exp(-iou^2/sigma). Records falling to thresh or below
+ * are dropped. Returns the number kept; probs are updated in place.
+ */
+int do_soft_nms_detections(detection *dets, int n, float sigma, float thresh)
+{
+    int i, j, k;
+    nms_iou_fn iou = get_nms_iou();
+    detection **s = calloc(n + 1, sizeof(detection *));
+    for(i = 0; i < n; ++i) s[i] = dets + i;
+    qsort(s, n, sizeof(detection *), detection_class_comparator);
+    for(i = 0; i < n; i = j){
+        int m;
+        nms_set set;
+        box *boxes;
+        unsigned char *done;
+        for(j = i + 1; j < n && s[j]->class == s[i]->class; ++j);
+        m = j - i;
+        boxes = calloc(m + 1, sizeof(box));
+        done = calloc(m + 1, 1);
+        for(k = 0; k < m; ++k) boxes[k] = s[i+k]->bbox;
+        make_nms_set(&set, boxes, m, 1);
+        while(1){
+            int best = -1, c, nc;
+            for(k = 0; k < m; ++k){
+                if(done[k] || s[i+k]->prob <= thresh) continue;
+                if(best < 0 || s[i+k]->prob > s[i+best]->prob) best = k;
+            }
+            if(best < 0) break;
+            done[best] = 1;
+            nc = nms_candidates(&set, best, 0);
+            iou(&set, best, set.cand, nc, set.iou);
+            for(c = 0; c < nc; ++c){
+                detection *d = s[i + set.cand[c]];
+                float o = set.iou[c];
+                if(done[set.cand[c]] || !(o > 0)) continue;
+                d->prob *= exp(-o*o/sigma);
+            }
+        }
+        for(k = 0; k < m; ++k) if(s[i+k]->prob <= thresh) s[i+k]->prob = 0;
+        free_nms_set(&set);
+        free(done);
+        free(boxes);
+    }
+    free(s);
+    return compact_detections(dets, n);
+}
+
+typedef struct{
+    detection **dets;
+    int *nums;
+    float thresh;
+} nms_batch;
+
+static void nms_batch_image(int i, void *ptr)
+{
+    nms_batch *b = ptr;
+    b->nums[i] = do_nms_detections(b->dets[i], b->nums[i], b->thresh);
+}
+
+/* do_nms_detections on a batch of images, in parallel; updates nums. */
+void do_nms_detections_batch(detection **dets, int *nums, int batch, float thresh)
+{
+    nms_batch b = {dets, nums, thresh};
+    parallel_for(batch, nms_batch_image, &b);
+}
@@ -17,7 +17,7 @@ layer make_normalization_layer(int batch, int w, int h, int c, int size, float a
     layer.alpha = alpha;
     layer.beta = beta;
     layer.output = calloc(h * w * c * batch, sizeof(float));
-    layer.delta = calloc(h * w * c * batch, sizeof(float));
+    layer.delta = training_calloc(h * w * c * batch, sizeof(float));
     layer.squared = calloc(h * w * c * batch, sizeof(float));
     layer.norms = calloc(h * w * c * batch, sizeof(float));
     layer.inputs = w*h*c;
@@ -48,7 +48,7 @@ void resize_normalization_layer(layer *layer, int w, int h)
     layer->inputs = w*h*c;
     layer->outputs = layer->inputs;
     layer->output = realloc(layer->output, h * w * c * batch * sizeof(float));
-    layer->delta = realloc(layer->delta, h * w * c * batch * sizeof(float));
+    if(layer->delta) layer->delta = realloc(layer->delta, h * w * c * batch * sizeof(float));
     layer->squared = realloc(layer->squared, h * w * c * batch * sizeof(float));
     layer->norms = realloc(layer->norms, h * w * c * batch * sizeof(float));
 #ifdef GPU
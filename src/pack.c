@@ -0,0 +1,266 @@
+#include "data.h"
+#include "image.h"
+#include "image_u8.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Packed training sets. `darknet pack` decodes every image of a list once
+ * and writes its interleaved 8-bit pixels, optionally shrunk so the longer
+ * side fits max_side, together with the image's boxes and original path.
+ * Records go into shards of about shard_bytes each, named <out>.0, <out>.1,
+ * ..., and <out> itself lists the shard files, one per line.
+ *
+ * A shard is a header, the records, each 8-byte aligned, and an index of
+ * record offsets at index_offset. Training maps the shards read-only and
+ * augments straight from the mapped pixels, so a sample costs no file
+ * open, no JPEG decode and no copy of the source image, and the page
+ * cache is shared by every loader thread. Version 1 stored planes and is
+ * no longer read.
+ */
+
+#define PACK_MAGIC "DNPACK"
+#define PACK_VERSION 2
+#define PACK_ALIGN 8
+
+typedef struct{
+    char magic[8];
+    int32_t version;
+    int32_t count;
+    uint64_t index_offset;
+} pack_header;
+
+/* Followed by the path (path_len bytes, NUL included, padded to 4),
+ * boxes box_labels and w*h*c pixel bytes. */
+typedef struct{
+    int32_t w;
+    int32_t h;
+    int32_t c;
+    int32_t boxes;
+    int32_t path_len;
+} pack_record;
+
+struct packed_data{
+    int n;
+    int shards;
+    unsigned char **maps;
+    size_t *sizes;
+    unsigned char **records;
+};
+
+typedef struct{
+    char **paths;
+    int max_side;
+    unsigned char **records;
+    size_t *sizes;
+} pack_job;
+
+static size_t pack_align(size_t n, size_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+static void encode_record(int i, void *ptr)
+{
+    pack_job *job = ptr;
+    char *path = job->paths[i];
+    char labelpath[4096];
+    int count = 0;
+    box_label *boxes = 0;
+    image_u8 im = load_image_u8(path);
+    pack_record r;
+    size_t path_bytes, size;
+    unsigned char *buf;
+
+    if(job->max_side > 0 && (im.w > job->max_side || im.h > job->max_side)){
+        int w = im.w >= im.h ? job->max_side : im.w*job->max_side/im.h;
+        int h = im.h >= im.w ? job->max_side : im.h*job->max_side/im.w;
+        image_u8 sized = resize_image_u8(im, w > 0 ? w : 1, h > 0 ? h : 1);
+        free_image_u8(im);
+        im = sized;
+    }
+    /* Classification sets have no label files, their labels come from the path. */
+    detection_label_path(path, labelpath);
+    if(access(labelpath, R_OK) == 0) boxes = read_boxes(labelpath, &count);
+
+    r.w = im.w;
+    r.h = im.h;
+    r.c = im.c;
+    r.boxes = count;
+    r.path_len = strlen(path) + 1;
+    path_bytes = pack_align(r.path_len, 4);
+    size = pack_align(sizeof(r) + path_bytes + count*sizeof(box_label) + (size_t)im.w*im.h*im.c, PACK_ALIGN);
+
+    buf = calloc(size, 1);
+    memcpy(buf, &r, sizeof(r));
+    memcpy(buf + sizeof(r), path, r.path_len);
+    if(count) memcpy(buf + sizeof(r) + path_bytes, boxes, count*sizeof(box_label));
+    memcpy(buf + sizeof(r) + path_bytes + count*sizeof(box_label), im.data, (size_t)im.w*im.h*im.c);
+    job->records[i] = buf;
+    job->sizes[i] = size;
+    free(boxes);
+    free_image_u8(im);
+}
+
+static void finish_shard(FILE *fp, uint64_t *offsets, int count, uint64_t end)
+{
+    pack_header h = {{0}};
+    memcpy(h.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    h.version = PACK_VERSION;
+    h.count = count;
+    h.index_offset = end;
+    fwrite(offsets, sizeof(uint64_t), count, fp);
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, fp);
+    fclose(fp);
+}
+
+void pack_dataset(char **paths, int n, char *out, int max_side, size_t shard_bytes)
+{
+    int chunk = 64*thread_pool_size();
+    int shard = 0;
+    int count = 0;
+    uint64_t offset = 0;
+    uint64_t *offsets = calloc(n, sizeof(uint64_t));
+    char buff[4096];
+    FILE *fp = 0;
+    FILE *list = fopen(out, "w");
+    pack_job job;
+    int i, j;
+    if(!list) file_error(out);
+
+    job.paths = paths;
+    job.max_side = max_side;
+    job.records = calloc(chunk, sizeof(unsigned char *));
+    job.sizes = calloc(chunk, sizeof(size_t));
+
+    for(i = 0; i < n; i += chunk){
+        int m = (n - i < chunk) ? n - i : chunk;
+        job.paths = paths + i;
+        parallel_for(m, encode_record, &job);
+        for(j = 0; j < m; ++j){
+            if(fp && offset + job.sizes[j] > shard_bytes && count > 0){
+                finish_shard(fp, offsets, count, offset);
+                fp = 0;
+            }
+            if(!fp){
+                sprintf(buff, "%s.%d", out, shard++);
+                fp = fopen(buff, "wb");
+                if(!fp) file_error(buff);
+                fprintf(list, "%s\n", buff);
+                offset = pack_align(sizeof(pack_header), PACK_ALIGN);
+                fseek(fp, offset, SEEK_SET);
+                count = 0;
+            }
+            fwrite(job.records[j], 1, job.sizes[j], fp);
+            offsets[count++] = offset;
+            offset += job.sizes[j];
+            free(job.records[j]);
+        }
+        fprintf(stderr, "Packed %d / %d\n", i + m, n);
+    }
+    if(fp) finish_shard(fp, offsets, count, offset);
+    fclose(list);
+    free(job.records);
+    free(job.sizes);
+    free(offsets);
+}
+
+packed_data *load_packed_data(char *filename)
+{
+    list *plist = get_paths(filename);
+    char **shards = (char **)list_to_array(plist);
+    packed_data *p = calloc(1, sizeof(packed_data));
+    int i, j, k = 0;
+
+    p->shards = plist->size;
+    p->maps = calloc(p->shards, sizeof(unsigned char *));
+    p->sizes = calloc(p->shards, sizeof(size_t));
+    for(i = 0; i < p->shards; ++i){
+        struct stat st;
+        pack_header *h;
+        int fd = open(shards[i], O_RDONLY);
+        if(fd < 0 || fstat(fd, &st) < 0) file_error(shards[i]);
+        if((size_t)st.st_size < sizeof(pack_header)) error("Not a packed dataset shard");
+        p->maps[i] = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(p->maps[i] == MAP_FAILED) file_error(shards[i]);
+        p->sizes[i] = st.st_size;
+        h = (pack_header *)p->maps[i];
+        if(memcmp(h->magic, PACK_MAGIC, sizeof(PACK_MAGIC))) error("Not a packed dataset shard");
+        if(h->version != PACK_VERSION){
+            fprintf(stderr, "%s: packed dataset version %d, this build reads version %d, pack it again\n", shards[i], h->version, PACK_VERSION);
+            exit(0);
+        }
+        if(h->index_offset + h->count*sizeof(uint64_t) > p->sizes[i]) error("Truncated packed dataset shard");
+        p->n += h->count;
+    }
+    p->records = calloc(p->n, sizeof(unsigned char *));
+    for(i = 0; i < p->shards; ++i){
+        pack_header *h = (pack_header *)p->maps[i];
+        uint64_t *offsets = (uint64_t *)(p->maps[i] + h->index_offset);
+        for(j = 0; j < h->count; ++j) p->records[k++] = p->maps[i] + offsets[j];
+    }
+    fprintf(stderr, "Packed data: %d images in %d shards\n", p->n, p->shards);
+    free_ptrs((void **)shards, plist->size);
+    free_list(plist);
+    return p;
+}
+
+void free_packed_data(packed_data *p)
+{
+    int i;
+    if(!p) return;
+    for(i = 0; i < p->shards; ++i) munmap(p->maps[i], p->sizes[i]);
+    free(p->maps);
+    free(p->sizes);
+    free(p->records);
+    free(p);
+}
+
+int packed_data_size(packed_data *p)
+{
+    return p->n;
+}
+
+char *packed_path(packed_data *p, int i)
+{
+    return (char *)(p->records[i] + sizeof(pack_record));
+}
+
+static unsigned char *packed_payload(packed_data *p, int i, pack_record *r)
+{
+    memcpy(r, p->records[i], sizeof(pack_record));
+    return p->records[i] + sizeof(pack_record) + pack_align(r->path_len, 4);
+}
+
+/* The boxes are copied, augmentation reorders and corrects them in place. */
+box_label *packed_boxes(packed_data *p, int i, int *n)
+{
+    pack_record r;
+    unsigned char *b = packed_payload(p, i, &r);
+    box_label *boxes = calloc(r.boxes ? r.boxes : 1, sizeof(box_label));
+    memcpy(boxes, b, r.boxes*sizeof(box_label));
+    *n = r.boxes;
+    return boxes;
+}
+
+/* Points into the read-only mapping: don't free or modify it. */
+image_u8 packed_image_u8(packed_data *p, int i)
+{
+    pack_record r;
+    image_u8 im;
+    im.data = packed_payload(p, i, &r) + r.boxes*sizeof(box_label);
+    im.w = r.w;
+    im.h = r.h;
+    im.c = r.c;
+    return im;
+}
@@ -2,6 +2,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "activation_layer.h"
 #include "activations.h"
@@ -23,6 +28,8 @@
 #include "normalization_layer.h"
 #include "option_list.h"
 #include "parser.h"
+#include "layer.h"
+#include "quantize.h"
 #include "region_layer.h"
 #include "reorg_layer.h"
 #include "rnn_layer.h"
@@ -39,6 +46,7 @@ typedef struct {
 } section;
 
 list *read_cfg(char *filename);
+static list *read_cfg_file(FILE *file);
 
 LAYER_TYPE string_to_layer_type(char *type) {
 
@@ -216,6 +224,11 @@ convolutional_layer parse_convolutional(list *options, size_params params) {
       batch_normalize, binary, xnor, params.net.adam);
   layer.flipped = option_find_int_quiet(options, "flipped", 0);
   layer.dot = option_find_float_quiet(options, "dot", 0);
+  char *algorithm = option_find(options, "algorithm");
+  if (algorithm) {
+    layer.autotune = 0;
+    set_conv_algorithm(&layer, get_conv_algorithm(algorithm));
+  }
 
   return layer;
 }
@@ -598,6 +611,8 @@ void parse_net_options(list *options, network *net) {
   int subdivs = option_find_int(options, "subdivisions", 1);
   net->time_steps = option_find_int_quiet(options, "time_steps", 1);
   net->notruth = option_find_int_quiet(options, "notruth", 0);
+  // Training batches the data loader keeps loading ahead.
+  net->prefetch = option_find_int_quiet(options, "prefetch", 2);
   net->batch /= subdivs;
   net->batch *= net->time_steps;
   net->subdivisions = subdivs;
@@ -674,8 +689,9 @@ int is_network(section *s) {
   return (strcmp(s->type, "[net]") == 0 || strcmp(s->type, "[network]") == 0);
 }
 
-network parse_network_cfg(char *filename) {
-  list *sections = read_cfg(filename);
+// With inference set, layers are built without the buffers only training
+// uses (see training_calloc). Frees the sections.
+static network parse_network_sections(list *sections, int inference) {
   node *n = sections->front;
   if (!n)
     error("Config file has no sections");
@@ -711,6 +727,9 @@ network parse_network_cfg(char *filename) {
     options = s->options;
     layer l = {0};
     LAYER_TYPE lt = string_to_layer_type(s->type);
+    // Recurrent layers drive their sublayers' deltas even in forward.
+    set_inference_only(inference && lt != RNN && lt != GRU && lt != LSTM &&
+                       lt != CRNN);
     if (lt == CONVOLUTIONAL) {
       l = parse_convolutional(options, params);
     } else if (lt == DECONVOLUTIONAL) {
@@ -789,6 +808,7 @@ network parse_network_cfg(char *filename) {
       params.inputs = l.outputs;
     }
   }
+  set_inference_only(0);
   free_list(sections);
   layer out = get_network_output_layer(net);
   net.outputs = out.outputs;
@@ -815,14 +835,33 @@ network parse_network_cfg(char *filename) {
 #else
     net.workspace = calloc(1, workspace_size);
 #endif
+    net.workspace_size = workspace_size;
   }
   return net;
 }
 
+network parse_network_cfg(char *filename) {
+  network net = parse_network_sections(read_cfg(filename), 0);
+  net.cfgfile = copy_string(filename);
+  return net;
+}
+
+network parse_network_cfg_inference(char *filename) {
+  network net = parse_network_sections(read_cfg(filename), 1);
+  net.cfgfile = copy_string(filename);
+  return net;
+}
+
 list *read_cfg(char *filename) {
   FILE *file = fopen(filename, "r");
   if (file == 0)
     file_error(filename);
+  list *sections = read_cfg_file(file);
+  fclose(file);
+  return sections;
+}
+
+static list *read_cfg_file(FILE *file) {
   char *line;
   int nu = 0;
   list *options = make_list();
@@ -851,7 +890,6 @@ list *read_cfg(char *filename) {
       break;
     }
   }
-  fclose(file);
   return options;
 }
 
@@ -935,6 +973,36 @@ void save_connected_weights(layer l, FILE *fp) {
   }
 }
 
+// Quantized records share one layout for convolutional and connected layers:
+// biases, batchnorm parameters, calibrated input range, per-channel weight
+// scales, then the int8 weights row by row.
+void save_quantized_weights(layer l, FILE *fp) {
+#ifdef GPU
+  if (gpu_index >= 0) {
+    if (l.type == CONVOLUTIONAL)
+      pull_convolutional_layer(l);
+    else
+      pull_connected_layer(l);
+  }
+#endif
+  int rows = quantized_rows(l);
+  int k = quantized_cols(l);
+  int lda = quantized_lda(l);
+  int i;
+  fwrite(l.biases, sizeof(float), rows, fp);
+  if (l.batch_normalize) {
+    fwrite(l.scales, sizeof(float), rows, fp);
+    fwrite(l.rolling_mean, sizeof(float), rows, fp);
+    fwrite(l.rolling_variance, sizeof(float), rows, fp);
+  }
+  fwrite(&l.qinput_min, sizeof(float), 1, fp);
+  fwrite(&l.qinput_max, sizeof(float), 1, fp);
+  fwrite(l.qweight_scales, sizeof(float), rows, fp);
+  for (i = 0; i < rows; ++i) {
+    fwrite(l.qweights + (size_t)i * lda, sizeof(int8_t), k, fp);
+  }
+}
+
 void save_weights_upto(network net, char *filename, int cutoff) {
 #ifdef GPU
   if (net.gpu_index >= 0) {
@@ -946,17 +1014,33 @@ void save_weights_upto(network net, char *filename, int cutoff) {
   if (!fp)
     file_error(filename);
 
+  // Version 0.3 files prefix every convolutional and connected record with a
+  // flag saying whether it is stored quantized.
+  int i;
+  int quantized = 0;
+  for (i = 0; i < net.n && i < cutoff; ++i) {
+    if (net.layers[i].qweights)
+      quantized = 1;
+  }
+
   int major = 0;
-  int minor = 2;
+  int minor = quantized ? 3 : 2;
   int revision = 0;
   fwrite(&major, sizeof(int), 1, fp);
   fwrite(&minor, sizeof(int), 1, fp);
   fwrite(&revision, sizeof(int), 1, fp);
   fwrite(net.seen, sizeof(size_t), 1, fp);
 
-  int i;
   for (i = 0; i < net.n && i < cutoff; ++i) {
     layer l = net.layers[i];
+    if (quantized && (l.type == CONVOLUTIONAL || l.type == CONNECTED)) {
+      int q = l.qweights != 0;
+      fwrite(&q, sizeof(int), 1, fp);
+      if (q) {
+        save_quantized_weights(l, fp);
+        continue;
+      }
+    }
     if (l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL) {
       save_convolutional_weights(l, fp);
     }
@@ -1143,6 +1227,8 @@ void load_convolutional_weights(layer l, FILE *fp) {
   if (l.flipped) {
     transpose_matrix(l.weights, l.c * l.size * l.size, l.n);
   }
+  update_winograd_weights(l);
+  update_xnor_weights(l);
 // if (l.binary) binarize_weights(l.weights, l.n, l.c*l.size*l.size, l.weights);
 #ifdef GPU
   if (gpu_index >= 0) {
@@ -1151,6 +1237,39 @@ void load_convolutional_weights(layer l, FILE *fp) {
 #endif
 }
 
+void load_quantized_weights(layer *l, FILE *fp) {
+  int rows = quantized_rows(*l);
+  int k = quantized_cols(*l);
+  int lda;
+  int i;
+  make_quantized_layer(l);
+  lda = quantized_lda(*l);
+  fread(l->biases, sizeof(float), rows, fp);
+  if (l->batch_normalize) {
+    fread(l->scales, sizeof(float), rows, fp);
+    fread(l->rolling_mean, sizeof(float), rows, fp);
+    fread(l->rolling_variance, sizeof(float), rows, fp);
+  }
+  fread(&l->qinput_min, sizeof(float), 1, fp);
+  fread(&l->qinput_max, sizeof(float), 1, fp);
+  fread(l->qweight_scales, sizeof(float), rows, fp);
+  for (i = 0; i < rows; ++i) {
+    fread(l->qweights + (size_t)i * lda, sizeof(int8_t), k, fp);
+  }
+  // Keep the float weights in step so training and GPU inference still work.
+  dequantize_weights(*l);
+  if (l->type == CONVOLUTIONAL)
+    update_winograd_weights(*l);
+#ifdef GPU
+  if (gpu_index >= 0) {
+    if (l->type == CONVOLUTIONAL)
+      push_convolutional_layer(*l);
+    else
+      push_connected_layer(*l);
+  }
+#endif
+}
+
 void load_weights_upto(network *net, char *filename, int start, int cutoff) {
 #ifdef GPU
   if (net->gpu_index >= 0) {
@@ -1177,12 +1296,22 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff) {
     *net->seen = iseen;
   }
   int transpose = (major > 1000) || (minor > 1000);
+  // Only the 0.x series written by save_weights_upto carries the flags.
+  int quantized = !transpose && major == 0 && minor >= 3;
 
   int i;
   for (i = start; i < net->n && i < cutoff; ++i) {
     layer l = net->layers[i];
     if (l.dontload)
       continue;
+    if (quantized && (l.type == CONVOLUTIONAL || l.type == CONNECTED)) {
+      int q = 0;
+      fread(&q, sizeof(int), 1, fp);
+      if (q) {
+        load_quantized_weights(net->layers + i, fp);
+        continue;
+      }
+    }
     if (l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL) {
       load_convolutional_weights(l, fp);
     }
@@ -1238,6 +1367,8 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff) {
 #endif
     }
   }
+  if (quantized)
+    update_quantized_network(net);
   fprintf(stderr, "Done!\n");
   fclose(fp);
 }
@@ -1245,3 +1376,368 @@ void load_weights_upto(network *net, char *filename, int start, int cutoff) {
 void load_weights(network *net, char *filename) {
   load_weights_upto(net, filename, 0, net->n);
 }
+
+// Weights for a network that will only run inference: batchnorm is folded
+// into the convolutions and shortcuts into the convolutions before them.
+void load_weights_inference(network *net, char *filename) {
+  load_weights(net, filename);
+  fuse_batchnorm_network(net);
+  fuse_shortcut_network(net);
+  plan_network_memory(net);
+}
+
+// Compiled models hold a network ready for inference in one file: a header,
+// the cfg text with fused batchnorm switched off, then every parameter blob
+// 64-byte aligned in the order layer_param_blobs lists them. The loader maps
+// the file and points the layers' parameters straight into the mapping, so
+// processes serving the same model share one copy through the page cache.
+// Blobs are stored in the host's byte order.
+
+#define COMPILED_MAGIC "DNMODEL"
+#define COMPILED_VERSION 1
+#define COMPILED_ALIGN 64
+
+typedef struct {
+  char magic[8];
+  int32_t version;
+  int32_t layers;
+  uint64_t seen;
+  uint64_t cfg_offset;
+  uint64_t cfg_size;
+  uint64_t data_offset;
+  uint64_t data_size;
+} compiled_header;
+
+static size_t compiled_align(size_t offset) {
+  return (offset + COMPILED_ALIGN - 1) / COMPILED_ALIGN * COMPILED_ALIGN;
+}
+
+static int can_compile_layer(layer l) {
+  return l.type != RNN && l.type != GRU && l.type != LSTM && l.type != CRNN &&
+         !l.qweights;
+}
+
+static void write_compiled_section(FILE *fp, section *s, layer *l) {
+  node *n;
+  fprintf(fp, "%s\n", s->type);
+  for (n = s->options->front; n; n = n->next) {
+    kvp *p = (kvp *)n->val;
+    // Loaded weights are already transposed and batchnorm already folded.
+    if (l && strcmp(p->key, "flipped") == 0)
+      continue;
+    if (l && strcmp(p->key, "batch_normalize") == 0 && !l->batch_normalize)
+      fprintf(fp, "%s=0\n", p->key);
+    else
+      fprintf(fp, "%s=%s\n", p->key, p->val);
+  }
+  fprintf(fp, "\n");
+}
+
+static void write_padding(FILE *fp, size_t offset) {
+  static char zeros[COMPILED_ALIGN];
+  size_t pad = compiled_align(offset) - offset;
+  if (pad)
+    fwrite(zeros, 1, pad, fp);
+}
+
+// net must have been built from cfgfile and, to be compiled for inference,
+// have its weights loaded and batchnorm fused (see fuse_batchnorm_network).
+void save_compiled_network(network net, char *cfgfile, char *filename) {
+  list *sections = read_cfg(cfgfile);
+  compiled_header h = {COMPILED_MAGIC};
+  param_blob b[MAX_PARAM_BLOBS];
+  node *n;
+  int i, j;
+  if (sections->size != net.n + 1)
+    error("Network does not match its cfg");
+  for (i = 0; i < net.n; ++i) {
+    if (!can_compile_layer(net.layers[i])) {
+      fprintf(stderr, "Layer %d (%s) can't be compiled\n", i,
+              get_layer_string(net.layers[i].type));
+      error("Compiled models support feed-forward float layers only");
+    }
+  }
+  fprintf(stderr, "Saving compiled network to %s\n", filename);
+  FILE *fp = fopen(filename, "wb");
+  if (!fp)
+    file_error(filename);
+
+  h.version = COMPILED_VERSION;
+  h.layers = net.n;
+  h.seen = *net.seen;
+  h.cfg_offset = sizeof(h);
+  fseek(fp, h.cfg_offset, SEEK_SET);
+  for (n = sections->front, i = -1; n; n = n->next, ++i) {
+    write_compiled_section(fp, (section *)n->val, i < 0 ? 0 : net.layers + i);
+  }
+  h.cfg_size = ftell(fp) - h.cfg_offset;
+  h.data_offset = compiled_align(ftell(fp));
+  write_padding(fp, ftell(fp));
+
+  for (i = 0; i < net.n; ++i) {
+    layer l = net.layers[i];
+#ifdef GPU
+    if (gpu_index >= 0) {
+      if (l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL)
+        pull_convolutional_layer(l);
+      if (l.type == CONNECTED)
+        pull_connected_layer(l);
+      if (l.type == BATCHNORM)
+        pull_batchnorm_layer(l);
+      if (l.type == LOCAL)
+        pull_local_layer(l);
+    }
+#endif
+    int blobs = layer_param_blobs(&l, b);
+    for (j = 0; j < blobs; ++j) {
+      fwrite(*b[j].data, sizeof(float), b[j].n, fp);
+      write_padding(fp, ftell(fp));
+    }
+  }
+  h.data_size = ftell(fp) - h.data_offset;
+  fseek(fp, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, fp);
+  fclose(fp);
+
+  for (n = sections->front; n; n = n->next) {
+    free_section((section *)n->val);
+  }
+  free_list(sections);
+}
+
+static int read_compiled_header(FILE *fp, compiled_header *h) {
+  return fread(h, sizeof(*h), 1, fp) == 1 &&
+         memcmp(h->magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) == 0;
+}
+
+int is_compiled_network(char *filename) {
+  compiled_header h;
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return 0;
+  int compiled = read_compiled_header(fp, &h);
+  fclose(fp);
+  return compiled;
+}
+
+static list *read_compiled_cfg(char *map) {
+  compiled_header h;
+  memcpy(&h, map, sizeof(h));
+  FILE *cfg = fmemopen(map + h.cfg_offset, h.cfg_size, "r");
+  if (!cfg)
+    error("Can't read compiled model cfg");
+  list *sections = read_cfg_file(cfg);
+  fclose(cfg);
+  return sections;
+}
+
+#ifdef GPU
+static void push_layer_params(layer l) {
+  if (gpu_index < 0)
+    return;
+  if (l.type == CONVOLUTIONAL || l.type == DECONVOLUTIONAL)
+    push_convolutional_layer(l);
+  if (l.type == CONNECTED)
+    push_connected_layer(l);
+  if (l.type == BATCHNORM)
+    push_batchnorm_layer(l);
+  if (l.type == LOCAL)
+    push_local_layer(l);
+}
+#endif
+
+// The mapping is private and writable, so pages stay shared until someone
+// writes to them. free_network unmaps it.
+network load_compiled_network(char *filename) {
+  compiled_header h;
+  param_blob b[MAX_PARAM_BLOBS];
+  struct stat st;
+  int i, j;
+  size_t offset = 0;
+  fprintf(stderr, "Loading compiled network from %s\n", filename);
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0)
+    file_error(filename);
+  char *map = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    file_error(filename);
+  if ((size_t)st.st_size < sizeof(h))
+    error("Not a compiled model");
+  memcpy(&h, map, sizeof(h));
+  if (memcmp(h.magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) != 0)
+    error("Not a compiled model");
+  if (h.version != COMPILED_VERSION)
+    error("Unsupported compiled model version");
+  if (h.cfg_offset + h.cfg_size > (uint64_t)st.st_size ||
+      h.data_offset % COMPILED_ALIGN ||
+      h.data_offset + h.data_size > (uint64_t)st.st_size)
+    error("Compiled model is truncated");
+
+  set_external_weights(1);
+  network net = parse_network_sections(read_compiled_cfg(map), 1);
+  set_external_weights(0);
+  if (net.n != h.layers)
+    error("Compiled model does not match its architecture");
+  *net.seen = h.seen;
+
+  float *data = (float *)(map + h.data_offset);
+  size_t workspace_size = net.workspace_size;
+  for (i = 0; i < net.n; ++i) {
+    layer *l = net.layers + i;
+    if (!can_compile_layer(*l))
+      error("Compiled model does not match its architecture");
+    int blobs = layer_param_blobs(l, b);
+    for (j = 0; j < blobs; ++j) {
+      if (offset + b[j].n * sizeof(float) > h.data_size)
+        error("Compiled model does not match its architecture");
+      free(*b[j].data);
+      *b[j].data = data + offset / sizeof(float);
+      offset = compiled_align(offset + b[j].n * sizeof(float));
+    }
+    if (l->type == CONVOLUTIONAL) {
+      // Winograd was picked before there were weights to check it with.
+      if (l->algorithm == CONV_WINOGRAD)
+        set_conv_algorithm(l, CONV_WINOGRAD);
+      update_xnor_weights(*l);
+      if (l->workspace_size > workspace_size)
+        workspace_size = l->workspace_size;
+    }
+#ifdef GPU
+    push_layer_params(*l);
+#endif
+  }
+  if (offset != h.data_size)
+    error("Compiled model does not match its architecture");
+  if (workspace_size > net.workspace_size) {
+    free(net.workspace);
+    net.workspace = calloc(1, workspace_size);
+    net.workspace_size = workspace_size;
+  }
+  net.mapping = map;
+  net.mapping_size = st.st_size;
+  fuse_shortcut_network(&net);
+  plan_network_memory(&net);
+  return net;
+}
+
+// Points l's parameters, int8 weights and the transformed Winograd and xnor
+// filters at s's, first folding away the batchnorm s has already folded into
+// its weights. l runs s's algorithm; s is tuned already.
+static void share_layer_params(layer *l, layer s) {
+  param_blob b[MAX_PARAM_BLOBS], sb[MAX_PARAM_BLOBS];
+  int i;
+  if (l->batch_normalize && !s.batch_normalize) {
+    free(l->scales);
+    free(l->rolling_mean);
+    free(l->rolling_variance);
+    l->scales = l->rolling_mean = l->rolling_variance = 0;
+    l->batch_normalize = 0;
+  }
+  int blobs = layer_param_blobs(l, b);
+  if (blobs != layer_param_blobs(&s, sb))
+    error("Clone does not match the network");
+  for (i = 0; i < blobs; ++i) {
+    free(*b[i].data);
+    *b[i].data = *sb[i].data;
+  }
+  if (s.qweights) {
+    free(l->qweights);
+    free(l->qweight_scales);
+    free(l->qscales);
+    free(l->qbiases);
+    l->qweights = s.qweights;
+    l->qweight_scales = s.qweight_scales;
+    l->qscales = s.qscales;
+    l->qbiases = s.qbiases;
+    l->qinput_min = s.qinput_min;
+    l->qinput_max = s.qinput_max;
+    l->qinput_scale = s.qinput_scale;
+    l->qinput_zero = s.qinput_zero;
+  }
+  if (l->type == CONVOLUTIONAL) {
+    free(l->winograd_weights);
+    free(l->xnor_weights);
+    free(l->xnor_scales);
+    l->winograd_weights = s.winograd_weights;
+    l->xnor_weights = s.xnor_weights;
+    l->xnor_scales = s.xnor_scales;
+    l->algorithm = s.algorithm;
+    l->autotune = 0;
+    l->workspace_size = s.workspace_size;
+  }
+  if (s.workspace_size > l->workspace_size)
+    l->workspace_size = s.workspace_size;
+  l->fused = s.fused;
+  l->fused_shortcut = s.fused_shortcut;
+#ifdef GPU
+  push_layer_params(*l);
+#endif
+}
+
+// A second instance of net for inference on another thread. Every clone
+// gets its own outputs, workspace and input, but points at net's weights,
+// biases and batchnorm parameters, so net must outlive its clones. The
+// clone is rebuilt from net's cfg (or compiled model) and takes net's
+// batch, size, fusions, convolution algorithms and memory plan. net is
+// autotuned first if it has not run yet, since retuning would free filters
+// its clones use.
+network clone_network_inference(network net) {
+  list *sections = 0;
+  size_t workspace_size = 0;
+  int planned = 0;
+  int untuned = 0;
+  int i;
+  for (i = 0; i < net.n; ++i) {
+    LAYER_TYPE t = net.layers[i].type;
+    if (t == RNN || t == GRU || t == LSTM || t == CRNN)
+      error("Networks with recurrent layers can't be cloned");
+    planned |= net.layers[i].shared_output;
+    untuned |= net.layers[i].autotune == 1;
+  }
+  if (untuned) {
+    float *input = calloc((size_t)net.inputs * net.batch, sizeof(float));
+    network_predict(net, input);
+    free(input);
+  }
+  if (net.mapping)
+    sections = read_compiled_cfg(net.mapping);
+  else if (net.cfgfile)
+    sections = read_cfg(net.cfgfile);
+  else
+    error("Only networks parsed from a cfg can be cloned");
+
+  set_external_weights(1);
+  network c = parse_network_sections(sections, 1);
+  set_external_weights(0);
+  if (c.n != net.n)
+    error("Clone does not match the network");
+  c.cfgfile = net.cfgfile ? copy_string(net.cfgfile) : 0;
+  c.shared_weights = 1;
+  *c.seen = *net.seen;
+  if (c.batch != net.batch) {
+    if (net.batch > c.batch)
+      error("Clone the network before growing its batch");
+    set_batch_network(&c, net.batch);
+  }
+  if (c.w != net.w || c.h != net.h)
+    resize_network(&c, net.w, net.h);
+
+  for (i = 0; i < c.n; ++i) {
+    share_layer_params(c.layers + i, net.layers[i]);
+    if (c.layers[i].workspace_size > workspace_size)
+      workspace_size = c.layers[i].workspace_size;
+  }
+#ifdef GPU
+  if (gpu_index < 0) {
+#endif
+    free(c.workspace);
+    c.workspace = workspace_size ? calloc(1, workspace_size) : 0;
+    c.workspace_size = workspace_size;
+#ifdef GPU
+  }
+#endif
+  if (planned)
+    replan_network_memory(&c);
+  return c;
+}
@@ -0,0 +1,200 @@
+#include "profiler.h"
+#include "network.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Per-layer profile of the CPU forward, backward and update passes. The
+ * network loops time each l.forward/l.backward/l.update call with the
+ * monotonic clock and hand it to profile_layer, which accumulates it per
+ * layer and phase and keeps it as a Chrome trace event (open the trace in
+ * chrome://tracing or ui.perfetto.dev). FLOPs and bytes are estimated from
+ * the layer geometry: multiply-adds count as two FLOPs, and bytes are the
+ * activations, deltas and parameters the pass reads or writes once each.
+ */
+
+/* Enough for a few thousand training iterations of a large network. */
+#define PROFILE_MAX_EVENTS (1 << 20)
+
+typedef struct{
+    int layer;
+    PROFILE_PHASE phase;
+    double start;
+    double duration;
+} profile_event;
+
+struct profiler{
+    int n;
+    int *calls[PROFILE_PHASES];
+    double *time[PROFILE_PHASES];
+    profile_event *events;
+    int nevents;
+    double origin;
+};
+
+static char *phase_names[PROFILE_PHASES] = {"forward", "backward", "update"};
+
+double profile_clock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+profiler *make_profiler(network net)
+{
+    int i;
+    profiler *p = calloc(1, sizeof(profiler));
+    p->n = net.n;
+    for(i = 0; i < PROFILE_PHASES; ++i){
+        p->calls[i] = calloc(net.n, sizeof(int));
+        p->time[i] = calloc(net.n, sizeof(double));
+    }
+    p->events = calloc(PROFILE_MAX_EVENTS, sizeof(profile_event));
+    p->origin = profile_clock();
+#ifdef GPU
+    if(gpu_index >= 0) fprintf(stderr, "Profiling only times layers run on the CPU\n");
+#endif
+    return p;
+}
+
+void free_profiler(profiler *p)
+{
+    int i;
+    if(!p) return;
+    for(i = 0; i < PROFILE_PHASES; ++i){
+        free(p->calls[i]);
+        free(p->time[i]);
+    }
+    free(p->events);
+    free(p);
+}
+
+void profile_layer(profiler *p, int index, PROFILE_PHASE phase, double start)
+{
+    double t = profile_clock() - start;
+    p->calls[phase][index] += 1;
+    p->time[phase][index] += t;
+    if(p->nevents < PROFILE_MAX_EVENTS){
+        profile_event *e = p->events + p->nevents++;
+        e->layer = index;
+        e->phase = phase;
+        e->start = start - p->origin;
+        e->duration = t;
+    }
+}
+
+static double layer_weights(layer l)
+{
+    switch(l.type){
+        case CONVOLUTIONAL:
+        case DECONVOLUTIONAL:
+            return (double)l.c/l.groups*l.n*l.size*l.size;
+        case CONNECTED:
+            return (double)l.inputs*l.outputs;
+        case LOCAL:
+            return (double)l.c*l.n*l.size*l.size*l.out_h*l.out_w;
+        default:
+            return 0;
+    }
+}
+
+double layer_flops(layer l, PROFILE_PHASE phase)
+{
+    double macs = 0;
+    double elements = (double)l.outputs*l.batch;
+    switch(l.type){
+        case CONVOLUTIONAL:
+            macs = layer_weights(l)*l.out_h*l.out_w*l.batch;
+            break;
+        case DECONVOLUTIONAL:
+            macs = layer_weights(l)*l.h*l.w*l.batch;
+            break;
+        case CONNECTED:
+            macs = layer_weights(l)*l.batch;
+            break;
+        case LOCAL:
+            macs = layer_weights(l)*l.batch;
+            break;
+        case MAXPOOL:
+            elements *= l.size*l.size;
+            break;
+        case AVGPOOL:
+            elements = (double)l.inputs*l.batch;
+            break;
+        default:
+            break;
+    }
+    if(phase == PROFILE_UPDATE) return 4*layer_weights(l);
+    /* Backward computes both the weight gradient and the input delta. */
+    if(macs) return (phase == PROFILE_BACKWARD ? 4 : 2)*macs;
+    return elements;
+}
+
+double layer_bytes(layer l, PROFILE_PHASE phase)
+{
+    double in = (double)l.inputs*l.batch;
+    double out = (double)l.outputs*l.batch;
+    double w = layer_weights(l);
+    if(phase == PROFILE_FORWARD) return sizeof(float)*(in + out + w);
+    if(phase == PROFILE_BACKWARD) return sizeof(float)*(2*in + out + 2*w);
+    return sizeof(float)*4*w;
+}
+
+void print_profile(network net)
+{
+    int i, j;
+    profiler *p = net.prof;
+    double total = 0;
+    double phase_total[PROFILE_PHASES] = {0};
+    if(!p) return;
+    for(j = 0; j < PROFILE_PHASES; ++j){
+        for(i = 0; i < p->n; ++i) phase_total[j] += p->time[j][i];
+        total += phase_total[j];
+    }
+    if(total == 0) return;
+
+    fprintf(stderr, "\nlayer                      %-9s calls    avg ms     GFLOP  GFLOP/s       MB    GB/s  time%%\n", "phase");
+    for(i = 0; i < p->n; ++i){
+        layer l = net.layers[i];
+        for(j = 0; j < PROFILE_PHASES; ++j){
+            double avg;
+            int calls = p->calls[j][i];
+            if(!calls) continue;
+            avg = p->time[j][i]/calls;
+            fprintf(stderr, "%4d %-21.21s %-9s %6d %9.3f %9.3f %8.2f %8.2f %7.2f %6.2f\n", i,
+                    get_layer_string(l.type), phase_names[j], calls, avg*1000,
+                    layer_flops(l, j)/1e9, avg > 0 ? layer_flops(l, j)/avg/1e9 : 0,
+                    layer_bytes(l, j)/1048576., avg > 0 ? layer_bytes(l, j)/avg/1e9 : 0,
+                    100*p->time[j][i]/total);
+        }
+    }
+    for(j = 0; j < PROFILE_PHASES; ++j){
+        if(phase_total[j] > 0) fprintf(stderr, "total %-9s %.3f s\n", phase_names[j], phase_total[j]);
+    }
+}
+
+void save_profile_trace(network net, char *filename)
+{
+    int i;
+    profiler *p = net.prof;
+    FILE *fp;
+    if(!p) return;
+    fp = fopen(filename, "w");
+    if(!fp) file_error(filename);
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for(i = 0; i < p->nevents; ++i){
+        profile_event e = p->events[i];
+        layer l = net.layers[e.layer];
+        fprintf(fp, "{\"name\":\"%d %s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0,"
+                "\"args\":{\"layer\":%d,\"flops\":%.0f,\"bytes\":%.0f}}%s\n",
+                e.layer, get_layer_string(l.type), phase_names[e.phase], e.start*1e6, e.duration*1e6,
+                e.layer, layer_flops(l, e.phase), layer_bytes(l, e.phase), i + 1 < p->nevents ? "," : "");
+    }
+    fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(fp);
+    fprintf(stderr, "Saved %d trace events to %s\n", p->nevents, filename);
+}
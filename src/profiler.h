@@ -0,0 +1,15 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "darknet.h"
+
+typedef enum{
+    PROFILE_FORWARD, PROFILE_BACKWARD, PROFILE_UPDATE, PROFILE_PHASES
+} PROFILE_PHASE;
+
+double profile_clock();
+void profile_layer(profiler *p, int index, PROFILE_PHASE phase, double start);
+double layer_flops(layer l, PROFILE_PHASE phase);
+double layer_bytes(layer l, PROFILE_PHASE phase);
+
+#endif
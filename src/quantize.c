@@ -0,0 +1,209 @@
+#include "quantize.h"
+#include "convolutional_layer.h"
+#include "gemm.h"
+#include "image.h"
+#include "network.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Post-training int8 quantization. Weights are symmetric int8 with one scale
+ * per output channel; layer inputs are asymmetric unsigned codes with a single
+ * scale and zero point spanning the calibrated range. Only the range is
+ * stored: the number of codes depends on the kernels (255 with VNNI, 127 with
+ * pmaddubsw), so scale and zero point are derived at load time. For input
+ * x = s*(u - z) and weight w = s_w*q the layer computes
+ *
+ *     act(a*(sum q*u) + b),  a = s*s_w*norm,  b = bias - norm*mean - a*z*sum q
+ *
+ * where norm and mean fold in batch normalization, so requantization, bias
+ * and batchnorm all collapse into the per-channel qscales/qbiases that the
+ * int8 GEMM applies when it stores a tile.
+ */
+
+int can_quantize_layer(layer l)
+{
+    if(l.type == CONNECTED) return 1;
+    /* Depthwise layers always run the direct float kernel. */
+    return l.type == CONVOLUTIONAL && !l.binary && !l.xnor && !is_depthwise_convolutional(l);
+}
+
+int quantized_rows(layer l)
+{
+    return l.type == CONNECTED ? l.outputs : l.n;
+}
+
+int quantized_cols(layer l)
+{
+    return l.type == CONNECTED ? l.inputs : l.size*l.size*l.c/l.groups;
+}
+
+int quantized_lda(layer l)
+{
+    return (quantized_cols(l) + 3)/4*4;
+}
+
+void make_quantized_layer(layer *l)
+{
+    int rows = quantized_rows(*l) + GEMM_INT8_MR;
+    if(l->qweights) return;
+    l->qweights = calloc((size_t)rows*quantized_lda(*l), sizeof(int8_t));
+    l->qweight_scales = calloc(rows, sizeof(float));
+    l->qscales = calloc(rows, sizeof(float));
+    l->qbiases = calloc(rows, sizeof(float));
+}
+
+void quantize_weights(layer *l)
+{
+    int rows = quantized_rows(*l);
+    int k = quantized_cols(*l);
+    int lda = quantized_lda(*l);
+    int i, j;
+    make_quantized_layer(l);
+    for(i = 0; i < rows; ++i){
+        float *w = l->weights + (size_t)i*k;
+        int8_t *q = l->qweights + (size_t)i*lda;
+        float max = 0;
+        for(j = 0; j < k; ++j){
+            if(fabs(w[j]) > max) max = fabs(w[j]);
+        }
+        l->qweight_scales[i] = (max > 0) ? max/127 : 1;
+        for(j = 0; j < k; ++j){
+            q[j] = constrain_int(lrintf(w[j]/l->qweight_scales[i]), -127, 127);
+        }
+    }
+}
+
+void dequantize_weights(layer l)
+{
+    int rows = quantized_rows(l);
+    int k = quantized_cols(l);
+    int lda = quantized_lda(l);
+    int i, j;
+    for(i = 0; i < rows; ++i){
+        for(j = 0; j < k; ++j){
+            l.weights[(size_t)i*k + j] = l.qweight_scales[i]*l.qweights[(size_t)i*lda + j];
+        }
+    }
+}
+
+void set_quantized_input_range(layer *l, float min, float max)
+{
+    l->qinput_min = (min < 0) ? min : 0;
+    l->qinput_max = (max > 0) ? max : 0;
+}
+
+void quantize_activations(float *x, int n, float scale, int zero, uint8_t *q)
+{
+    float inv = 1./scale;
+    float top = gemm_int8_input_max();
+    int i;
+    for(i = 0; i < n; ++i){
+        float v = x[i]*inv + zero;
+        v = (v < 0) ? 0 : (v > top) ? top : v;
+        q[i] = (uint8_t)(v + .5f);
+    }
+}
+
+/* Room for one quantized input image plus its 8-bit im2col matrix. */
+size_t get_quantized_workspace_size(layer l)
+{
+    if(l.type == CONNECTED) return l.inputs;
+    return (size_t)l.inputs + (size_t)quantized_cols(l)*l.out_h*l.out_w;
+}
+
+static void prepare_quantized_layer(layer *l)
+{
+    int rows = quantized_rows(*l);
+    int k = quantized_cols(*l);
+    int lda = quantized_lda(*l);
+    int top = gemm_int8_input_max();
+    int i, j;
+    float range = l->qinput_max - l->qinput_min;
+    l->qinput_scale = (range > 0) ? range/top : 1;
+    l->qinput_zero = constrain_int(lrintf(-l->qinput_min/l->qinput_scale), 0, top);
+    for(i = 0; i < rows; ++i){
+        int8_t *q = l->qweights + (size_t)i*lda;
+        float scale = l->qinput_scale*l->qweight_scales[i];
+        float bias = l->biases[i];
+        int sum = 0;
+        for(j = 0; j < k; ++j) sum += q[j];
+        if(l->batch_normalize){
+            float norm = l->scales[i]/(sqrt(l->rolling_variance[i]) + .000001f);
+            scale *= norm;
+            bias -= norm*l->rolling_mean[i];
+        }
+        l->qscales[i] = scale;
+        l->qbiases[i] = bias - scale*l->qinput_zero*sum;
+    }
+}
+
+/* Rebuild the fused epilogues and grow the shared workspace to fit the
+ * 8-bit buffers. Call after quantized weights are loaded or recomputed. */
+void update_quantized_network(network *net)
+{
+    size_t workspace_size = 0;
+    int quantized = 0;
+    int i;
+    for(i = 0; i < net->n; ++i){
+        layer *l = net->layers + i;
+        if(l->qweights){
+            size_t s = get_quantized_workspace_size(*l);
+            prepare_quantized_layer(l);
+            if(s > l->workspace_size) l->workspace_size = s;
+            quantized = 1;
+        }
+        if(l->workspace_size > workspace_size) workspace_size = l->workspace_size;
+    }
+    if(!quantized) return;
+#ifdef GPU
+    if(gpu_index >= 0) return;
+#endif
+    free(net->workspace);
+    net->workspace = calloc(1, workspace_size);
+    net->workspace_size = workspace_size;
+}
+
+void quantize_network(network *net, char **paths, int n)
+{
+    float *min = calloc(net->n, sizeof(float));
+    float *max = calloc(net->n, sizeof(float));
+    int i, j, k;
+    if(n <= 0) error("Quantization needs at least one calibration image");
+    set_batch_network(net, 1);
+    for(i = 0; i < n; ++i){
+        image im = load_image_color(paths[i], 0, 0);
+        image sized = letterbox_image(im, net->w, net->h);
+        network_predict(*net, sized.data);
+        for(j = 0; j < net->n; ++j){
+            layer l = net->layers[j];
+            float *input = j ? net->layers[j-1].output : sized.data;
+            if(!can_quantize_layer(l)) continue;
+            for(k = 0; k < l.inputs; ++k){
+                if(input[k] < min[j]) min[j] = input[k];
+                if(input[k] > max[j]) max[j] = input[k];
+            }
+        }
+        free_image(im);
+        free_image(sized);
+        if(i % 10 == 9 || i == n - 1) fprintf(stderr, "Calibrated %d/%d\n", i + 1, n);
+    }
+    for(j = 0; j < net->n; ++j){
+        layer *l = net->layers + j;
+        if(!can_quantize_layer(*l)) continue;
+        quantize_weights(l);
+        set_quantized_input_range(l, min[j], max[j]);
+    }
+    update_quantized_network(net);
+    for(j = 0; j < net->n; ++j){
+        layer l = net->layers[j];
+        if(!l.qweights) continue;
+        fprintf(stderr, "%5d input range [%10.4f, %10.4f], scale %g, zero point %3d\n", j, l.qinput_min, l.qinput_max, l.qinput_scale, l.qinput_zero);
+    }
+    free(min);
+    free(max);
+}
@@ -0,0 +1,20 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stdint.h>
+#include "darknet.h"
+
+int can_quantize_layer(layer l);
+int quantized_rows(layer l);
+int quantized_cols(layer l);
+int quantized_lda(layer l);
+
+void make_quantized_layer(layer *l);
+void quantize_weights(layer *l);
+void dequantize_weights(layer l);
+void set_quantized_input_range(layer *l, float min, float max);
+void quantize_activations(float *x, int n, float scale, int zero, uint8_t *q);
+size_t get_quantized_workspace_size(layer l);
+void update_quantized_network(network *net);
+
+#endif
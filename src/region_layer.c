@@ -4,11 +4,14 @@
 #include "box.h"
 #include "cuda.h"
 #include "utils.h"
+#include "tree.h"
 
 #include <stdio.h>
 #include <assert.h>
+#include <float.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 layer make_region_layer(int batch, int w, int h, int n, int classes, int coords)
 {
@@ -151,32 +154,200 @@ int entry_index(layer l, int batch, int location, int entry)
     return batch*l.outputs + n*l.w*l.h*(l.coords+l.classes+1) + entry*l.w*l.h + loc;
 }
 
-void forward_region_layer(const layer l, network net)
+/*
+ * Region activation in one pass. An anchor's outputs are coords + 1 +
+ * classes planes of w*h floats. Instead of sweeping each plane with expf
+ * and then walking every location's classes at a stride of w*h, a block
+ * of REGION_TILE locations goes through all of the anchor's channels at
+ * once: logistic on x, y and objectness, softmax over the classes or over
+ * each group of the tree. The AVX2 kernel keeps one location per lane, so
+ * the channel loops are plain vector loads, and uses a polynomial exp
+ * accurate to a couple of ulp.
+ */
+
+#define REGION_TILE 64
+
+typedef void (*region_block_fn)(const layer *l, float *in, float *out, int count);
+
+typedef struct{
+    const layer *l;
+    float *in;
+    float *out;
+    region_block_fn block;
+    int tiles;
+} region_job;
+
+static void region_block_scalar(const layer *l, float *in, float *out, int count)
 {
-    int i,j,b,t,n;
-    memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
-
-#ifndef GPU
-    for (b = 0; b < l.batch; ++b){
-        for(n = 0; n < l.n; ++n){
-            int index = entry_index(l, b, n*l.w*l.h, 0);
-            activate_array(l.output + index, 2*l.w*l.h, LOGISTIC);
-            index = entry_index(l, b, n*l.w*l.h, l.coords);
-            if(!l.background) activate_array(l.output + index,   l.w*l.h, LOGISTIC);
+    int wh = l->w*l->h;
+    int c, g, k;
+    for(c = 0; c < l->coords + l->classes + 1; ++c){
+        memcpy(out + c*wh, in + c*wh, count*sizeof(float));
+    }
+    activate_array(out, count, LOGISTIC);
+    activate_array(out + wh, count, LOGISTIC);
+    if(!l->background) activate_array(out + l->coords*wh, count, LOGISTIC);
+    if(l->softmax_tree){
+        tree *hier = l->softmax_tree;
+        for(g = 0; g < hier->groups; ++g){
+            c = l->coords + 1 + hier->group_offset[g];
+            for(k = 0; k < count; ++k){
+                softmax(in + c*wh + k, hier->group_size[g], l->temperature, wh, out + c*wh + k);
+            }
+        }
+    } else if(l->softmax){
+        c = l->coords + !l->background;
+        for(k = 0; k < count; ++k){
+            softmax(in + c*wh + k, l->classes + l->background, 1, wh, out + c*wh + k);
         }
     }
-    if (l.softmax_tree){
-        int i;
-        int count = l.coords + 1;
-        for (i = 0; i < l.softmax_tree->groups; ++i) {
-            int group_size = l.softmax_tree->group_size[i];
-            softmax_cpu(net.input + count, group_size, l.batch, l.inputs, l.n*l.w*l.h, 1, l.n*l.w*l.h, l.temperature, l.output + count);
-            count += group_size;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REGION_X86
+#include <immintrin.h>
+
+/* Cephes expf: 2^round(x*log2e) times a degree-5 polynomial of the rest. */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) __m256 region_exp_avx2(__m256 x)
+{
+    __m256 fx, y, z;
+    __m256i e;
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.33f)), _mm256_set1_ps(88.f));
+    fx = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+    z = _mm256_mul_ps(x, x);
+    y = _mm256_set1_ps(1.9875691500e-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+    y = _mm256_fmadd_ps(y, z, _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+    e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void region_logistic_avx2(const float *in, float *out, __m256i m)
+{
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 e = region_exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_maskload_ps(in, m)));
+    _mm256_maskstore_ps(out, m, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+}
+
+/* Softmax over n channels wh apart, one location per lane. */
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void region_softmax_avx2(const float *in, float *out, int n, int wh, float temp, __m256i m)
+{
+    __m256 big = _mm256_set1_ps(-FLT_MAX);
+    __m256 sum = _mm256_setzero_ps();
+    __m256 t = _mm256_set1_ps(1.f/temp);
+    int c;
+    for(c = 0; c < n; ++c) big = _mm256_max_ps(big, _mm256_maskload_ps(in + c*wh, m));
+    for(c = 0; c < n; ++c){
+        __m256 e = region_exp_avx2(_mm256_mul_ps(_mm256_sub_ps(_mm256_maskload_ps(in + c*wh, m), big), t));
+        _mm256_maskstore_ps(out + c*wh, m, e);
+        sum = _mm256_add_ps(sum, e);
+    }
+    sum = _mm256_div_ps(_mm256_set1_ps(1.f), sum);
+    for(c = 0; c < n; ++c){
+        _mm256_maskstore_ps(out + c*wh, m, _mm256_mul_ps(_mm256_maskload_ps(out + c*wh, m), sum));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) __m256i region_mask_avx2(int n)
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+/* Softmax groups are swept over the whole tile one at a time, so a group's
+ * channels stay in cache even when the tree has thousands of classes. */
+__attribute__((target("avx2,fma")))
+static void region_block_avx2(const layer *l, float *in, float *out, int count)
+{
+    int wh = l->w*l->h;
+    int k, c, g;
+    for(k = 0; k < count; k += 8){
+        float *x = in + k;
+        float *y = out + k;
+        __m256i m = region_mask_avx2(count - k);
+        region_logistic_avx2(x, y, m);
+        region_logistic_avx2(x + wh, y + wh, m);
+        for(c = 2; c < l->coords; ++c) _mm256_maskstore_ps(y + c*wh, m, _mm256_maskload_ps(x + c*wh, m));
+        c = l->coords;
+        if(l->background) _mm256_maskstore_ps(y + c*wh, m, _mm256_maskload_ps(x + c*wh, m));
+        else region_logistic_avx2(x + c*wh, y + c*wh, m);
+    }
+    if(l->softmax_tree){
+        tree *hier = l->softmax_tree;
+        for(g = 0; g < hier->groups; ++g){
+            c = l->coords + 1 + hier->group_offset[g];
+            for(k = 0; k < count; k += 8){
+                region_softmax_avx2(in + c*wh + k, out + c*wh + k, hier->group_size[g], wh, l->temperature, region_mask_avx2(count - k));
+            }
+        }
+    } else if(l->softmax){
+        c = l->coords + !l->background;
+        for(k = 0; k < count; k += 8){
+            region_softmax_avx2(in + c*wh + k, out + c*wh + k, l->classes + l->background, wh, 1, region_mask_avx2(count - k));
+        }
+    } else {
+        for(c = l->coords + 1; c < l->coords + l->classes + 1; ++c){
+            memcpy(out + c*wh, in + c*wh, count*sizeof(float));
         }
-    } else if (l.softmax){
-        int index = entry_index(l, 0, 0, l.coords + !l.background);
-        softmax_cpu(net.input + index, l.classes + l.background, l.batch*l.n, l.inputs/l.n, l.w*l.h, 1, l.w*l.h, 1, l.output + index);
     }
+}
+#endif
+
+static pthread_once_t region_block_once = PTHREAD_ONCE_INIT;
+static region_block_fn region_block_selected;
+
+static void init_region_block()
+{
+    region_block_fn f = region_block_scalar;
+#ifdef REGION_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) f = region_block_avx2;
+#endif
+    region_block_selected = f;
+}
+
+static region_block_fn get_region_block()
+{
+    pthread_once(&region_block_once, init_region_block);
+    return region_block_selected;
+}
+
+/* Tile t covers REGION_TILE locations of one anchor of one image. */
+static void region_activate_tile(int t, void *ptr)
+{
+    region_job *job = ptr;
+    const layer *l = job->l;
+    int wh = l->w*l->h;
+    int plane = t / job->tiles;
+    int start = (t % job->tiles)*REGION_TILE;
+    int count = (wh - start < REGION_TILE) ? wh - start : REGION_TILE;
+    size_t offset = (size_t)plane*wh*(l->coords + l->classes + 1) + start;
+    job->block(l, job->in + offset, job->out + offset, count);
+}
+
+void forward_region_layer(const layer l, network net)
+{
+    int i,j,b,t,n;
+
+#ifndef GPU
+    region_job job;
+    job.l = &l;
+    job.in = net.input;
+    job.out = l.output;
+    job.block = get_region_block();
+    job.tiles = (l.w*l.h + REGION_TILE - 1)/REGION_TILE;
+    parallel_for(l.batch*l.n*job.tiles, region_activate_tile, &job);
+#else
+    memcpy(l.output, net.input, l.outputs*l.batch*sizeof(float));
 #endif
 
     memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
@@ -361,10 +532,10 @@ void correct_region_boxes(box *boxes, int n, int w, int h, int netw, int neth, i
     }
 }
 
-void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, float **probs, box *boxes, float **masks, int only_objectness, int *map, float tree_thresh, int relative)
+/* With batch 2 the second image is the mirrored input; fold it into the first. */
+static void average_flipped_output(layer l)
 {
     int i,j,n,z;
-    float *predictions = l.output;
     if (l.batch == 2) {
         float *flip = l.output + l.outputs;
         for (j = 0; j < l.h; ++j) {
@@ -388,6 +559,19 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, f
             l.output[i] = (l.output[i] + flip[i])/2.;
         }
     }
+}
+
+void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, float **probs, box *boxes, float **masks, int only_objectness, int *map, float tree_thresh, int relative)
+{
+    int i,j,n;
+    float *predictions = l.output;
+    average_flipped_output(l);
+    if(l.softmax_tree){
+        for(n = 0; n < l.n; ++n){
+            int class_index = entry_index(l, 0, n*l.w*l.h, l.coords + !l.background);
+            hierarchy_predictions_spatial(predictions + class_index, l.classes, l.softmax_tree, 0, l.w*l.h, l.w*l.h);
+        }
+    }
     for (i = 0; i < l.w*l.h; ++i){
         int row = i / l.w;
         int col = i % l.w;
@@ -409,8 +593,6 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, f
 
             int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + !l.background);
             if(l.softmax_tree){
-
-                hierarchy_predictions(predictions + class_index, l.classes, l.softmax_tree, 0, l.w*l.h);
                 if(map){
                     for(j = 0; j < 200; ++j){
                         int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1 + map[j]);
@@ -419,7 +601,8 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, f
                     }
                 } else {
                     int j =  hierarchy_top_prediction(predictions + class_index, l.softmax_tree, tree_thresh, l.w*l.h);
-                    probs[index][j] = (scale > thresh) ? scale : 0;
+                    /* -1 when even the root's best guess fails tree_thresh. */
+                    if(j >= 0) probs[index][j] = (scale > thresh) ? scale : 0;
                     probs[index][l.classes] = scale;
                 }
             } else {
@@ -450,6 +633,102 @@ void get_region_boxes(layer l, int w, int h, int netw, int neth, float thresh, f
     correct_region_boxes(boxes, l.w*l.h*l.n, w, h, netw, neth, relative);
 }
 
+static detection *push_detection(detection *dets, int *n, int *cap, detection d)
+{
+    if(*n == *cap){
+        *cap = *cap ? 2**cap : 64;
+        dets = realloc(dets, *cap*sizeof(detection));
+    }
+    dets[(*n)++] = d;
+    return dets;
+}
+
+/*
+ * Sparse counterpart of get_region_boxes. No class score can beat thresh
+ * unless the objectness does, so anchors are filtered on objectness first
+ * and only the survivors get their box decoded and their classes scanned.
+ * Returns one record per (anchor, class) scoring above thresh, the same
+ * entries get_region_boxes leaves non-zero in probs, ordered by anchor
+ * index and then class.
+ */
+detection *get_region_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, float tree_thresh, int relative, int *num)
+{
+    int i,j,n;
+    int count = 0;
+    int cap = 0;
+    detection *dets = 0;
+    float *predictions = l.output;
+    average_flipped_output(l);
+    for(n = 0; n < l.n; ++n){
+        int chained = 0;
+        for (i = 0; i < l.w*l.h; ++i){
+            int row = i / l.w;
+            int col = i % l.w;
+            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, l.coords);
+            float scale = l.background ? 1 : predictions[obj_index];
+            if(scale <= thresh) continue;
+
+            int first = count;
+            detection d = {{0}};
+            int box_index  = entry_index(l, 0, n*l.w*l.h + i, 0);
+            int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + !l.background);
+            d.bbox = get_region_box(predictions, l.biases, n, box_index, col, row, l.w, l.h, l.w*l.h);
+            correct_region_boxes(&d.bbox, 1, w, h, netw, neth, relative);
+            d.index = n*l.w*l.h + i;
+
+            if(l.softmax_tree){
+                /* Chain the whole anchor plane at once, the first time one of its locations is kept. */
+                if(!chained){
+                    hierarchy_predictions_spatial(predictions + class_index - i, l.classes, l.softmax_tree, 0, l.w*l.h, l.w*l.h);
+                    chained = 1;
+                }
+                if(map){
+                    for(j = 0; j < 200; ++j){
+                        int class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1 + map[j]);
+                        d.prob = scale*predictions[class_index];
+                        d.class = j;
+                        if(d.prob > thresh) dets = push_detection(dets, &count, &cap, d);
+                    }
+                    for(j = first; j < count; ++j) if(dets[j].prob > d.max_prob) d.max_prob = dets[j].prob;
+                } else {
+                    d.class = hierarchy_top_prediction(predictions + class_index, l.softmax_tree, tree_thresh, l.w*l.h);
+                    d.prob = d.max_prob = scale;
+                    if(d.class >= 0) dets = push_detection(dets, &count, &cap, d);
+                }
+            } else {
+                class_index = entry_index(l, 0, n*l.w*l.h + i, l.coords + 1);
+                for(j = 0; j < l.classes; ++j){
+                    float prob = scale*predictions[class_index + j*l.w*l.h];
+                    if(prob > d.max_prob) d.max_prob = prob;
+                    if(prob > thresh){
+                        d.class = j;
+                        d.prob = prob;
+                        dets = push_detection(dets, &count, &cap, d);
+                    }
+                }
+            }
+            for(j = first; j < count; ++j){
+                dets[j].max_prob = d.max_prob;
+                if(l.coords > 4){
+                    int mask_index = entry_index(l, 0, n*l.w*l.h + i, 4);
+                    int k;
+                    dets[j].mask = calloc(l.coords - 4, sizeof(float));
+                    for(k = 0; k < l.coords - 4; ++k) dets[j].mask[k] = predictions[mask_index + k*l.w*l.h];
+                }
+            }
+        }
+    }
+    *num = count;
+    return dets;
+}
+
+void free_detections(detection *dets, int n)
+{
+    int i;
+    for(i = 0; i < n; ++i) free(dets[i].mask);
+    free(dets);
+}
+
 #ifdef GPU
 
 void forward_region_layer_gpu(const layer l, network net)
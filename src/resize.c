@@ -0,0 +1,314 @@
+#include "image.h"
+#include "image_u8.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Bilinear resizing and letterboxing. The sample positions and weights of
+ * every output column and row are worked out once into tables, then each
+ * output row is a blend of two source rows that were resampled across
+ * with those tables. Only the two source rows the current output row
+ * needs are kept, so shrinking a large image touches just the rows that
+ * are actually sampled, and the result goes straight into the caller's
+ * buffer, at an offset when letterboxing. The AVX2 kernels gather eight
+ * columns at a time and, like the scalar ones, compute w0*a + w1*b
+ * without fma, so every path rounds like the old get_pixel loops.
+ *
+ * Sources are either planar float images or interleaved 8-bit images,
+ * which are converted a row at a time as rows are needed.
+ */
+
+typedef struct{
+    int n;
+    int *i0;
+    int *i1;
+    float *w0;
+    float *w1;
+} resize_axis;
+
+typedef struct{
+    float *data;
+    unsigned char *bytes;
+    int w, h, c;
+} resize_source;
+
+typedef struct{
+    void (*row)(const float *src, const resize_axis *a, float *dst);
+    void (*blend)(const float *a, const float *b, float w0, float w1, int n, float *dst);
+} resize_kernels;
+
+/* The last sample takes the last source pixel, as the old resize did. */
+static resize_axis make_resize_axis(int src, int dst)
+{
+    resize_axis a;
+    float scale = (float)(src - 1) / (dst - 1);
+    int i;
+    a.n = dst;
+    a.i0 = calloc(dst, sizeof(int));
+    a.i1 = calloc(dst, sizeof(int));
+    a.w0 = calloc(dst, sizeof(float));
+    a.w1 = calloc(dst, sizeof(float));
+    for(i = 0; i < dst; ++i){
+        if(i == dst-1 || src == 1){
+            a.i0[i] = a.i1[i] = src - 1;
+            a.w0[i] = 1;
+            a.w1[i] = 0;
+        } else {
+            float s = i*scale;
+            int j = (int) s;
+            float d = s - j;
+            a.i0[i] = j;
+            a.i1[i] = (j + 1 < src) ? j + 1 : src - 1;
+            a.w0[i] = 1 - d;
+            a.w1[i] = d;
+        }
+    }
+    return a;
+}
+
+static void free_resize_axis(resize_axis a)
+{
+    free(a.i0);
+    free(a.i1);
+    free(a.w0);
+    free(a.w1);
+}
+
+static void resize_row_scalar(const float *src, const resize_axis *a, float *dst)
+{
+    int i;
+    for(i = 0; i < a->n; ++i) dst[i] = a->w0[i]*src[a->i0[i]] + a->w1[i]*src[a->i1[i]];
+}
+
+static void blend_rows_scalar(const float *a, const float *b, float w0, float w1, int n, float *dst)
+{
+    int i;
+    for(i = 0; i < n; ++i) dst[i] = w0*a[i] + w1*b[i];
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESIZE_X86
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static void resize_row_avx2(const float *src, const resize_axis *a, float *dst)
+{
+    int i;
+    for(i = 0; i + 8 <= a->n; i += 8){
+        __m256 p = _mm256_i32gather_ps(src, _mm256_loadu_si256((const __m256i *)(a->i0 + i)), 4);
+        __m256 q = _mm256_i32gather_ps(src, _mm256_loadu_si256((const __m256i *)(a->i1 + i)), 4);
+        p = _mm256_mul_ps(_mm256_loadu_ps(a->w0 + i), p);
+        q = _mm256_mul_ps(_mm256_loadu_ps(a->w1 + i), q);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(p, q));
+    }
+    for(; i < a->n; ++i) dst[i] = a->w0[i]*src[a->i0[i]] + a->w1[i]*src[a->i1[i]];
+}
+
+__attribute__((target("avx2")))
+static void blend_rows_avx2(const float *a, const float *b, float w0, float w1, int n, float *dst)
+{
+    __m256 v0 = _mm256_set1_ps(w0);
+    __m256 v1 = _mm256_set1_ps(w1);
+    int i;
+    for(i = 0; i + 8 <= n; i += 8){
+        __m256 p = _mm256_mul_ps(v0, _mm256_loadu_ps(a + i));
+        __m256 q = _mm256_mul_ps(v1, _mm256_loadu_ps(b + i));
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(p, q));
+    }
+    for(; i < n; ++i) dst[i] = w0*a[i] + w1*b[i];
+}
+#endif
+
+static const resize_kernels scalar_kernels = {resize_row_scalar, blend_rows_scalar};
+#ifdef RESIZE_X86
+static const resize_kernels avx2_kernels = {resize_row_avx2, blend_rows_avx2};
+#endif
+static pthread_once_t resize_kernels_once = PTHREAD_ONCE_INIT;
+static const resize_kernels *resize_kernels_selected;
+
+static void init_resize_kernels()
+{
+    const resize_kernels *k = &scalar_kernels;
+#ifdef RESIZE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) k = &avx2_kernels;
+#endif
+    resize_kernels_selected = k;
+}
+
+static const resize_kernels *get_resize_kernels()
+{
+    pthread_once(&resize_kernels_once, init_resize_kernels);
+    return resize_kernels_selected;
+}
+
+typedef struct{
+    resize_source src;
+    resize_axis *ax;
+    const resize_kernels *k;
+    float *line;
+    float *buf[2];
+    int y[2];
+} resize_rows;
+
+/* Source row y resampled across, all channels; keep is not overwritten. */
+static float *resized_row(resize_rows *r, int y, float *keep)
+{
+    resize_source s = r->src;
+    int i, k, slot;
+    for(slot = 0; slot < 2; ++slot){
+        if(r->y[slot] == y) return r->buf[slot];
+    }
+    slot = (r->buf[0] == keep || (r->buf[1] != keep && r->y[1] < r->y[0])) ? 1 : 0;
+    for(k = 0; k < s.c; ++k){
+        float *src = r->line;
+        if(s.bytes){
+            unsigned char *p = s.bytes + (size_t)y*s.w*s.c + k;
+            for(i = 0; i < s.w; ++i) r->line[i] = (float)p[i*s.c]/255.;
+        } else {
+            src = s.data + (size_t)k*s.w*s.h + (size_t)y*s.w;
+        }
+        r->k->row(src, r->ax, r->buf[slot] + (size_t)k*r->ax->n);
+    }
+    r->y[slot] = y;
+    return r->buf[slot];
+}
+
+/* Resizes s to w x h and writes it at (dx, dy) of the planar out_w x out_h
+ * image out, leaving the rest of out alone. */
+static void resize_into(resize_source s, int w, int h, float *out, int out_w, int out_h, int dx, int dy)
+{
+    resize_axis ax = make_resize_axis(s.w, w);
+    resize_axis ay = make_resize_axis(s.h, h);
+    resize_rows r;
+    int row, k;
+    r.src = s;
+    r.ax = &ax;
+    r.k = get_resize_kernels();
+    r.line = s.bytes ? calloc(s.w, sizeof(float)) : 0;
+    r.buf[0] = calloc((size_t)2*w*s.c, sizeof(float));
+    r.buf[1] = r.buf[0] + (size_t)w*s.c;
+    r.y[0] = r.y[1] = -1;
+    for(row = 0; row < h; ++row){
+        float *a = resized_row(&r, ay.i0[row], 0);
+        float *b = resized_row(&r, ay.i1[row], a);
+        for(k = 0; k < s.c; ++k){
+            float *dst = out + (size_t)k*out_w*out_h + (size_t)(dy + row)*out_w + dx;
+            r.k->blend(a + (size_t)k*w, b + (size_t)k*w, ay.w0[row], ay.w1[row], w, dst);
+        }
+    }
+    free(r.line);
+    free(r.buf[0]);
+    free_resize_axis(ax);
+    free_resize_axis(ay);
+}
+
+image resize_image(image im, int w, int h)
+{
+    image resized = make_image(w, h, im.c);
+    resize_source s = {im.data, 0, im.w, im.h, im.c};
+    resize_into(s, w, h, resized.data, w, h, 0, 0);
+    return resized;
+}
+
+static void letterbox_size(int src_w, int src_h, int w, int h, int *new_w, int *new_h)
+{
+    if (((float)w/src_w) < ((float)h/src_h)) {
+        *new_w = w;
+        *new_h = (src_h * w)/src_w;
+    } else {
+        *new_h = h;
+        *new_w = (src_w * h)/src_h;
+    }
+}
+
+/* Fills everything outside the new_w x new_h box centred in boxed with .5. */
+static void fill_letterbox_border(image boxed, int new_w, int new_h)
+{
+    int dx = (boxed.w - new_w)/2;
+    int dy = (boxed.h - new_h)/2;
+    int k, y, x;
+    for(k = 0; k < boxed.c; ++k){
+        float *p = boxed.data + (size_t)k*boxed.w*boxed.h;
+        for(y = 0; y < boxed.h; ++y){
+            float *row = p + (size_t)y*boxed.w;
+            if(y < dy || y >= dy + new_h){
+                for(x = 0; x < boxed.w; ++x) row[x] = .5;
+                continue;
+            }
+            for(x = 0; x < dx; ++x) row[x] = .5;
+            for(x = dx + new_w; x < boxed.w; ++x) row[x] = .5;
+        }
+    }
+}
+
+static void letterbox_source(resize_source s, image boxed)
+{
+    int new_w, new_h;
+    letterbox_size(s.w, s.h, boxed.w, boxed.h, &new_w, &new_h);
+    fill_letterbox_border(boxed, new_w, new_h);
+    resize_into(s, new_w, new_h, boxed.data, boxed.w, boxed.h, (boxed.w-new_w)/2, (boxed.h-new_h)/2);
+}
+
+/* boxed may wrap any w*h*im.c buffer, e.g. float_to_image over net->input. */
+void letterbox_image_into(image im, int w, int h, image boxed)
+{
+    resize_source s = {im.data, 0, im.w, im.h, im.c};
+    boxed.w = w;
+    boxed.h = h;
+    letterbox_source(s, boxed);
+}
+
+image letterbox_image(image im, int w, int h)
+{
+    image boxed = make_image(w, h, im.c);
+    letterbox_image_into(im, w, h, boxed);
+    return boxed;
+}
+
+static resize_source u8_source(image_u8 im)
+{
+    resize_source s = {0, im.data, im.w, im.h, im.c};
+    return s;
+}
+
+/* Resizes im into the planar w x h float image out. */
+void resize_image_u8_into(image_u8 im, int w, int h, float *out)
+{
+    resize_into(u8_source(im), w, h, out, w, h, 0, 0);
+}
+
+/* Rounds to the nearest byte, as quantizing resize_image's result would. */
+image_u8 resize_image_u8(image_u8 im, int w, int h)
+{
+    image_u8 out = make_image_u8(w, h, im.c);
+    float *tmp = calloc((size_t)w*h*im.c, sizeof(float));
+    int i, k;
+    resize_image_u8_into(im, w, h, tmp);
+    for(k = 0; k < im.c; ++k){
+        float *p = tmp + (size_t)k*w*h;
+        for(i = 0; i < w*h; ++i) out.data[(size_t)i*im.c + k] = (unsigned char)(constrain(0, 1, p[i])*255 + .5);
+    }
+    free(tmp);
+    return out;
+}
+
+void letterbox_image_u8_into(image_u8 im, image boxed)
+{
+    letterbox_source(u8_source(im), boxed);
+}
+
+/* Decodes filename and letterboxes it into boxed (3 channels) without a
+ * full-size float copy of the image. *w and *h get the decoded size. */
+void load_image_letterbox(char *filename, image boxed, int *w, int *h)
+{
+    image_u8 im = load_image_u8(filename);
+    letterbox_image_u8_into(im, boxed);
+    *w = im.w;
+    *h = im.h;
+    free_image_u8(im);
+}
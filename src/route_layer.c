@@ -22,7 +22,7 @@ route_layer make_route_layer(int batch, int n, int *input_layers, int *input_siz
     fprintf(stderr, "\n");
     l.outputs = outputs;
     l.inputs = outputs;
-    l.delta =  calloc(outputs*batch, sizeof(float));
+    l.delta =  training_calloc(outputs*batch, sizeof(float));
     l.output = calloc(outputs*batch, sizeof(float));;
 
     l.forward = forward_route_layer;
@@ -59,7 +59,7 @@ void resize_route_layer(route_layer *l, network *net)
         }
     }
     l->inputs = l->outputs;
-    l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
+    if(l->delta) l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
     l->output = realloc(l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
@@ -79,6 +79,11 @@ void forward_route_layer(const route_layer l, network net)
         int index = l.input_layers[i];
         float *input = net.layers[index].output;
         int input_size = l.input_sizes[i];
+        // Planned inputs already write into their slice.
+        if(input == l.output + offset){
+            offset += input_size;
+            continue;
+        }
         for(j = 0; j < l.batch; ++j){
             copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
         }
@@ -94,6 +99,10 @@ void backward_route_layer(const route_layer l, network net)
         int index = l.input_layers[i];
         float *delta = net.layers[index].delta;
         int input_size = l.input_sizes[i];
+        if(delta == l.delta + offset){
+            offset += input_size;
+            continue;
+        }
         for(j = 0; j < l.batch; ++j){
             axpy_cpu(input_size, 1, l.delta + offset + j*l.outputs, 1, delta + j*input_size, 1);
         }
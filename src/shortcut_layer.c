@@ -23,7 +23,7 @@ layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int
 
     l.index = index;
 
-    l.delta =  calloc(l.outputs*batch, sizeof(float));
+    l.delta =  training_calloc(l.outputs*batch, sizeof(float));
     l.output = calloc(l.outputs*batch, sizeof(float));;
 
     l.forward = forward_shortcut_layer;
@@ -40,6 +40,8 @@ layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int
 
 void forward_shortcut_layer(const layer l, network net)
 {
+    /* Written by the convolution in front of it, see fuse_shortcut_network. */
+    if(l.fused && !net.train) return;
     copy_cpu(l.outputs*l.batch, net.input, 1, l.output, 1);
     shortcut_cpu(l.batch, l.w, l.h, l.c, net.layers[l.index].output, l.out_w, l.out_h, l.out_c, l.output);
     activate_array(l.output, l.outputs*l.batch, l.activation);
@@ -23,7 +23,7 @@ shuffle_layer make_shuffle_layer(int batch, int h, int w, int c, int groups) {
     l.outputs = outputs;
     l.inputs = outputs;
     l.output = calloc(outputs * batch, sizeof (float));
-    l.delta = calloc(outputs * batch, sizeof (float));
+    l.delta = training_calloc(outputs * batch, sizeof (float));
 
     l.forward = forward_shuffle_layer;
     l.backward = backward_shuffle_layer;
@@ -47,7 +47,7 @@ void resize_shuffle_layer(shuffle_layer *l, int w, int h) {
     l->outputs = outputs;
     l->inputs = l->outputs;
     l->output = realloc(l->output, l->outputs * l->batch * sizeof (float));
-    l->delta = realloc(l->delta, l->outputs * l->batch * sizeof (float));
+    if(l->delta) l->delta = realloc(l->delta, l->outputs * l->batch * sizeof (float));
 
 #ifdef GPU
     cuda_free(l->output_gpu);
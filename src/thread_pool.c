@@ -0,0 +1,302 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "darknet.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * One persistent pool runs every parallel piece of work in darknet: data
+ * loading tasks, per-frame demo work and the parallel loops of the CPU
+ * kernels. Each worker owns a deque; a worker pushes and pops its own tasks
+ * at the back and steals from the front of the others' when it runs dry.
+ * Tasks submitted from outside the pool go to one shared queue.
+ *
+ * A worker waiting on a task keeps running queued tasks instead of blocking,
+ * so tasks can wait on tasks they submitted without starving the pool. A
+ * parallel_for is split into chunks the caller and up to threads-1 workers
+ * claim from a shared counter, so a busy pool only slows it down instead of
+ * deadlocking it.
+ *
+ * The pool starts on first use with $DARKNET_THREADS threads, or one per
+ * online CPU, unless thread_pool_init was called first.
+ */
+
+struct task{
+    void (*fn)(void *);
+    void *arg;
+    int done;
+    int detached;
+};
+
+typedef struct{
+    pthread_mutex_t lock;
+    task **items;
+    int head;
+    int size;
+    int cap;
+} task_queue;
+
+typedef struct{
+    void (*body)(int i, void *arg);
+    void *arg;
+    int n;
+    int grain;
+    int next;
+    int done;
+    int refs;
+} parallel_job;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static int pool_threads;
+static int pool_affinity;
+static int pool_queued;
+static int pool_sleeping;
+static task_queue *pool_queues;
+static __thread int worker_id = -1;
+
+/* Spins before sleeping; short parallel loops finish well within this. */
+#define POOL_SPIN 4000
+
+static void push_task(task_queue *q, task *t)
+{
+    pthread_mutex_lock(&q->lock);
+    if(q->size == q->cap){
+        int i;
+        int cap = q->cap ? 2*q->cap : 64;
+        task **items = calloc(cap, sizeof(task *));
+        for(i = 0; i < q->size; ++i) items[i] = q->items[(q->head + i) % q->cap];
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->cap = cap;
+    }
+    q->items[(q->head + q->size) % q->cap] = t;
+    ++q->size;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static task *pop_task(task_queue *q, int back)
+{
+    task *t = 0;
+    if(!__atomic_load_n(&q->size, __ATOMIC_RELAXED)) return 0;
+    pthread_mutex_lock(&q->lock);
+    if(q->size){
+        if(back){
+            t = q->items[(q->head + q->size - 1) % q->cap];
+        } else {
+            t = q->items[q->head];
+            q->head = (q->head + 1) % q->cap;
+        }
+        --q->size;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return t;
+}
+
+/* Own deque first, newest task first, then the oldest task of anyone else. */
+static task *find_task(int id)
+{
+    int i;
+    task *t;
+    if(id >= 0 && (t = pop_task(pool_queues + id, 1))) goto found;
+    for(i = 0; i <= pool_threads; ++i){
+        int q = (id + 1 + i) % (pool_threads + 1);
+        if((t = pop_task(pool_queues + q, 0))) goto found;
+    }
+    return 0;
+found:
+    __atomic_sub_fetch(&pool_queued, 1, __ATOMIC_RELAXED);
+    return t;
+}
+
+static void notify_pool()
+{
+    pthread_mutex_lock(&pool_lock);
+    if(pool_sleeping) pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void run_task(task *t)
+{
+    t->fn(t->arg);
+    if(t->detached){
+        free(t);
+        return;
+    }
+    __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+    notify_pool();
+}
+
+/* Returns once done becomes nonzero, running queued tasks meanwhile if
+ * called from a worker. */
+static void wait_until(int *done)
+{
+    int spin = 0;
+    while(!__atomic_load_n(done, __ATOMIC_ACQUIRE)){
+        task *t = worker_id >= 0 ? find_task(worker_id) : 0;
+        if(t){
+            run_task(t);
+            spin = 0;
+            continue;
+        }
+        if(++spin < POOL_SPIN){
+            sched_yield();
+            continue;
+        }
+        pthread_mutex_lock(&pool_lock);
+        ++pool_sleeping;
+        while(!__atomic_load_n(done, __ATOMIC_ACQUIRE)
+                && (worker_id < 0 || !__atomic_load_n(&pool_queued, __ATOMIC_RELAXED))){
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        }
+        --pool_sleeping;
+        pthread_mutex_unlock(&pool_lock);
+        spin = 0;
+    }
+}
+
+static void *pool_worker(void *ptr)
+{
+    worker_id = (int)(size_t)ptr;
+#ifdef __linux__
+    if(pool_affinity){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker_id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+    while(1){
+        task *t = find_task(worker_id);
+        if(t){
+            run_task(t);
+            continue;
+        }
+        pthread_mutex_lock(&pool_lock);
+        ++pool_sleeping;
+        while(!__atomic_load_n(&pool_queued, __ATOMIC_RELAXED)) pthread_cond_wait(&pool_cond, &pool_lock);
+        --pool_sleeping;
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return 0;
+}
+
+static void start_thread_pool()
+{
+    int i;
+    char *env = getenv("DARKNET_THREADS");
+    if(!pool_threads && env) pool_threads = atoi(env);
+    if(pool_threads <= 0) pool_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(pool_threads <= 0) pool_threads = 1;
+    pool_queues = calloc(pool_threads + 1, sizeof(task_queue));
+    for(i = 0; i <= pool_threads; ++i) pthread_mutex_init(&pool_queues[i].lock, 0);
+    for(i = 0; i < pool_threads; ++i){
+        pthread_t thread;
+        if(pthread_create(&thread, 0, pool_worker, (void *)(size_t)i)) error("Thread creation failed");
+        pthread_detach(thread);
+    }
+}
+
+void thread_pool_init(int threads, int affinity)
+{
+    if(pool_queues){
+        fprintf(stderr, "Thread pool already running with %d threads\n", pool_threads);
+        return;
+    }
+    pool_threads = threads;
+    pool_affinity = affinity;
+    pthread_once(&pool_once, start_thread_pool);
+}
+
+int thread_pool_size()
+{
+    pthread_once(&pool_once, start_thread_pool);
+    return pool_threads;
+}
+
+static task *submit(void (*fn)(void *), void *arg, int detached)
+{
+    task *t = calloc(1, sizeof(task));
+    pthread_once(&pool_once, start_thread_pool);
+    t->fn = fn;
+    t->arg = arg;
+    t->detached = detached;
+    __atomic_add_fetch(&pool_queued, 1, __ATOMIC_RELAXED);
+    push_task(pool_queues + (worker_id >= 0 ? worker_id : pool_threads), t);
+    notify_pool();
+    return t;
+}
+
+task *submit_task(void (*fn)(void *), void *arg)
+{
+    return submit(fn, arg, 0);
+}
+
+void wait_task(task *t)
+{
+    if(!t) return;
+    wait_until(&t->done);
+    free(t);
+}
+
+static void release_parallel_job(parallel_job *job)
+{
+    if(__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) == 0) free(job);
+}
+
+static void run_parallel_job(parallel_job *job)
+{
+    int i, start;
+    while((start = __atomic_fetch_add(&job->next, job->grain, __ATOMIC_RELAXED)) < job->n){
+        int end = (start + job->grain < job->n) ? start + job->grain : job->n;
+        for(i = start; i < end; ++i) job->body(i, job->arg);
+        if(__atomic_add_fetch(&job->done, end - start, __ATOMIC_ACQ_REL) == job->n) notify_pool();
+    }
+}
+
+static void parallel_helper(void *ptr)
+{
+    run_parallel_job(ptr);
+    release_parallel_job(ptr);
+}
+
+void parallel_for(int n, void (*body)(int i, void *arg), void *arg)
+{
+    int i, chunks, helpers;
+    int threads = thread_pool_size();
+    parallel_job *job;
+    if(n <= 0) return;
+    if(threads == 1 || n == 1){
+        for(i = 0; i < n; ++i) body(i, arg);
+        return;
+    }
+    /* A few chunks per thread evens out uneven iterations. */
+    job = calloc(1, sizeof(parallel_job));
+    job->body = body;
+    job->arg = arg;
+    job->n = n;
+    job->grain = (n + 4*threads - 1) / (4*threads);
+    chunks = (n + job->grain - 1) / job->grain;
+    helpers = (chunks - 1 < threads - 1) ? chunks - 1 : threads - 1;
+    job->refs = helpers + 1;
+    for(i = 0; i < helpers; ++i) submit(parallel_helper, job, 1);
+    run_parallel_job(job);
+    /* Every chunk is claimed by now; wait for the ones still running. */
+    for(i = 0; i < POOL_SPIN && __atomic_load_n(&job->done, __ATOMIC_ACQUIRE) < n; ++i) sched_yield();
+    while(__atomic_load_n(&job->done, __ATOMIC_ACQUIRE) < n){
+        pthread_mutex_lock(&pool_lock);
+        ++pool_sleeping;
+        if(__atomic_load_n(&job->done, __ATOMIC_ACQUIRE) < n) pthread_cond_wait(&pool_cond, &pool_lock);
+        --pool_sleeping;
+        pthread_mutex_unlock(&pool_lock);
+    }
+    release_parallel_job(job);
+}
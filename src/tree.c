@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "tree.h"
 #include "utils.h"
 #include "data.h"
@@ -50,6 +51,27 @@ void hierarchy_predictions(float *predictions, int n, tree *hier, int only_leave
     }
 }
 
+/* hierarchy_predictions for spatial neighbouring locations at once. Each
+ * class is a contiguous run of locations, stride apart, so the products
+ * are taken a whole run at a time and the inner loops vectorize. */
+void hierarchy_predictions_spatial(float *predictions, int n, tree *hier, int only_leaves, int stride, int spatial)
+{
+    int j, k;
+    for(j = 0; j < n; ++j){
+        int parent = hier->parent[j];
+        if(parent >= 0){
+            float *p = predictions + j*stride;
+            float *q = predictions + parent*stride;
+            for(k = 0; k < spatial; ++k) p[k] *= q[k];
+        }
+    }
+    if(only_leaves){
+        for(j = 0; j < n; ++j){
+            if(!hier->leaf[j]) memset(predictions + j*stride, 0, spatial*sizeof(float));
+        }
+    }
+}
+
 int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int stride)
 {
     float p = 1;
@@ -3,6 +3,7 @@
 #include "darknet.h"
 
 tree *read_tree(char *filename);
+void hierarchy_predictions_spatial(float *predictions, int n, tree *hier, int only_leaves, int stride, int spatial);
 int hierarchy_top_prediction(float *predictions, tree *hier, float thresh, int stride);
 float get_hierarchy_probability(float *x, tree *hier, int c, int stride);
 
@@ -0,0 +1,307 @@
+#include "winograd.h"
+#include "darknet.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * Winograd minimal filtering F(4x4, 3x3) (Lavin & Gray). A stride-1 3x3
+ * convolution of a 6x6 input tile d into a 4x4 output tile is
+ *
+ *     Y = A^T [(G g G^T) .* (B^T d B)] A
+ *
+ * which takes 36 multiplies per tile and channel instead of 144. Summed over
+ * input channels, the elementwise products become 36 independent GEMMs
+ *
+ *     M[xi] (n x nt) = U[xi] (n x c) * V[xi] (c x nt)
+ *
+ * that do almost all of the work; the transforms themselves are just adds.
+ * U is stored [36][n][c], V [36][c][nt] and M [36][n][nt], so every GEMM
+ * operand is a plain row-major matrix. Tiles are numbered across the batch,
+ * tile t covering output rows 4*ty.. and columns 4*tx.. of image t/(th*tw).
+ */
+
+/* B^T x for one column or row of six inputs. */
+#define WINOGRAD_BT(x0, x1, x2, x3, x4, x5, y, s) \
+    y[0*(s)] = 4*(x0) - 5*(x2) + (x4); \
+    y[1*(s)] = -4*((x1) + (x2)) + (x3) + (x4); \
+    y[2*(s)] = 4*((x1) - (x2)) - (x3) + (x4); \
+    y[3*(s)] = 2*((x3) - (x1)) - (x2) + (x4); \
+    y[4*(s)] = 2*((x1) - (x3)) - (x2) + (x4); \
+    y[5*(s)] = 4*(x1) - 5*(x3) + (x5);
+
+/* A^T x: six transformed values to four outputs. */
+#define WINOGRAD_AT(x0, x1, x2, x3, x4, x5, y, s) \
+    y[0*(s)] = (x0) + ((x1) + (x2)) + ((x3) + (x4)); \
+    y[1*(s)] = ((x1) - (x2)) + 2*((x3) - (x4)); \
+    y[2*(s)] = ((x1) + (x2)) + 4*((x3) + (x4)); \
+    y[3*(s)] = ((x1) - (x2)) + 8*((x3) - (x4)) + (x5);
+
+/* G x: three filter taps to six. */
+#define WINOGRAD_G(x0, x1, x2, y, s) \
+    y[0*(s)] = (x0)/4; \
+    y[1*(s)] = -((x0) + (x1) + (x2))/6; \
+    y[2*(s)] = -((x0) - (x1) + (x2))/6; \
+    y[3*(s)] = (x0)/24 + (x1)/12 + (x2)/6; \
+    y[4*(s)] = (x0)/24 - (x1)/12 + (x2)/6; \
+    y[5*(s)] = (x2);
+
+typedef struct{
+    const float *weights;
+    int n, c;
+    float *u;
+} winograd_weights_args;
+
+static void winograd_transform_filter(int i, void *ptr)
+{
+    winograd_weights_args *a = ptr;
+    size_t step = (size_t)a->n*a->c;
+    float t[18];
+    int k, j;
+    for(k = 0; k < a->c; ++k){
+        const float *g = a->weights + ((size_t)i*a->c + k)*9;
+        float *dst = a->u + (size_t)i*a->c + k;
+        for(j = 0; j < 3; ++j){
+            WINOGRAD_G(g[j], g[3 + j], g[6 + j], (t + j), 3)
+        }
+        for(j = 0; j < 6; ++j){
+            const float *r = t + 3*j;
+            float *y = dst + 6*j*step;
+            WINOGRAD_G(r[0], r[1], r[2], y, step)
+        }
+    }
+}
+
+void winograd_transform_weights(const float *weights, int n, int c, float *u)
+{
+    winograd_weights_args a = {weights, n, c, u};
+    parallel_for(n, winograd_transform_filter, &a);
+}
+
+/*
+ * The tile transforms work on WINOGRAD_LANES consecutive tiles at a time,
+ * with the tile index innermost, so the arithmetic and the stores into V and
+ * loads from M are unit-stride vectors. Only the 6x6 gather and 4x4 scatter
+ * in image space stay scalar. The *_block functions are compiled once per
+ * target below and picked at runtime.
+ */
+#define WINOGRAD_LANES 16
+
+typedef void (*winograd_input_fn)(const float *im, int c, int h, int w, int pad, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *v);
+typedef void (*winograd_output_fn)(const float *m, int n, int out_h, int out_w, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *out);
+
+static inline __attribute__((always_inline)) void winograd_input_block(const float *im, int c, int h, int w,
+        int pad, int tiles_h, int tiles_w, int t0, int nt, int k, float *v)
+{
+    int tiles = tiles_h*tiles_w;
+    size_t step = (size_t)c*nt;
+    float d[36][WINOGRAD_LANES], t[36][WINOGRAD_LANES], y[36][WINOGRAD_LANES];
+    int i, j, l, n;
+    for(n = 0; n < nt; n += WINOGRAD_LANES){
+        int lanes = (nt - n < WINOGRAD_LANES) ? nt - n : WINOGRAD_LANES;
+        float *dst = v + (size_t)k*nt + n;
+        for(l = 0; l < lanes; ++l){
+            int tile = t0 + n + l;
+            int b = tile/tiles;
+            int y0 = tile%tiles/tiles_w*WINOGRAD_TILE - pad;
+            int x0 = tile%tiles%tiles_w*WINOGRAD_TILE - pad;
+            const float *src = im + ((size_t)b*c + k)*h*w;
+            if(y0 >= 0 && x0 >= 0 && y0 + 6 <= h && x0 + 6 <= w){
+                for(i = 0; i < 6; ++i){
+                    const float *r = src + (y0 + i)*w + x0;
+                    for(j = 0; j < 6; ++j) d[i*6 + j][l] = r[j];
+                }
+            } else {
+                for(i = 0; i < 6; ++i){
+                    int yy = y0 + i;
+                    for(j = 0; j < 6; ++j){
+                        int xx = x0 + j;
+                        d[i*6 + j][l] = (yy < 0 || xx < 0 || yy >= h || xx >= w) ? 0 : src[yy*w + xx];
+                    }
+                }
+            }
+        }
+        for(; l < WINOGRAD_LANES; ++l){
+            for(i = 0; i < 36; ++i) d[i][l] = 0;
+        }
+        for(j = 0; j < 6; ++j){
+            for(l = 0; l < WINOGRAD_LANES; ++l){
+                WINOGRAD_BT(d[j][l], d[6 + j][l], d[12 + j][l], d[18 + j][l], d[24 + j][l], d[30 + j][l],
+                        (&t[j][l]), 6*WINOGRAD_LANES)
+            }
+        }
+        for(i = 0; i < 6; ++i){
+            for(l = 0; l < WINOGRAD_LANES; ++l){
+                WINOGRAD_BT(t[6*i][l], t[6*i + 1][l], t[6*i + 2][l], t[6*i + 3][l], t[6*i + 4][l], t[6*i + 5][l],
+                        (&y[6*i][l]), WINOGRAD_LANES)
+            }
+        }
+        for(i = 0; i < 36; ++i){
+            float *o = dst + i*step;
+            if(lanes == WINOGRAD_LANES){
+                for(l = 0; l < WINOGRAD_LANES; ++l) o[l] = y[i][l];
+            } else {
+                for(l = 0; l < lanes; ++l) o[l] = y[i][l];
+            }
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void winograd_output_block(const float *m, int n, int out_h, int out_w,
+        int tiles_h, int tiles_w, int t0, int nt, int k, float *out)
+{
+    int tiles = tiles_h*tiles_w;
+    size_t step = (size_t)n*nt;
+    float x[36][WINOGRAD_LANES], t[24][WINOGRAD_LANES], y[16][WINOGRAD_LANES];
+    int i, j, l, p;
+    for(p = 0; p < nt; p += WINOGRAD_LANES){
+        int lanes = (nt - p < WINOGRAD_LANES) ? nt - p : WINOGRAD_LANES;
+        const float *src = m + (size_t)k*nt + p;
+        for(i = 0; i < 36; ++i){
+            const float *s = src + i*step;
+            if(lanes == WINOGRAD_LANES){
+                for(l = 0; l < WINOGRAD_LANES; ++l) x[i][l] = s[l];
+            } else {
+                for(l = 0; l < lanes; ++l) x[i][l] = s[l];
+                for(; l < WINOGRAD_LANES; ++l) x[i][l] = 0;
+            }
+        }
+        for(j = 0; j < 6; ++j){
+            for(l = 0; l < WINOGRAD_LANES; ++l){
+                WINOGRAD_AT(x[j][l], x[6 + j][l], x[12 + j][l], x[18 + j][l], x[24 + j][l], x[30 + j][l],
+                        (&t[j][l]), 6*WINOGRAD_LANES)
+            }
+        }
+        for(i = 0; i < 4; ++i){
+            for(l = 0; l < WINOGRAD_LANES; ++l){
+                WINOGRAD_AT(t[6*i][l], t[6*i + 1][l], t[6*i + 2][l], t[6*i + 3][l], t[6*i + 4][l], t[6*i + 5][l],
+                        (&y[4*i][l]), WINOGRAD_LANES)
+            }
+        }
+        for(l = 0; l < lanes; ++l){
+            int tile = t0 + p + l;
+            int b = tile/tiles;
+            int y0 = tile%tiles/tiles_w*WINOGRAD_TILE;
+            int x0 = tile%tiles%tiles_w*WINOGRAD_TILE;
+            float *dst = out + ((size_t)b*n + k)*out_h*out_w + y0*out_w + x0;
+            if(y0 + WINOGRAD_TILE <= out_h && x0 + WINOGRAD_TILE <= out_w){
+                for(i = 0; i < 4; ++i){
+                    for(j = 0; j < 4; ++j) dst[i*out_w + j] = y[4*i + j][l];
+                }
+            } else {
+                int rows = (out_h - y0 < WINOGRAD_TILE) ? out_h - y0 : WINOGRAD_TILE;
+                int cols = (out_w - x0 < WINOGRAD_TILE) ? out_w - x0 : WINOGRAD_TILE;
+                for(i = 0; i < rows; ++i){
+                    for(j = 0; j < cols; ++j) dst[i*out_w + j] = y[4*i + j][l];
+                }
+            }
+        }
+    }
+}
+
+static void winograd_input_scalar(const float *im, int c, int h, int w, int pad, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *v)
+{
+    winograd_input_block(im, c, h, w, pad, tiles_h, tiles_w, t0, nt, k, v);
+}
+
+static void winograd_output_scalar(const float *m, int n, int out_h, int out_w, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *out)
+{
+    winograd_output_block(m, n, out_h, out_w, tiles_h, tiles_w, t0, nt, k, out);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WINOGRAD_X86
+__attribute__((target("avx2,fma")))
+static void winograd_input_avx2(const float *im, int c, int h, int w, int pad, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *v)
+{
+    winograd_input_block(im, c, h, w, pad, tiles_h, tiles_w, t0, nt, k, v);
+}
+
+__attribute__((target("avx2,fma")))
+static void winograd_output_avx2(const float *m, int n, int out_h, int out_w, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *out)
+{
+    winograd_output_block(m, n, out_h, out_w, tiles_h, tiles_w, t0, nt, k, out);
+}
+
+__attribute__((target("avx512f")))
+static void winograd_input_avx512(const float *im, int c, int h, int w, int pad, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *v)
+{
+    winograd_input_block(im, c, h, w, pad, tiles_h, tiles_w, t0, nt, k, v);
+}
+
+__attribute__((target("avx512f")))
+static void winograd_output_avx512(const float *m, int n, int out_h, int out_w, int tiles_h, int tiles_w,
+        int t0, int nt, int k, float *out)
+{
+    winograd_output_block(m, n, out_h, out_w, tiles_h, tiles_w, t0, nt, k, out);
+}
+#endif
+
+static pthread_once_t winograd_isa_once = PTHREAD_ONCE_INIT;
+static int winograd_isa_selected;
+
+static void init_winograd_isa()
+{
+    int i = 0;
+#ifdef WINOGRAD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) i = 2;
+    else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) i = 1;
+#endif
+    winograd_isa_selected = i;
+}
+
+static int winograd_isa()
+{
+    pthread_once(&winograd_isa_once, init_winograd_isa);
+    return winograd_isa_selected;
+}
+
+/* Arguments of one tile transform pass; pool iterations are channels. */
+typedef struct{
+    winograd_input_fn input;
+    winograd_output_fn output;
+    const float *src;
+    int c, h, w, pad, tiles_h, tiles_w, t0, nt;
+    float *dst;
+} winograd_tiles_args;
+
+static void winograd_input_channel(int k, void *ptr)
+{
+    winograd_tiles_args *a = ptr;
+    a->input(a->src, a->c, a->h, a->w, a->pad, a->tiles_h, a->tiles_w, a->t0, a->nt, k, a->dst);
+}
+
+static void winograd_output_channel(int k, void *ptr)
+{
+    winograd_tiles_args *a = ptr;
+    a->output(a->src, a->c, a->h, a->w, a->tiles_h, a->tiles_w, a->t0, a->nt, k, a->dst);
+}
+
+void winograd_input_tiles(const float *im, int c, int h, int w, int pad, int tiles_h, int tiles_w,
+        int t0, int nt, float *v)
+{
+    winograd_tiles_args a = {winograd_input_scalar, 0, im, c, h, w, pad, tiles_h, tiles_w, t0, nt, v};
+#ifdef WINOGRAD_X86
+    if(winograd_isa() == 2) a.input = winograd_input_avx512;
+    else if(winograd_isa() == 1) a.input = winograd_input_avx2;
+#endif
+    parallel_for(c, winograd_input_channel, &a);
+}
+
+void winograd_output_tiles(const float *m, int n, int out_h, int out_w, int tiles_h, int tiles_w,
+        int t0, int nt, float *out)
+{
+    winograd_tiles_args a = {0, winograd_output_scalar, m, n, out_h, out_w, 0, tiles_h, tiles_w, t0, nt, out};
+#ifdef WINOGRAD_X86
+    if(winograd_isa() == 2) a.output = winograd_output_avx512;
+    else if(winograd_isa() == 1) a.output = winograd_output_avx2;
+#endif
+    parallel_for(n, winograd_output_channel, &a);
+}
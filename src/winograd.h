@@ -0,0 +1,14 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+/* F(4x4, 3x3): 6x6 input tiles, 4x4 output tiles, 36 transformed taps. */
+#define WINOGRAD_TILE 4
+#define WINOGRAD_TAPS 36
+
+void winograd_transform_weights(const float *weights, int n, int c, float *u);
+void winograd_input_tiles(const float *im, int c, int h, int w, int pad, int tiles_h, int tiles_w,
+        int t0, int nt, float *v);
+void winograd_output_tiles(const float *m, int n, int out_h, int out_w, int tiles_h, int tiles_w,
+        int t0, int nt, float *out);
+
+#endif